@@ -29,6 +29,13 @@ TARGETS = [
 			Platform.WINDOWS: windows_options
 		}
     ),
+    BuildTarget("anim_tool",
+        source_file="src/anim_tool.cpp",
+        type=TargetType.EXECUTABLE,
+        platform_options={
+			Platform.WINDOWS: windows_options
+		}
+    ),
     # BuildTarget("test_bench",
     #    source_file="src/test_bench.cpp",
     #    type=TargetType.EXECUTABLE,
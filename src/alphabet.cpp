@@ -232,8 +232,8 @@ bool LoadAlphabet(MemoryBlock memory, Alphabet* outAlphabet)
     return true;
 }
 
-void AlphabetAtlasUpdateAndRender(Alphabet* alphabet, const GameInput& input, MemoryBlock transient,
-                                  RectGL rectGL, TexturedRectGL texturedRectGL, TextGL textGL,
+void AlphabetAtlasUpdateAndRender(Alphabet* alphabet, RandomState* random, const GameInput& input,
+                                  MemoryBlock transient, RectGL rectGL, TexturedRectGL texturedRectGL, TextGL textGL,
                                   ScreenInfo screenInfo, const FontFace& fontText, const FontFace& fontHeader)
 {
     static bool panelInputMinimized = true;
@@ -285,7 +285,7 @@ void AlphabetAtlasUpdateAndRender(Alphabet* alphabet, const GameInput& input, Me
                 if (i >= inputStringPrev.size || inputString[i] != inputStringPrev[i]) {
                     int numVariations = alphabet->numVariations[inputString[i]];
                     if (numVariations > 0) {
-                        inputCharVariation[i] = rand() % numVariations;
+                        inputCharVariation[i] = RandInt(random, 0, numVariations);
                     }
                     else {
                         inputCharVariation[i] = 0;
@@ -5,6 +5,7 @@
 
 #include "asset_texture.h"
 #include "opengl_base.h"
+#include "random.h"
 #include "text.h"
 
 const uint64 MAX_LETTERS = 512;
@@ -46,6 +47,6 @@ struct Alphabet
 
 bool LoadAlphabet(MemoryBlock memory, Alphabet* outAlphabet);
 
-void AlphabetAtlasUpdateAndRender(Alphabet* alphabet, const GameInput& input, MemoryBlock transient,
-                                  RectGL rectGL, TexturedRectGL texturedRectGL, TextGL textGL,
+void AlphabetAtlasUpdateAndRender(Alphabet* alphabet, RandomState* random, const GameInput& input,
+                                  MemoryBlock transient, RectGL rectGL, TexturedRectGL texturedRectGL, TextGL textGL,
                                   ScreenInfo screenInfo, const FontFace& fontText, const FontFace& fontHeader);
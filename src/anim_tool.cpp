@@ -0,0 +1,389 @@
+#include <emmintrin.h>
+#include <stdio.h>
+#include <stdlib.h>
+#undef internal
+#include <chrono>
+#define internal static
+
+#include <km_common/km_debug.h>
+#include <km_common/km_lib.h>
+#include <km_common/km_log.h>
+#include <km_common/km_memory.h>
+#include <km_common/km_os.h>
+#include <km_common/km_string.h>
+
+#include "asset_animation.h"
+#include "load_psd.h"
+
+#include <stb_sprintf.h>
+
+// Offline tool that finds the root motion marker in every frame of a sprite's animations and writes the
+// positions into the sprite's animation kmkv, as "rootmotion" entries.
+// Run from the repository root: anim_tool kid [other sprite names...]
+
+// The marker is a single pure red, fully opaque pixel drawn in each frame layer, at the root position.
+// As RGBA bytes in memory, read as a little-endian uint32.
+const uint32 ROOT_MOTION_MARKER = 0xff0000ff;
+
+const int ANIM_TOOL_MAX_ANIMATIONS = 32;
+
+enum class RootMotionStatus
+{
+    NO_MARKERS,
+    FOUND,
+};
+
+struct RootMotionInfo
+{
+    FixedArray<char, 64> name;
+    RootMotionStatus status;
+    int numFrames;
+    Vec2Int framePos[ANIMATION_MAX_FRAMES]; // in PSD pixels, y down, as the kmkv stores them
+};
+
+void LogString(const char* string, uint64 n)
+{
+    fprintf(stderr, "%.*s", (int)n, string);
+}
+
+void PlatformFlushLogs(LogState* logState)
+{
+    for (uint64 i = 0; i < logState->eventCount; i++) {
+        uint64 eventIndex = (logState->eventFirst + i) % LOG_EVENTS_MAX;
+        const LogEvent& event = logState->logEvents[eventIndex];
+        uint64 bufferStart = event.logStart;
+        uint64 bufferEnd = event.logStart + event.logSize;
+        if (bufferEnd >= LOG_BUFFER_SIZE) {
+            bufferEnd -= LOG_BUFFER_SIZE;
+        }
+        if (bufferEnd >= bufferStart) {
+            LogString(logState->buffer + bufferStart, event.logSize);
+        }
+        else {
+            LogString(logState->buffer + bufferStart, LOG_BUFFER_SIZE - bufferStart);
+            LogString(logState->buffer, bufferEnd);
+        }
+    }
+
+    logState->eventFirst = (logState->eventFirst + logState->eventCount) % LOG_EVENTS_MAX;
+    logState->eventCount = 0;
+}
+
+// Returns the number of marker pixels in the image, and the position of the first one (rows bottom-up,
+// as loaded from the PSD). Compares 4 pixels at a time.
+internal int FindRootMotionMarker(const ImageData& image, Vec2Int* outPos)
+{
+    DEBUG_ASSERT(image.channels == 4);
+    const __m128i marker = _mm_set1_epi32((int)ROOT_MOTION_MARKER);
+
+    int numMarkers = 0;
+    for (int y = 0; y < image.size.y; y++) {
+        const uint32* row = (const uint32*)image.data + y * image.size.x;
+        int x = 0;
+        for (; x + 4 <= image.size.x; x += 4) {
+            __m128i pixels = _mm_loadu_si128((const __m128i*)(row + x));
+            int mask = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(pixels, marker)));
+            if (mask == 0) {
+                continue;
+            }
+            for (int i = 0; i < 4; i++) {
+                if (mask & (1 << i)) {
+                    if (numMarkers == 0) {
+                        *outPos = Vec2Int { x + i, y };
+                    }
+                    numMarkers++;
+                }
+            }
+        }
+        for (; x < image.size.x; x++) {
+            if (row[x] == ROOT_MOTION_MARKER) {
+                if (numMarkers == 0) {
+                    *outPos = Vec2Int { x, y };
+                }
+                numMarkers++;
+            }
+        }
+    }
+
+    return numMarkers;
+}
+
+internal bool ExtractRootMotion(PsdFile* psdFile, string animName, LinearAllocator* allocator,
+                                RootMotionInfo* outInfo)
+{
+    outInfo->name.Clear();
+    outInfo->name.Append(animName);
+    outInfo->status = RootMotionStatus::NO_MARKERS;
+
+    uint64 frameLayers[ANIMATION_MAX_FRAMES];
+    outInfo->numFrames = psdFile->GetGroupTimelineLayers(animName, frameLayers, (int)ANIMATION_MAX_FRAMES);
+    if (outInfo->numFrames < 0) {
+        LOG_ERROR("Animation %.*s has more than %d frames\n", animName.size, animName.data,
+                  (int)ANIMATION_MAX_FRAMES);
+        return false;
+    }
+
+    int framesWithMarker = 0;
+    for (int f = 0; f < outInfo->numFrames; f++) {
+        const auto& allocatorState = allocator->SaveState();
+        defer (allocator->LoadState(allocatorState));
+
+        ImageData image;
+        if (!psdFile->LoadLayerImageData(frameLayers[f], LayerChannelID::ALL, allocator, &image)) {
+            LOG_ERROR("Failed to load frame %d of animation %.*s\n", f, animName.size, animName.data);
+            return false;
+        }
+        if (image.channels != 4) {
+            continue;
+        }
+
+        Vec2Int markerPos;
+        int numMarkers = FindRootMotionMarker(image, &markerPos);
+        if (numMarkers == 0) {
+            continue;
+        }
+        if (numMarkers > 1) {
+            LOG_ERROR("Frame %d of animation %.*s has %d root motion markers, should have 1\n",
+                      f, animName.size, animName.data, numMarkers);
+            return false;
+        }
+
+        const PsdLayerInfo& layer = psdFile->layers[frameLayers[f]];
+        outInfo->framePos[f] = Vec2Int { layer.left + markerPos.x, layer.bottom - 1 - markerPos.y };
+        framesWithMarker++;
+    }
+
+    if (framesWithMarker == 0) {
+        return true;
+    }
+    if (framesWithMarker != outInfo->numFrames) {
+        LOG_ERROR("Only %d of %d frames of animation %.*s have a root motion marker\n",
+                  framesWithMarker, outInfo->numFrames, animName.size, animName.data);
+        return false;
+    }
+
+    outInfo->status = RootMotionStatus::FOUND;
+    return true;
+}
+
+// Returns the first word of the line, or an empty string for blank lines
+internal string GetLineKeyword(string line)
+{
+    string trimmed = TrimWhitespace(line);
+    return NextSplitElement(&trimmed, ' ');
+}
+
+internal void WriteRootMotion(FILE* file, const RootMotionInfo& info, const char* newline)
+{
+    if (info.numFrames == 1) {
+        fprintf(file, "rootmotion %d %d%s", info.framePos[0].x, info.framePos[0].y, newline);
+        return;
+    }
+
+    fprintf(file, "rootmotion {%s", newline);
+    for (int f = 0; f < info.numFrames; f++) {
+        fprintf(file, "    %d %d%s", info.framePos[f].x, info.framePos[f].y, newline);
+    }
+    fprintf(file, "}%s", newline);
+}
+
+// Rewrites the kmkv with new rootmotion entries for the animations that had markers, replacing any old
+// entries (single-line or in braces). Animations without an entry get one at the end of their section.
+internal bool WriteAnimationFile(const char* filePath, string fileString,
+                                 RootMotionInfo* infos, int numInfos)
+{
+    FILE* file = fopen(filePath, "wb");
+    if (!file) {
+        LOG_ERROR("Failed to open %s for writing\n", filePath);
+        return false;
+    }
+
+    const char* newline = "\n";
+    for (uint64 i = 0; i < fileString.size; i++) {
+        if (fileString[i] == '\n') {
+            if (i > 0 && fileString[i - 1] == '\r') {
+                newline = "\r\n";
+            }
+            break;
+        }
+    }
+
+    RootMotionInfo* currentInfo = nullptr;
+    bool rootMotionWritten = false;
+    bool inRootMotionBlock = false;
+    int pendingBlankLines = 0;
+    while (fileString.size > 0) {
+        string line = NextSplitElement(&fileString, '\n');
+        string keyword = GetLineKeyword(line);
+
+        if (inRootMotionBlock) {
+            if (StringEquals(TrimWhitespace(line), ToString("}"))) {
+                inRootMotionBlock = false;
+            }
+            continue;
+        }
+
+        if (keyword.size == 0) {
+            pendingBlankLines++;
+            continue;
+        }
+
+        if (StringEquals(keyword, ToString("anim")) || StringEquals(keyword, ToString("start"))) {
+            if (currentInfo != nullptr && currentInfo->status == RootMotionStatus::FOUND && !rootMotionWritten) {
+                WriteRootMotion(file, *currentInfo, newline);
+            }
+            currentInfo = nullptr;
+            rootMotionWritten = false;
+
+            if (StringEquals(keyword, ToString("anim"))) {
+                string animLine = TrimWhitespace(line);
+                NextSplitElement(&animLine, ' ');
+                string animName = TrimWhitespace(animLine);
+                for (int a = 0; a < numInfos; a++) {
+                    if (StringEquals(infos[a].name.ToArray(), animName)) {
+                        currentInfo = &infos[a];
+                        break;
+                    }
+                }
+            }
+        }
+
+        for (int b = 0; b < pendingBlankLines; b++) {
+            fprintf(file, "%s", newline);
+        }
+        pendingBlankLines = 0;
+
+        if (StringEquals(keyword, ToString("rootmotion"))
+            && currentInfo != nullptr && currentInfo->status == RootMotionStatus::FOUND) {
+            string value = TrimWhitespace(line);
+            NextSplitElement(&value, ' ');
+            value = TrimWhitespace(value);
+            inRootMotionBlock = value.size > 0 && value[0] == '{' && value[value.size - 1] != '}';
+            WriteRootMotion(file, *currentInfo, newline);
+            rootMotionWritten = true;
+            continue;
+        }
+
+        fwrite(line.data, 1, line.size, file);
+        fwrite("\n", 1, 1, file);
+    }
+    if (currentInfo != nullptr && currentInfo->status == RootMotionStatus::FOUND && !rootMotionWritten) {
+        WriteRootMotion(file, *currentInfo, newline);
+    }
+    for (int b = 0; b < pendingBlankLines; b++) {
+        fprintf(file, "%s", newline);
+    }
+
+    fclose(file);
+    return true;
+}
+
+internal bool ProcessSprite(const_string name, LinearAllocator* allocator)
+{
+    const auto& allocatorState = allocator->SaveState();
+    defer (allocator->LoadState(allocatorState));
+
+    FixedArray<char, PATH_MAX_LENGTH> psdPath;
+    psdPath.Clear();
+    psdPath.Append(ToString("data/psd/"));
+    psdPath.Append(name);
+    psdPath.Append(ToString(".psd"));
+    PsdFile psdFile;
+    if (!LoadPsd(&psdFile, psdPath.ToConstArray(), allocator)) {
+        LOG_ERROR("Failed to open and parse PSD file %.*s\n", psdPath.size, psdPath.data);
+        return false;
+    }
+
+    char animPath[PATH_MAX_LENGTH];
+    stbsp_snprintf(animPath, PATH_MAX_LENGTH, "data/kmkv/animations/%.*s.kmkv", (int)name.size, name.data);
+    Array<uint8> animFile = LoadEntireFile(ToString(animPath), allocator);
+    if (!animFile.data) {
+        LOG_ERROR("Failed to open animation file at: %s\n", animPath);
+        return false;
+    }
+    const string fileString = {
+        .size = animFile.size,
+        .data = (char*)animFile.data
+    };
+
+    RootMotionInfo* infos = (RootMotionInfo*)allocator->Allocate(ANIM_TOOL_MAX_ANIMATIONS * sizeof(RootMotionInfo));
+    if (!infos) {
+        LOG_ERROR("Not enough memory for root motion info\n");
+        return false;
+    }
+    int numInfos = 0;
+    string lines = fileString;
+    while (lines.size > 0) {
+        string line = NextSplitElement(&lines, '\n');
+        if (!StringEquals(GetLineKeyword(line), ToString("anim"))) {
+            continue;
+        }
+        if (numInfos >= ANIM_TOOL_MAX_ANIMATIONS) {
+            LOG_ERROR("Too many animations in %s\n", animPath);
+            return false;
+        }
+
+        string animName = TrimWhitespace(line);
+        NextSplitElement(&animName, ' ');
+        animName = TrimWhitespace(animName);
+        RootMotionInfo* info = &infos[numInfos++];
+        if (!ExtractRootMotion(&psdFile, animName, allocator, info)) {
+            return false;
+        }
+        if (info->status == RootMotionStatus::FOUND) {
+            LOG_INFO("    %.*s: %d frames\n", animName.size, animName.data, info->numFrames);
+        }
+        else {
+            LOG_INFO("    %.*s: no markers, left as is\n", animName.size, animName.data);
+        }
+    }
+
+    return WriteAnimationFile(animPath, fileString, infos, numInfos);
+}
+
+int main(int argc, char** argv)
+{
+    LogState* logState = (LogState*)malloc(sizeof(LogState));
+    logState->eventFirst = 0;
+    logState->eventCount = 0;
+    logState_ = logState;
+
+    if (argc < 2) {
+        LOG_ERROR("Usage: anim_tool <sprite name> [sprite names...]\n");
+        LOG_FLUSH();
+        return 1;
+    }
+
+    const uint64 memorySize = GIGABYTES(1);
+    void* memory = malloc(memorySize);
+    LinearAllocator allocator(memorySize, memory);
+
+    auto timeStart = std::chrono::steady_clock::now();
+    for (int i = 1; i < argc; i++) {
+        LOG_INFO("%s\n", argv[i]);
+        if (!ProcessSprite(ToString(argv[i]), &allocator)) {
+            LOG_ERROR("Failed to extract root motion for %s\n", argv[i]);
+            LOG_FLUSH();
+            return 1;
+        }
+    }
+    auto timeEnd = std::chrono::steady_clock::now();
+    float64 seconds = std::chrono::duration<float64>(timeEnd - timeStart).count();
+    LOG_INFO("Done in %.3f s\n", seconds);
+    LOG_FLUSH();
+
+    return 0;
+}
+
+#include "load_psd.cpp"
+
+#define STB_SPRINTF_IMPLEMENTATION
+#include <stb_sprintf.h>
+#undef STB_SPRINTF_IMPLEMENTATION
+
+#include <km_common/km_kmkv.cpp>
+#include <km_common/km_lib.cpp>
+#include <km_common/km_log.cpp>
+#include <km_common/km_memory.cpp>
+#include <km_common/km_os.cpp>
+#include <km_common/km_string.cpp>
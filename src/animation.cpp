@@ -0,0 +1,283 @@
+#include "animation.h"
+
+#include <km_common/km_debug.h>
+
+#include "main.h"
+
+internal void SetInstanceFrame(AnimationSystem* system, int index, const AnimatedSprite* sprite,
+                               int animation, int frame)
+{
+    system->animation[index] = animation;
+    system->frame[index] = frame;
+    system->frameDuration[index] = sprite->animations[animation].frameTime[frame];
+}
+
+void InitAnimationSystem(AnimationSystem* system)
+{
+    system->numInstances = 0;
+    for (int i = 0; i < ANIMATION_INSTANCES_MAX; i++) {
+        system->instanceIndex[i] = -1;
+    }
+}
+
+int CreateAnimationInstance(AnimationSystem* system, const GameAssets& assets, AnimatedSpriteId spriteId,
+                            AnimationLayer layer)
+{
+    int id = ANIMATION_INSTANCE_NONE;
+    for (int i = 0; i < ANIMATION_INSTANCES_MAX; i++) {
+        if (system->instanceIndex[i] == -1) {
+            id = i;
+            break;
+        }
+    }
+    if (id == ANIMATION_INSTANCE_NONE) {
+        LOG_ERROR("Out of animation instances\n");
+        return ANIMATION_INSTANCE_NONE;
+    }
+
+    const int index = system->numInstances++;
+    system->instanceIndex[id] = index;
+    system->instanceId[index] = id;
+
+    const AnimatedSprite* sprite = GetAnimatedSprite(assets, spriteId);
+    system->spriteId[index] = spriteId;
+    SetInstanceFrame(system, index, sprite, sprite->startAnimation, 0);
+    system->frameTime[index] = 0.0f;
+    system->timeScale[index] = 1.0f;
+    system->numNextAnimations[index] = 0;
+    system->rootMotion[index] = Vec2::zero;
+
+    system->layer[index] = layer;
+    system->pos[index] = Vec2::zero;
+    system->size[index] = Vec2::zero;
+    system->anchor[index] = Vec2::zero;
+    system->rot[index] = Quat::one;
+    system->alpha[index] = 1.0f;
+    system->flip[index] = false;
+
+    return id;
+}
+
+void DestroyAnimationInstance(AnimationSystem* system, int id)
+{
+    DEBUG_ASSERT(0 <= id && id < ANIMATION_INSTANCES_MAX);
+    const int index = system->instanceIndex[id];
+    DEBUG_ASSERT(index != -1);
+
+    const int last = --system->numInstances;
+    if (index != last) {
+        system->spriteId[index] = system->spriteId[last];
+        system->animation[index] = system->animation[last];
+        system->frame[index] = system->frame[last];
+        system->frameTime[index] = system->frameTime[last];
+        system->frameDuration[index] = system->frameDuration[last];
+        system->timeScale[index] = system->timeScale[last];
+        MemCopy(system->nextAnimations[index], system->nextAnimations[last], sizeof(system->nextAnimations[0]));
+        system->numNextAnimations[index] = system->numNextAnimations[last];
+        system->rootMotion[index] = system->rootMotion[last];
+        system->layer[index] = system->layer[last];
+        system->pos[index] = system->pos[last];
+        system->size[index] = system->size[last];
+        system->anchor[index] = system->anchor[last];
+        system->rot[index] = system->rot[last];
+        system->alpha[index] = system->alpha[last];
+        system->flip[index] = system->flip[last];
+
+        const int lastId = system->instanceId[last];
+        system->instanceId[index] = lastId;
+        system->instanceIndex[lastId] = index;
+    }
+    system->instanceIndex[id] = -1;
+}
+
+void ResetAnimationInstances(AnimationSystem* system, const GameAssets& assets, AnimatedSpriteId spriteId)
+{
+    const AnimatedSprite* sprite = GetAnimatedSprite(assets, spriteId);
+    for (int i = 0; i < system->numInstances; i++) {
+        if (system->spriteId[i] == spriteId) {
+            SetInstanceFrame(system, i, sprite, sprite->startAnimation, 0);
+            system->frameTime[i] = 0.0f;
+            system->numNextAnimations[i] = 0;
+            system->rootMotion[i] = Vec2::zero;
+        }
+    }
+}
+
+void RemapAnimationInstances(AnimationSystem* system, const GameAssets& assets, AnimatedSpriteId spriteId,
+                             const int* newIds)
+{
+    const AnimatedSprite* sprite = GetAnimatedSprite(assets, spriteId);
+    for (int i = 0; i < system->numInstances; i++) {
+        if (system->spriteId[i] != spriteId) {
+            continue;
+        }
+
+        const int animation = newIds[system->animation[i]];
+        if (animation == ANIMATION_ID_NONE) {
+            SetInstanceFrame(system, i, sprite, sprite->startAnimation, 0);
+            system->frameTime[i] = 0.0f;
+            system->rootMotion[i] = Vec2::zero;
+        }
+        else {
+            const int frame = MinInt(system->frame[i], sprite->animations[animation].numFrames - 1);
+            SetInstanceFrame(system, i, sprite, animation, frame);
+        }
+
+        int numNextAnimations = 0;
+        for (int n = 0; n < system->numNextAnimations[i]; n++) {
+            const int next = newIds[system->nextAnimations[i][n]];
+            if (next != ANIMATION_ID_NONE) {
+                system->nextAnimations[i][numNextAnimations++] = (int8)next;
+            }
+        }
+        system->numNextAnimations[i] = (uint8)numNextAnimations;
+    }
+}
+
+internal int GetInstanceIndex(const AnimationSystem& system, int id)
+{
+    DEBUG_ASSERT(0 <= id && id < ANIMATION_INSTANCES_MAX);
+    DEBUG_ASSERT(system.instanceIndex[id] != -1);
+    return system.instanceIndex[id];
+}
+
+int GetActiveAnimation(const AnimationSystem& system, int id)
+{
+    return system.animation[GetInstanceIndex(system, id)];
+}
+
+Vec2 GetRootMotion(const AnimationSystem& system, int id)
+{
+    return system.rootMotion[GetInstanceIndex(system, id)];
+}
+
+void SetNextAnimations(AnimationSystem* system, int id, const Array<int>& nextAnimations)
+{
+    DEBUG_ASSERT(nextAnimations.size <= ANIMATION_QUEUE_MAX_LENGTH);
+    const int index = GetInstanceIndex(*system, id);
+    for (uint64 i = 0; i < nextAnimations.size; i++) {
+        DEBUG_ASSERT(0 <= nextAnimations[i] && nextAnimations[i] < (int)SPRITE_MAX_ANIMATIONS);
+        system->nextAnimations[index][i] = (int8)nextAnimations[i];
+    }
+    system->numNextAnimations[index] = (uint8)nextAnimations.size;
+}
+
+void SetAnimationTimeScale(AnimationSystem* system, int id, float32 timeScale)
+{
+    system->timeScale[GetInstanceIndex(*system, id)] = timeScale;
+}
+
+void SetAnimationTransform(AnimationSystem* system, int id, Vec2 pos, Vec2 size, Vec2 anchor, Quat rot,
+                           float32 alpha, bool flipHorizontal)
+{
+    const int index = GetInstanceIndex(*system, id);
+    system->pos[index] = pos;
+    system->size[index] = size;
+    system->anchor[index] = anchor;
+    system->rot[index] = rot;
+    system->alpha[index] = alpha;
+    system->flip[index] = flipHorizontal;
+}
+
+// Moves an instance whose frame time ran out to its next frame, or to the first next animation it can exit to
+internal void StepAnimationInstance(AnimationSystem* system, int index, const AnimatedSprite* sprite)
+{
+    system->frameTime[index] = 0.0f;
+
+    bool animTransition = false;
+    for (int i = 0; i < system->numNextAnimations[index]; i++) {
+        const int next = system->nextAnimations[index][i];
+        if (next == system->animation[index]) {
+            break;
+        }
+
+        DEBUG_ASSERT(next < sprite->numAnimations);
+        const Animation* activeAnimation = &sprite->animations[system->animation[index]];
+        const int8 exitToFrame = activeAnimation->frameExitTo[system->frame[index]][next];
+        if (exitToFrame != ANIMATION_NO_EXIT) {
+            // TODO transitions between rootfollow-enabled animations don't work for now
+            animTransition = true;
+            SetInstanceFrame(system, index, sprite, next, exitToFrame);
+        }
+    }
+    if (animTransition) {
+        return;
+    }
+
+    const Animation* activeAnimation = &sprite->animations[system->animation[index]];
+    const int activeFrame = system->frame[index];
+    int activeFrameNext = activeFrame + 1;
+    if (activeFrameNext >= activeAnimation->numFrames) {
+        activeFrameNext = activeAnimation->loop ? 0 : activeFrame;
+    }
+
+    if (activeAnimation->rootFollow) {
+        Vec2 rootMotion = activeAnimation->frameRootMotion[activeFrameNext]
+            - activeAnimation->frameRootMotion[activeFrame];
+
+        if (!activeAnimation->loop && activeAnimation->rootFollowEndLoop
+            && activeFrame == activeAnimation->numFrames - 1) {
+            rootMotion += activeAnimation->frameRootMotion[activeFrame]
+                - activeAnimation->frameRootMotion[activeFrame - 1];
+        }
+        system->rootMotion[index] = rootMotion;
+    }
+
+    SetInstanceFrame(system, index, sprite, system->animation[index], activeFrameNext);
+}
+
+void UpdateAnimationInstances(AnimationSystem* system, const GameAssets& assets, float32 deltaTime)
+{
+    // Most instances stay on the same frame in a given update, so this pass only touches the time arrays,
+    // and the few instances that change frame are stepped afterwards
+    int numStepped = 0;
+    int stepped[ANIMATION_INSTANCES_MAX];
+    for (int i = 0; i < system->numInstances; i++) {
+        system->frameTime[i] += deltaTime * system->timeScale[i];
+        system->rootMotion[i] = Vec2::zero;
+        if (system->frameTime[i] > system->frameDuration[i]) {
+            stepped[numStepped++] = i;
+        }
+    }
+
+    for (int i = 0; i < numStepped; i++) {
+        const int index = stepped[i];
+        StepAnimationInstance(system, index, GetAnimatedSprite(assets, system->spriteId[index]));
+    }
+}
+
+void DrawAnimationInstances(const AnimationSystem& system, const GameAssets& assets, AnimationLayer layer,
+                            const RenderState& renderState, Mat4 transform, SpriteDataGL* spriteDataGL)
+{
+    spriteDataGL->numSprites = 0;
+    for (int i = 0; i < system.numInstances; i++) {
+        if (system.layer[i] != layer) {
+            continue;
+        }
+
+        const AnimatedSprite* sprite = GetAnimatedSprite(assets, system.spriteId[i]);
+        const Animation* activeAnimation = &sprite->animations[system.animation[i]];
+        const int frame = system.frame[i];
+        const Vec2 frameOffset = activeAnimation->frameOffset[frame];
+        const Vec2 frameSize = activeAnimation->frameSize[frame];
+        if (frameSize.x == 0.0f) {
+            continue;
+        }
+
+        // The anchor is a fraction of the full frame. Moving it into the trimmed frame's space keeps the
+        // anchor point (and so the flip and rotation pivot) in the same place.
+        Vec2 anchor = activeAnimation->rootMotion ? activeAnimation->frameRootAnchor[frame] : system.anchor[i];
+        anchor = Vec2 { (anchor.x - frameOffset.x) / frameSize.x, (anchor.y - frameOffset.y) / frameSize.y };
+        const Vec2 size = { system.size[i].x * frameSize.x, system.size[i].y * frameSize.y };
+        if (spriteDataGL->numSprites == SPRITE_BATCH_SIZE) {
+            DrawSprites(renderState, *spriteDataGL, transform);
+            spriteDataGL->numSprites = 0;
+        }
+        Mat4 spriteTransform = CalculateTransform(system.pos[i], size, anchor, system.rot[i], system.flip[i]);
+        PushSprite(spriteDataGL, spriteTransform, activeAnimation->frameUVs[frame], system.alpha[i],
+                   sprite->atlas.textureID);
+    }
+
+    DrawSprites(renderState, *spriteDataGL, transform);
+    spriteDataGL->numSprites = 0;
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <km_common/km_math.h>
+
+#include "asset.h"
+#include "asset_animation.h"
+#include "render.h"
+
+#define ANIMATION_INSTANCES_MAX 1024
+
+// Returned by CreateAnimationInstance when the system is full
+const int ANIMATION_INSTANCE_NONE = -1;
+
+// Which DrawAnimationInstances call draws an instance, so instances can be drawn with different transforms
+// or in between other sprites
+enum class AnimationLayer
+{
+    WORLD,
+    SCREEN,
+
+    COUNT
+};
+
+// Owns every playing animated sprite. Instance state is stored one array per field and packed at the front
+// (removing an instance moves the last one into its place), so UpdateAnimationInstances can run over all of
+// them in a couple of tight passes. Instances are referred to by id, which stays the same while they move.
+struct AnimationSystem
+{
+    int numInstances;
+
+    AnimatedSpriteId spriteId[ANIMATION_INSTANCES_MAX];
+    int animation[ANIMATION_INSTANCES_MAX];
+    int frame[ANIMATION_INSTANCES_MAX];
+    float32 frameTime[ANIMATION_INSTANCES_MAX];
+    float32 frameDuration[ANIMATION_INSTANCES_MAX]; // of the current frame, so the time pass needn't look it up
+    float32 timeScale[ANIMATION_INSTANCES_MAX];
+    // Animations to exit to, in order of preference, as in the kmkv "exit" lines
+    int8 nextAnimations[ANIMATION_INSTANCES_MAX][ANIMATION_QUEUE_MAX_LENGTH];
+    uint8 numNextAnimations[ANIMATION_INSTANCES_MAX];
+    Vec2 rootMotion[ANIMATION_INSTANCES_MAX]; // from the last update
+
+    AnimationLayer layer[ANIMATION_INSTANCES_MAX];
+    Vec2 pos[ANIMATION_INSTANCES_MAX];
+    Vec2 size[ANIMATION_INSTANCES_MAX];
+    Vec2 anchor[ANIMATION_INSTANCES_MAX]; // ignored for animations with root motion
+    Quat rot[ANIMATION_INSTANCES_MAX];
+    float32 alpha[ANIMATION_INSTANCES_MAX];
+    bool flip[ANIMATION_INSTANCES_MAX];
+
+    int instanceId[ANIMATION_INSTANCES_MAX]; // by index
+    int instanceIndex[ANIMATION_INSTANCES_MAX]; // by id, -1 for unused ids
+};
+
+void InitAnimationSystem(AnimationSystem* system);
+// Starts at the sprite's start animation, with a time scale of 1 and nothing to draw (size 0)
+int CreateAnimationInstance(AnimationSystem* system, const GameAssets& assets, AnimatedSpriteId spriteId,
+                            AnimationLayer layer);
+void DestroyAnimationInstance(AnimationSystem* system, int id);
+// Back to the start animation's first frame, for every instance of the sprite (e.g. after it's reloaded)
+void ResetAnimationInstances(AnimationSystem* system, const GameAssets& assets, AnimatedSpriteId spriteId);
+// After the sprite is reloaded, moves every instance of it to the new id of its animation (newIds holds them
+// by old id, as from ReloadAnimatedSprite), keeping its frame and frame time. Instances whose animation is gone
+// go back to the start animation.
+void RemapAnimationInstances(AnimationSystem* system, const GameAssets& assets, AnimatedSpriteId spriteId,
+                             const int* newIds);
+
+int GetActiveAnimation(const AnimationSystem& system, int id);
+Vec2 GetRootMotion(const AnimationSystem& system, int id);
+// nextAnimations holds at most ANIMATION_QUEUE_MAX_LENGTH ids, and stays set until it's set again
+void SetNextAnimations(AnimationSystem* system, int id, const Array<int>& nextAnimations);
+void SetAnimationTimeScale(AnimationSystem* system, int id, float32 timeScale);
+void SetAnimationTransform(AnimationSystem* system, int id, Vec2 pos, Vec2 size, Vec2 anchor, Quat rot,
+                           float32 alpha, bool flipHorizontal);
+
+// Advances every instance by deltaTime times its time scale, taking exits to the next animations
+// at frame changes
+void UpdateAnimationInstances(AnimationSystem* system, const GameAssets& assets, float32 deltaTime);
+// Draws the layer's instances, a full sprite batch at a time since there can be more instances than fit in one.
+// Leaves spriteDataGL empty.
+void DrawAnimationInstances(const AnimationSystem& system, const GameAssets& assets, AnimationLayer layer,
+                            const RenderState& renderState, Mat4 transform, SpriteDataGL* spriteDataGL);
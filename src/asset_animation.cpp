@@ -10,6 +10,10 @@
 global_var const uint64 KEYWORD_MAX_LENGTH = 32;
 global_var const uint64 VALUE_MAX_LENGTH = 4096;
 
+// Transparent pixels around each frame in the atlas, so linear filtering doesn't pick up its neighbors
+#define ANIMATION_ATLAS_PADDING 1
+#define ANIMATION_ATLAS_SIZE_MAX 8192
+
 const char KEYWORD_ANIM             [KEYWORD_MAX_LENGTH] = "anim";
 const char KEYWORD_DIR              [KEYWORD_MAX_LENGTH] = "dir";
 const char KEYWORD_FPS              [KEYWORD_MAX_LENGTH] = "fps";
@@ -23,95 +27,272 @@ const char KEYWORD_ROOTMOTION       [KEYWORD_MAX_LENGTH] = "rootmotion";
 const char KEYWORD_START            [KEYWORD_MAX_LENGTH] = "start";
 const char KEYWORD_COMMENT          [KEYWORD_MAX_LENGTH] = "//";
 
-Vec2 UpdateAnimatedSprite(AnimatedSpriteInstance* sprite, const GameAssets& assets, float32 deltaTime,
-                          const Array<HashKey>& nextAnimations)
+// Exit the frame, then the animation, from which "exit" lines in the animation file were read, to be
+// checked and put in the transition tables once every animation name has an id
+struct AnimationExitInfo
 {
-    const AnimatedSprite* animatedSprite = GetAnimatedSprite(assets, sprite->animatedSpriteId);
-    const Animation* activeAnimation = animatedSprite->animations.GetValue(sprite->activeAnimationKey);
-    Vec2 rootMotion = Vec2::zero;
-
-    sprite->activeFrameTime += deltaTime;
-    if (sprite->activeFrameTime > activeAnimation->frameTime[sprite->activeFrame]) {
-        sprite->activeFrameTime = 0.0f;
-
-        bool animTransition = false;
-        for (uint64 i = 0; i < nextAnimations.size; i++) {
-            if (KeyCompare(sprite->activeAnimationKey, nextAnimations[i])) {
-                break;
-            }
+    int fromAnimation;
+    int fromFrame; // -1 for every frame
+    HashKey toAnimationName;
+    int toFrame;
+};
 
-            const int* exitToFrame = activeAnimation->frameExitTo[sprite->activeFrame].GetValue(nextAnimations[i]);
-            if (exitToFrame != nullptr) {
-                //Vec2 rootMotionPrev = activeAnimation->frameRootMotion[activeFrame];
-                animTransition = true;
-                sprite->activeAnimationKey = nextAnimations[i];
-                sprite->activeFrame = *exitToFrame;
+int GetAnimationId(const AnimatedSprite& sprite, const HashKey& name)
+{
+    for (int i = 0; i < sprite.numAnimations; i++) {
+        if (KeyCompare(sprite.animationNames[i], name)) {
+            return i;
+        }
+    }
+    return ANIMATION_ID_NONE;
+}
 
-                activeAnimation = animatedSprite->animations.GetValue(sprite->activeAnimationKey);
-                // TODO transitions between rootfollow-enabled animations don't work for now
-                //rootMotion += (activeAnimation->frameRootMotion[activeFrame] - rootMotionPrev);
+// A frame's PSD layer and the part of its image that goes in the sprite's atlas
+struct AtlasFrameInfo
+{
+    int animation;
+    int frame;
+    uint64 layer;
+    Vec2Int canvasOrigin; // of the layer's bottom-left corner on the PSD canvas, y up
+    // The rest is only set once the image is loaded, by LoadAtlasFrameImage
+    ImageData image; // bottom row first, as loaded from the PSD
+    Vec2Int trimOrigin; // in the image
+    Vec2Int trimSize; // 0 if the frame is fully transparent
+    uint64 hash;
+    Vec2Int atlasOrigin;
+};
+
+// Finds the smallest rect of the frame image that holds all its non-transparent pixels on the PSD canvas
+internal void TrimAtlasFrame(Vec2Int canvasSize, AtlasFrameInfo* frame)
+{
+    const ImageData& image = frame->image;
+    const int minX = MaxInt(0, -frame->canvasOrigin.x);
+    const int minY = MaxInt(0, -frame->canvasOrigin.y);
+    const int maxX = MinInt(image.size.x, canvasSize.x - frame->canvasOrigin.x);
+    const int maxY = MinInt(image.size.y, canvasSize.y - frame->canvasOrigin.y);
+
+    Vec2Int trimMin = { maxX, maxY };
+    Vec2Int trimMax = { minX, minY };
+    for (int y = minY; y < maxY; y++) {
+        const uint8* row = image.data + y * image.size.x * image.channels;
+        for (int x = minX; x < maxX; x++) {
+            if (image.channels == 4 && row[x * 4 + 3] == 0) {
+                continue;
             }
+            trimMin.x = MinInt(trimMin.x, x);
+            trimMin.y = MinInt(trimMin.y, y);
+            trimMax.x = MaxInt(trimMax.x, x + 1);
+            trimMax.y = MaxInt(trimMax.y, y + 1);
         }
+    }
 
-        if (!animTransition) {
-            int activeFrameNext = sprite->activeFrame + 1;
-            if (activeFrameNext >= activeAnimation->numFrames) {
-                activeFrameNext = activeAnimation->loop ? 0 : sprite->activeFrame;
-            }
+    if (trimMin.x >= trimMax.x) {
+        frame->trimOrigin = Vec2Int::zero;
+        frame->trimSize = Vec2Int::zero;
+    }
+    else {
+        frame->trimOrigin = trimMin;
+        frame->trimSize = trimMax - trimMin;
+    }
+}
 
-            if (activeAnimation->rootFollow) {
-                rootMotion += activeAnimation->frameRootMotion[activeFrameNext]
-                    - activeAnimation->frameRootMotion[sprite->activeFrame];
+// FNV-1a over the trimmed frame's size and pixels. Where the frame is on the canvas is left out, since a frame
+// that only moved doesn't need to be uploaded again.
+internal uint64 HashAtlasFrame(const AtlasFrameInfo& frame)
+{
+    const uint64 FNV_OFFSET = 14695981039346656037ull;
+    const uint64 FNV_PRIME = 1099511628211ull;
+
+    const ImageData& image = frame.image;
+    const int header[3] = { frame.trimSize.x, frame.trimSize.y, image.channels };
+    uint64 hash = FNV_OFFSET;
+    for (uint64 i = 0; i < sizeof(header); i++) {
+        hash = (hash ^ ((const uint8*)header)[i]) * FNV_PRIME;
+    }
+    const uint64 rowBytes = (uint64)frame.trimSize.x * image.channels;
+    for (int y = 0; y < frame.trimSize.y; y++) {
+        const uint8* row = image.data
+            + ((frame.trimOrigin.y + y) * image.size.x + frame.trimOrigin.x) * image.channels;
+        for (uint64 i = 0; i < rowBytes; i++) {
+            hash = (hash ^ row[i]) * FNV_PRIME;
+        }
+    }
+    return hash;
+}
 
-                if (!activeAnimation->loop && activeAnimation->rootFollowEndLoop
-                    && sprite->activeFrame == activeAnimation->numFrames - 1) {
-                    rootMotion += activeAnimation->frameRootMotion[sprite->activeFrame]
-                        - activeAnimation->frameRootMotion[sprite->activeFrame - 1];
-                }
-            }
+internal bool LoadAtlasFrameImage(PsdFile* psdFile, AtlasFrameInfo* frame, LinearAllocator* allocator)
+{
+    if (!psdFile->LoadLayerImageData(frame->layer, LayerChannelID::ALL, allocator, &frame->image)) {
+        LOG_ERROR("Failed to load layer image data\n");
+        return false;
+    }
+    if (frame->image.channels != 3 && frame->image.channels != 4) {
+        LOG_ERROR("Unsupported animation frame channels %d\n", frame->image.channels);
+        return false;
+    }
 
-            sprite->activeFrame = activeFrameNext;
+    TrimAtlasFrame(psdFile->size, frame);
+    frame->hash = HashAtlasFrame(*frame);
+    return true;
+}
+
+// Copies the trimmed frame into an RGBA image with rows dstWidth pixels long
+internal void CopyAtlasFrame(const AtlasFrameInfo& frame, uint8* dst, int dstWidth)
+{
+    const ImageData& image = frame.image;
+    for (int y = 0; y < frame.trimSize.y; y++) {
+        const uint8* srcRow = image.data
+            + ((frame.trimOrigin.y + y) * image.size.x + frame.trimOrigin.x) * image.channels;
+        uint8* dstRow = dst + y * dstWidth * 4;
+        if (image.channels == 4) {
+            MemCopy(dstRow, srcRow, frame.trimSize.x * 4);
+        }
+        else {
+            for (int x = 0; x < frame.trimSize.x; x++) {
+                MemCopy(dstRow + x * 4, srcRow + x * image.channels, image.channels);
+                dstRow[x * 4 + 3] = 255;
+            }
         }
     }
-
-    return rootMotion;
 }
 
-void DrawAnimatedSprite(const AnimatedSpriteInstance& sprite, const GameAssets& assets, SpriteDataGL* spriteDataGL,
-                        Vec2 pos, Vec2 size, Vec2 anchor, Quat rot, float32 alpha, bool flipHorizontal)
+// Sets the frame's offset and size on the canvas, and its UVs for the given place in the atlas
+internal void SetAtlasFrameRects(const AtlasFrameInfo& frame, Vec2Int canvasSize, Vec2Int atlasSize,
+                                 Animation* animation)
 {
-    const AnimatedSprite* animatedSprite = GetAnimatedSprite(assets, sprite.animatedSpriteId);
-    const Animation* activeAnimation = animatedSprite->animations.GetValue(sprite.activeAnimationKey);
-    Vec2 animAnchor = anchor;
-    if (activeAnimation->rootMotion) {
-        animAnchor = activeAnimation->frameRootAnchor[sprite.activeFrame];
-    }
-    Mat4 transform = CalculateTransform(pos, size, animAnchor, rot, flipHorizontal);
-    PushSprite(spriteDataGL, transform, alpha, activeAnimation->frameTextures[sprite.activeFrame].textureID);
+    animation->frameHash[frame.frame] = frame.hash;
+    if (frame.trimSize.x == 0) {
+        animation->frameUVs[frame.frame] = Vec4::zero;
+        animation->frameOffset[frame.frame] = Vec2::zero;
+        animation->frameSize[frame.frame] = Vec2::zero;
+        return;
+    }
+
+    const Vec2 canvas = ToVec2(canvasSize);
+    const Vec2 atlas = ToVec2(atlasSize);
+    const Vec2 atlasOrigin = ToVec2(frame.atlasOrigin);
+    const Vec2 trimSize = ToVec2(frame.trimSize);
+    const Vec2 offset = ToVec2(frame.canvasOrigin + frame.trimOrigin);
+    animation->frameUVs[frame.frame] = Vec4 {
+        atlasOrigin.x / atlas.x, atlasOrigin.y / atlas.y,
+        trimSize.x / atlas.x, trimSize.y / atlas.y
+    };
+    animation->frameOffset[frame.frame] = Vec2 { offset.x / canvas.x, offset.y / canvas.y };
+    animation->frameSize[frame.frame] = Vec2 { trimSize.x / canvas.x, trimSize.y / canvas.y };
 }
 
-bool LoadAnimatedSprite(AnimatedSprite* sprite, const_string name, float32 pixelsPerUnit, MemoryBlock transient)
+// Packs the trimmed frames into shelves, tallest first, then uploads the atlas (into the sprite's current
+// atlas texture if replaceTexture is set) and fills in the frames' UVs, offsets and sizes
+internal bool PackAnimationAtlas(AnimatedSprite* sprite, Array<AtlasFrameInfo> frames, bool replaceTexture,
+                                 LinearAllocator* allocator)
 {
-    LinearAllocator allocator(transient.size, transient.memory);
+    const auto& allocatorState = allocator->SaveState();
+    defer (allocator->LoadState(allocatorState));
+
+    const int padding = ANIMATION_ATLAS_PADDING;
+    int* order = (int*)allocator->Allocate(frames.size * sizeof(int));
+    if (!order) {
+        LOG_ERROR("Not enough memory to sort atlas frames\n");
+        return false;
+    }
+    uint64 area = 0;
+    int maxWidth = 0;
+    for (uint64 i = 0; i < frames.size; i++) {
+        const Vec2Int trimSize = frames[i].trimSize;
+        int j = (int)i;
+        while (j > 0 && frames[order[j - 1]].trimSize.y < trimSize.y) {
+            order[j] = order[j - 1];
+            j--;
+        }
+        order[j] = (int)i;
 
+        if (trimSize.x > 0) {
+            area += (uint64)(trimSize.x + padding * 2) * (trimSize.y + padding * 2);
+            maxWidth = MaxInt(maxWidth, trimSize.x + padding * 2);
+        }
+    }
+
+    int atlasWidth = 64;
+    while ((uint64)atlasWidth * atlasWidth < area || atlasWidth < maxWidth) {
+        atlasWidth *= 2;
+    }
+    int atlasHeight = 0;
+    int shelfX = 0;
+    int shelfHeight = 0;
+    for (uint64 i = 0; i < frames.size; i++) {
+        AtlasFrameInfo* frame = &frames[order[i]];
+        if (frame->trimSize.x == 0) {
+            continue;
+        }
+        const int width = frame->trimSize.x + padding * 2;
+        if (shelfX + width > atlasWidth) {
+            atlasHeight += shelfHeight;
+            shelfX = 0;
+            shelfHeight = 0;
+        }
+        frame->atlasOrigin = Vec2Int { shelfX + padding, atlasHeight + padding };
+        shelfX += width;
+        shelfHeight = MaxInt(shelfHeight, frame->trimSize.y + padding * 2);
+    }
+    atlasHeight = MaxInt(atlasHeight + shelfHeight, 1);
+    if (atlasWidth > ANIMATION_ATLAS_SIZE_MAX || atlasHeight > ANIMATION_ATLAS_SIZE_MAX) {
+        LOG_ERROR("Animation atlas too large: %dx%d\n", atlasWidth, atlasHeight);
+        return false;
+    }
+
+    const uint64 atlasBytes = (uint64)atlasWidth * atlasHeight * 4;
+    uint8* atlasData = (uint8*)allocator->Allocate(atlasBytes);
+    if (!atlasData) {
+        LOG_ERROR("Not enough memory for %dx%d animation atlas\n", atlasWidth, atlasHeight);
+        return false;
+    }
+    MemSet(atlasData, 0, atlasBytes);
+
+    const Vec2Int atlasSize = { atlasWidth, atlasHeight };
+    for (uint64 i = 0; i < frames.size; i++) {
+        const AtlasFrameInfo& frame = frames[i];
+        if (frame.trimSize.x > 0) {
+            uint8* dst = atlasData + (frame.atlasOrigin.y * atlasWidth + frame.atlasOrigin.x) * 4;
+            CopyAtlasFrame(frame, dst, atlasWidth);
+        }
+        SetAtlasFrameRects(frame, sprite->textureSize, atlasSize, &sprite->animations[frame.animation]);
+    }
+
+    if (replaceTexture) {
+        ReplaceTexture(atlasData, atlasWidth, atlasHeight, GL_RGBA, &sprite->atlas);
+    }
+    else if (!LoadTexture(atlasData, atlasWidth, atlasHeight, GL_RGBA, GL_LINEAR, GL_LINEAR,
+                          GL_CLAMP_TO_EDGE, GL_CLAMP_TO_EDGE, &sprite->atlas)) {
+        LOG_ERROR("Failed to load animation atlas texture\n");
+        return false;
+    }
+
+    return true;
+}
+
+// Parses the sprite's PSD into psdFile and its animation file into sprite, leaving the atlas alone. Every frame
+// goes in atlasFrames, but their images aren't loaded.
+internal bool LoadAnimationFiles(AnimatedSprite* sprite, const_string name, float32 pixelsPerUnit,
+                                 PsdFile* psdFile, DynamicArray<AtlasFrameInfo, LinearAllocator>* atlasFrames,
+                                 LinearAllocator* allocator)
+{
     FixedArray<char, PATH_MAX_LENGTH> filePath;
     filePath.Clear();
     filePath.Append(ToString("data/psd/"));
     filePath.Append(name);
     filePath.Append(ToString(".psd"));
-    PsdFile psdFile;
-    if (!LoadPsd(&psdFile, filePath.ToConstArray(), &allocator)) {
+    if (!LoadPsd(psdFile, filePath.ToConstArray(), allocator)) {
         LOG_ERROR("Failed to open and parse level PSD file %.*s\n", filePath.size, filePath.data);
         return false;
     }
 
-    sprite->textureSize = psdFile.size;
+    sprite->textureSize = psdFile->size;
 
     filePath.Clear();
     filePath.Append(ToString("data/kmkv/animations/"));
     filePath.Append(name);
     filePath.Append(ToString(".kmkv"));
-    Array<uint8> animFile = LoadEntireFile(filePath.ToArray(), &allocator);
+    Array<uint8> animFile = LoadEntireFile(filePath.ToArray(), allocator);
     if (!animFile.data) {
         LOG_ERROR("Failed to open animation file at: %.*s\n", filePath.size, filePath.data);
         return false;
@@ -121,8 +302,11 @@ bool LoadAnimatedSprite(AnimatedSprite* sprite, const_string name, float32 pixel
         .size = animFile.size,
         .data = (char*)animFile.data
     };
+    sprite->numAnimations = 0;
+    DynamicArray<AnimationExitInfo, LinearAllocator> exits(allocator);
+    HashKey startAnimationName;
+
     string keyword, value;
-    HashKey currentAnimKey;
     Animation* currentAnim = nullptr;
     while (true) {
         int read = ReadNextKeywordValue(fileString, &keyword, &value);
@@ -138,57 +322,46 @@ bool LoadAnimatedSprite(AnimatedSprite* sprite, const_string name, float32 pixel
 
         // TODO catch error in keyword order (e.g. anim should always be first)
         if (StringEquals(keyword, ToString("anim"))) {
-            currentAnimKey.WriteString(value);
-            currentAnim = sprite->animations.Add(currentAnimKey);
+            HashKey animName;
+            animName.WriteString(value);
+            if (GetAnimationId(*sprite, animName) != ANIMATION_ID_NONE) {
+                LOG_ERROR("Animation file duplicate animation %.*s (%.*s)\n",
+                          value.size, value.data, filePath.size, filePath.data);
+                return false;
+            }
+            if (sprite->numAnimations >= SPRITE_MAX_ANIMATIONS) {
+                LOG_ERROR("Animation file has too many animations (%.*s)\n", filePath.size, filePath.data);
+                return false;
+            }
+            sprite->animationNames[sprite->numAnimations] = animName;
+            currentAnim = &sprite->animations[sprite->numAnimations++];
 
             currentAnim->numFrames = 0;
             currentAnim->loop = false;
             currentAnim->rootMotion = false;
             currentAnim->rootFollow = false;
             currentAnim->rootFollowEndLoop = false;
+            MemSet(currentAnim->frameExitTo, (uint8)ANIMATION_NO_EXIT, sizeof(currentAnim->frameExitTo));
 
-            uint64 frame = 0;
-            float64 lastFrameStart = -1.0f;
-            while (true) {
-                uint64 nextLayerIndex = psdFile.layers.size;
-                float64 earliestFrameStart = 1e6;
-                for (uint64 i = 0; i < psdFile.layers.size; i++) {
-                    if (!psdFile.layers[i].inTimeline) {
-                        continue;
-                    }
-                    if (psdFile.layers[i].parentIndex == psdFile.layers.size) {
-                        continue;
-                    }
-                    uint64 parentIndex = psdFile.layers[i].parentIndex;
-                    if (!StringEquals(psdFile.layers[parentIndex].name.ToArray(), value)) {
-                        continue;
-                    }
-                    float64 start = psdFile.layers[i].timelineStart;
-                    if (start < earliestFrameStart && start > lastFrameStart) {
-                        earliestFrameStart = start;
-                        nextLayerIndex = i;
-                    }
-                }
-                if (nextLayerIndex == psdFile.layers.size) {
-                    break;
-                }
-
-                const PsdLayerInfo& frameLayer = psdFile.layers[nextLayerIndex];
-                TextureGL frameTextureGL;
-                if (!psdFile.LoadLayerAtPsdSizeTextureGL(nextLayerIndex, LayerChannelID::ALL,
-                                                         GL_LINEAR, GL_LINEAR, GL_CLAMP_TO_EDGE, GL_CLAMP_TO_EDGE, &allocator,
-                                                         &frameTextureGL)) {
-                    LOG_ERROR("Failed to load animation texture GL for %s\n", name);
-                    return false;
-                }
-                currentAnim->frameTextures[frame] = frameTextureGL;
+            uint64 frameLayers[ANIMATION_MAX_FRAMES];
+            int numFrameLayers = psdFile->GetGroupTimelineLayers(value, frameLayers, (int)ANIMATION_MAX_FRAMES);
+            if (numFrameLayers < 0) {
+                LOG_ERROR("Animation %.*s has more than %d frames (%.*s)\n", value.size, value.data,
+                          (int)ANIMATION_MAX_FRAMES, filePath.size, filePath.data);
+                return false;
+            }
+            for (int frame = 0; frame < numFrameLayers; frame++) {
+                const PsdLayerInfo& frameLayer = psdFile->layers[frameLayers[frame]];
+                AtlasFrameInfo* atlasFrame = atlasFrames->Append();
+                atlasFrame->animation = sprite->numAnimations - 1;
+                atlasFrame->frame = frame;
+                atlasFrame->layer = frameLayers[frame];
+                atlasFrame->canvasOrigin = Vec2Int { frameLayer.left, psdFile->size.y - frameLayer.bottom };
+                atlasFrame->image.data = nullptr;
                 currentAnim->frameTime[frame] = frameLayer.timelineDuration;
                 currentAnim->frameRootAnchor[frame] = Vec2::zero;
                 currentAnim->frameRootMotion[frame] = Vec2::zero;
                 currentAnim->numFrames++;
-
-                frame++;
-                lastFrameStart = earliestFrameStart;
             }
 
             if (currentAnim->numFrames == 0) {
@@ -241,8 +414,10 @@ bool LoadAnimatedSprite(AnimatedSprite* sprite, const_string name, float32 pixel
             }
 
             next = NextSplitElement(&value, ' ');
-            HashKey exitToAnim;
-            exitToAnim.WriteString(next);
+            AnimationExitInfo* exit = exits.Append();
+            exit->fromAnimation = sprite->numAnimations - 1;
+            exit->fromFrame = exitFromFrame;
+            exit->toAnimationName.WriteString(next);
 
             if (value.size == 0) {
                 LOG_ERROR("Animation file missing exit-to frame (%.*s)\n",
@@ -251,22 +426,15 @@ bool LoadAnimatedSprite(AnimatedSprite* sprite, const_string name, float32 pixel
             }
 
             next = NextSplitElement(&value, '\n');
-            int exitToFrame;
-            {
-                if (!StringToIntBase10(next, &exitToFrame)) {
-                    LOG_ERROR("Animation file invalid exit-to frame (%.*s)\n",
-                              filePath.size, filePath.data);
-                    return false;
-                }
-            }
-
-            if (exitFromFrame == -1) {
-                for (int i = 0; i < currentAnim->numFrames; i++) {
-                    currentAnim->frameExitTo[i].Add(exitToAnim, exitToFrame);
-                }
+            if (!StringToIntBase10(next, &exit->toFrame)) {
+                LOG_ERROR("Animation file invalid exit-to frame (%.*s)\n",
+                          filePath.size, filePath.data);
+                return false;
             }
-            else {
-                currentAnim->frameExitTo[exitFromFrame].Add(exitToAnim, exitToFrame);
+            if (exitFromFrame >= currentAnim->numFrames) {
+                LOG_ERROR("Animation file exit-from frame out of bounds %d (%.*s)\n",
+                          exitFromFrame, filePath.size, filePath.data);
+                return false;
             }
         }
         else if (StringEquals(keyword, ToString("rootfollow"))) {
@@ -320,9 +488,7 @@ bool LoadAnimatedSprite(AnimatedSprite* sprite, const_string name, float32 pixel
             }
         }
         else if (StringEquals(keyword, ToString("start"))) {
-            HashKey startAnim;
-            startAnim.WriteString(value);
-            sprite->startAnimationKey = startAnim;
+            startAnimationName.WriteString(value);
         }
         else if (StringEquals(keyword, ToString("//"))) {
             // Comment, ignore
@@ -334,53 +500,206 @@ bool LoadAnimatedSprite(AnimatedSprite* sprite, const_string name, float32 pixel
         }
     }
 
-    // TODO maybe provide a friendlier way of iterating through HashTable
-    for (uint32 k = 0; k < sprite->animations.capacity; k++) {
-        const HashKey* animKey = &sprite->animations.pairs[k].key;
-        if (animKey->s.size == 0) {
-            continue;
+    // Every animation has an id now, so exits can go in the transition tables
+    for (uint64 i = 0; i < exits.size; i++) {
+        const AnimationExitInfo& exit = exits[i];
+        int toAnimation = GetAnimationId(*sprite, exit.toAnimationName);
+        if (toAnimation == ANIMATION_ID_NONE) {
+            LOG_ERROR("Animation file non-existent exit-to animation %.*s (%.*s)\n",
+                      exit.toAnimationName.s.size, exit.toAnimationName.s.data, filePath.size, filePath.data);
+            return false;
+        }
+        if (exit.toFrame < 0 || exit.toFrame >= sprite->animations[toAnimation].numFrames) {
+            LOG_ERROR("Animation file exit-to frame out of bounds %d (%.*s)\n",
+                      exit.toFrame, filePath.size, filePath.data);
+            return false;
         }
 
-        const Animation* anim = &sprite->animations.pairs[k].value;
-        for (int f = 0; f < anim->numFrames; f++) {
-            const HashTable<int>* frameExitToTable = &anim->frameExitTo[f];
-            for (uint32 j = 0; j < frameExitToTable->capacity; j++) {
-                const HashKey* toAnimKey = &frameExitToTable->pairs[j].key;
-                if (toAnimKey->s.size == 0) {
-                    continue;
-                }
-
-                const int* exitToFrame = frameExitToTable->GetValue(*toAnimKey);
-                if (exitToFrame != nullptr && *exitToFrame >= 0) {
-                    const Animation* toAnim = sprite->animations.GetValue(*toAnimKey);
-                    if (toAnim == nullptr) {
-                        LOG_ERROR("Animation file non-existent exit-to animation %.*s (%.*s)\n",
-                                  toAnimKey->s.size, toAnimKey->s.data, filePath.size, filePath.data);
-                        return false;
-                    }
-                    if (*exitToFrame >= toAnim->numFrames) {
-                        LOG_ERROR("Animation file exit-to frame out of bounds %d (%.*s)\n",
-                                  *exitToFrame, filePath.size, filePath.data);
-                        return false;
-                    }
-                }
+        Animation* fromAnim = &sprite->animations[exit.fromAnimation];
+        if (exit.fromFrame == -1) {
+            for (int f = 0; f < fromAnim->numFrames; f++) {
+                fromAnim->frameExitTo[f][toAnimation] = (int8)exit.toFrame;
             }
         }
+        else {
+            fromAnim->frameExitTo[exit.fromFrame][toAnimation] = (int8)exit.toFrame;
+        }
+    }
+
+    sprite->startAnimation = 0;
+    if (startAnimationName.s.size > 0) {
+        sprite->startAnimation = GetAnimationId(*sprite, startAnimationName);
+        if (sprite->startAnimation == ANIMATION_ID_NONE) {
+            LOG_ERROR("Animation file non-existent start animation %.*s (%.*s)\n",
+                      startAnimationName.s.size, startAnimationName.s.data, filePath.size, filePath.data);
+            return false;
+        }
     }
 
     return true;
 }
 
-void UnloadAnimatedSprite(AnimatedSprite* sprite)
+bool LoadAnimatedSprite(AnimatedSprite* sprite, const_string name, float32 pixelsPerUnit, MemoryBlock transient)
 {
-    for (uint32 k = 0; k < sprite->animations.capacity; k++) {
-        if (sprite->animations.pairs[k].key.s.size == 0) {
+    LinearAllocator allocator(transient.size, transient.memory);
+    PsdFile psdFile;
+    DynamicArray<AtlasFrameInfo, LinearAllocator> atlasFrames(&allocator);
+    if (!LoadAnimationFiles(sprite, name, pixelsPerUnit, &psdFile, &atlasFrames, &allocator)) {
+        return false;
+    }
+
+    for (uint64 i = 0; i < atlasFrames.size; i++) {
+        if (!LoadAtlasFrameImage(&psdFile, &atlasFrames[i], &allocator)) {
+            LOG_ERROR("Failed to load animation frame image for %.*s\n", name.size, name.data);
+            return false;
+        }
+    }
+    if (!PackAnimationAtlas(sprite, atlasFrames.ToArray(), false, &allocator)) {
+        LOG_ERROR("Failed to pack animation atlas for %.*s\n", name.size, name.data);
+        return false;
+    }
+
+    return true;
+}
+
+// The animation in the previous sprite with the same name as the frame's, or nullptr if there's none or it
+// doesn't have that many frames
+internal const Animation* GetPreviousAnimation(const AnimatedSprite& previous, const AnimatedSprite& sprite,
+                                               const AtlasFrameInfo& frame)
+{
+    const int id = GetAnimationId(previous, sprite.animationNames[frame.animation]);
+    if (id == ANIMATION_ID_NONE || frame.frame >= previous.animations[id].numFrames) {
+        return nullptr;
+    }
+    return &previous.animations[id];
+}
+
+// The rect a frame with these UVs takes up in the atlas, in pixels (size 0 for empty frames)
+internal void GetAtlasFrameSlot(Vec4 uvs, const TextureGL& atlas, Vec2Int* outOrigin, Vec2Int* outSize)
+{
+    *outOrigin = Vec2Int { (int)(uvs.x * atlas.size.x + 0.5f), (int)(uvs.y * atlas.size.y + 0.5f) };
+    *outSize = Vec2Int { (int)(uvs.z * atlas.size.x + 0.5f), (int)(uvs.w * atlas.size.y + 0.5f) };
+}
+
+bool ReloadAnimatedSprite(AnimatedSprite* sprite, const_string name, float32 pixelsPerUnit, bool psdChanged,
+                          const char* const* requiredAnimations, int numRequiredAnimations,
+                          MemoryBlock transient, int outAnimationIds[SPRITE_MAX_ANIMATIONS])
+{
+    LinearAllocator allocator(transient.size, transient.memory);
+    AnimatedSprite* newSprite = (AnimatedSprite*)allocator.Allocate(sizeof(AnimatedSprite));
+    if (!newSprite) {
+        LOG_ERROR("Not enough memory to reload animated sprite %.*s\n", name.size, name.data);
+        return false;
+    }
+    PsdFile psdFile;
+    DynamicArray<AtlasFrameInfo, LinearAllocator> atlasFrames(&allocator);
+    if (!LoadAnimationFiles(newSprite, name, pixelsPerUnit, &psdFile, &atlasFrames, &allocator)) {
+        return false;
+    }
+    // Checked before anything is written to the shared atlas, so a failed reload leaves it untouched
+    for (int i = 0; i < numRequiredAnimations; i++) {
+        if (GetAnimationId(*newSprite, HashKey(requiredAnimations[i])) == ANIMATION_ID_NONE) {
+            LOG_ERROR("Reloaded animated sprite %.*s has no animation %s\n", name.size, name.data,
+                      requiredAnimations[i]);
+            return false;
+        }
+    }
+    newSprite->atlas = sprite->atlas;
+
+    // A frame keeps its place in the atlas if the same frame of an animation with the same name was there
+    // before, and its new image (if it changed) fits in that place. Otherwise the whole atlas is packed again.
+    bool repack = false;
+    uint64 maxSlotBytes = 0;
+    for (uint64 i = 0; i < atlasFrames.size; i++) {
+        AtlasFrameInfo* frame = &atlasFrames[i];
+        const Animation* previous = GetPreviousAnimation(*sprite, *newSprite, *frame);
+        if (previous == nullptr) {
+            repack = true;
+            continue;
+        }
+        if (!psdChanged) {
             continue;
         }
 
-        const Animation& animation = sprite->animations.pairs[k].value;
-        for (int i = 0; i < animation.numFrames; i++) {
-            UnloadTexture(animation.frameTextures[i]);
+        if (!LoadAtlasFrameImage(&psdFile, frame, &allocator)) {
+            LOG_ERROR("Failed to load animation frame image for %.*s\n", name.size, name.data);
+            return false;
+        }
+        if (frame->hash != previous->frameHash[frame->frame] && frame->trimSize.x > 0) {
+            Vec2Int slotOrigin, slotSize;
+            GetAtlasFrameSlot(previous->frameUVs[frame->frame], sprite->atlas, &slotOrigin, &slotSize);
+            if (frame->trimSize.x > slotSize.x || frame->trimSize.y > slotSize.y) {
+                repack = true;
+            }
+            const uint64 slotBytes = (uint64)slotSize.x * slotSize.y * 4;
+            if (slotBytes > maxSlotBytes) {
+                maxSlotBytes = slotBytes;
+            }
         }
     }
+
+    int numUpdatedFrames = 0;
+    if (repack) {
+        for (uint64 i = 0; i < atlasFrames.size; i++) {
+            if (atlasFrames[i].image.data == nullptr
+                && !LoadAtlasFrameImage(&psdFile, &atlasFrames[i], &allocator)) {
+                LOG_ERROR("Failed to load animation frame image for %.*s\n", name.size, name.data);
+                return false;
+            }
+        }
+        if (!PackAnimationAtlas(newSprite, atlasFrames.ToArray(), true, &allocator)) {
+            LOG_ERROR("Failed to pack animation atlas for %.*s\n", name.size, name.data);
+            return false;
+        }
+        numUpdatedFrames = (int)atlasFrames.size;
+    }
+    else {
+        uint8* slotData = (uint8*)allocator.Allocate(maxSlotBytes);
+        if (maxSlotBytes > 0 && !slotData) {
+            LOG_ERROR("Not enough memory to update animation atlas for %.*s\n", name.size, name.data);
+            return false;
+        }
+
+        for (uint64 i = 0; i < atlasFrames.size; i++) {
+            AtlasFrameInfo* frame = &atlasFrames[i];
+            const Animation* previous = GetPreviousAnimation(*sprite, *newSprite, *frame);
+            Animation* animation = &newSprite->animations[frame->animation];
+            const int f = frame->frame;
+            if (!psdChanged) {
+                animation->frameUVs[f] = previous->frameUVs[f];
+                animation->frameOffset[f] = previous->frameOffset[f];
+                animation->frameSize[f] = previous->frameSize[f];
+                animation->frameHash[f] = previous->frameHash[f];
+                continue;
+            }
+
+            Vec2Int slotOrigin, slotSize;
+            GetAtlasFrameSlot(previous->frameUVs[f], sprite->atlas, &slotOrigin, &slotSize);
+            frame->atlasOrigin = slotOrigin;
+            SetAtlasFrameRects(*frame, newSprite->textureSize, newSprite->atlas.size, animation);
+            if (frame->hash == previous->frameHash[f] || frame->trimSize.x == 0) {
+                continue;
+            }
+
+            // Clear the whole slot, in case the new image is smaller than the old one
+            MemSet(slotData, 0, (uint64)slotSize.x * slotSize.y * 4);
+            CopyAtlasFrame(*frame, slotData, slotSize.x);
+            UpdateTextureRect(slotData, slotOrigin, slotSize, GL_RGBA, newSprite->atlas);
+            numUpdatedFrames++;
+        }
+    }
+
+    for (int i = 0; i < sprite->numAnimations; i++) {
+        outAnimationIds[i] = GetAnimationId(*newSprite, sprite->animationNames[i]);
+    }
+    *sprite = *newSprite;
+
+    LOG_INFO("Reloaded animated sprite %.*s, %d of %d frames uploaded%s\n", name.size, name.data,
+             numUpdatedFrames, (int)atlasFrames.size, repack ? " (atlas repacked)" : "");
+    return true;
+}
+
+void UnloadAnimatedSprite(AnimatedSprite* sprite)
+{
+    UnloadTexture(sprite->atlas);
 }
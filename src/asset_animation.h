@@ -10,16 +10,28 @@
 const uint64 ANIMATION_MAX_FRAMES = 32;
 const uint64 SPRITE_MAX_ANIMATIONS = 8;
 const uint64 ANIMATION_QUEUE_MAX_LENGTH = 4;
+// In Animation::frameExitTo, for frames that can't exit to an animation
+const int8 ANIMATION_NO_EXIT = -1;
+// Returned by GetAnimationId for names the sprite doesn't have
+const int ANIMATION_ID_NONE = -1;
 
 struct Animation
 {
     int fps;
     int numFrames;
     bool loop;
-    TextureGL frameTextures[ANIMATION_MAX_FRAMES];
+    // Where each frame is in the sprite's atlas, as sprite.vert's uvInfo (origin, then size)
+    Vec4 frameUVs[ANIMATION_MAX_FRAMES];
+    // Frames are trimmed to their non-transparent pixels. These are the bottom-left corner and size of the
+    // trimmed frame as fractions of the sprite's full size. Fully transparent frames have size 0.
+    Vec2 frameOffset[ANIMATION_MAX_FRAMES];
+    Vec2 frameSize[ANIMATION_MAX_FRAMES];
+    // Of each trimmed frame's pixels, so a reload can tell which frames changed
+    uint64 frameHash[ANIMATION_MAX_FRAMES];
     int frameTiming[ANIMATION_MAX_FRAMES];
     float32 frameTime[ANIMATION_MAX_FRAMES];
-    HashTable<int> frameExitTo[ANIMATION_MAX_FRAMES];
+    // Frame to continue from when exiting from each frame to each animation (by id), or ANIMATION_NO_EXIT
+    int8 frameExitTo[ANIMATION_MAX_FRAMES][SPRITE_MAX_ANIMATIONS];
     bool rootMotion;
     bool rootFollow;
     bool rootFollowEndLoop;
@@ -27,12 +39,26 @@ struct Animation
     Vec2 frameRootAnchor[ANIMATION_MAX_FRAMES];
 };
 
+// Animations are referred to by id, their index in animations. Ids are given out in file order on load,
+// so names only need to be looked up when loading, never while playing.
 struct AnimatedSprite
 {
-    HashTable<Animation> animations;
-    HashKey startAnimationKey;
-    Vec2Int textureSize;
+    int numAnimations;
+    Animation animations[SPRITE_MAX_ANIMATIONS];
+    HashKey animationNames[SPRITE_MAX_ANIMATIONS];
+    int startAnimation;
+    Vec2Int textureSize; // of the PSD canvas, before the frames are trimmed
+    TextureGL atlas; // every frame of every animation
 };
 
+int GetAnimationId(const AnimatedSprite& sprite, const HashKey& name);
+
 bool LoadAnimatedSprite(AnimatedSprite* sprite, const_string name, float32 pixelsPerUnit, MemoryBlock transient);
+// Loads the sprite's files again, keeping its atlas texture. Frames that are still in the atlas are only
+// uploaded again if their pixels changed, and the PSD's frame images aren't decoded at all unless psdChanged.
+// outAnimationIds gets the new id of each old animation, or ANIMATION_ID_NONE if it's gone.
+// Fails if the new files are missing any of requiredAnimations. Leaves the sprite as it was on failure.
+bool ReloadAnimatedSprite(AnimatedSprite* sprite, const_string name, float32 pixelsPerUnit, bool psdChanged,
+                          const char* const* requiredAnimations, int numRequiredAnimations,
+                          MemoryBlock transient, int outAnimationIds[SPRITE_MAX_ANIMATIONS]);
 void UnloadAnimatedSprite(AnimatedSprite* sprite);
@@ -1,9 +1,14 @@
 #include "asset_audio.h"
 
+#include <emmintrin.h>
 #include <km_common/km_lib.h>
+#include <math.h>
+
+#include "audio_resample.h"
 
 #define WAVE_FORMAT_PCM         0x0001
 #define WAVE_FORMAT_IEEE_FLOAT  0x0003
+#define WAVE_FORMAT_EXTENSIBLE  0xFFFE
 
 struct ChunkHeader
 {
@@ -28,20 +33,50 @@ struct WaveFormat
 	// there might be additional data here
 };
 
-template <typename Allocator>
-bool LoadWAV(Allocator* allocator, const char* filePath, const GameAudio* gameAudio,
-             AudioBuffer* outAudioBuffer)
+// WAVE_FORMAT_EXTENSIBLE files have the actual format in the first 2 bytes of subFormat
+struct WaveFormatExtensible
 {
-	const auto& allocatorState = allocator->SaveState();
-	defer (allocator->LoadState(allocatorState));
-    
-	Array<uint8> wavFile = LoadEntireFile(ToString(filePath), allocator);
-	if (!wavFile.data) {
-		LOG_ERROR("Failed to open WAV file at: %s\n", filePath);
+	WaveFormat format;
+	int16 extensionSize;
+	int16 validBitsPerSample;
+	int32 channelMask;
+	uint8 subFormat[16];
+};
+
+struct WaveInfo
+{
+	int16 format; // WAVE_FORMAT_PCM or WAVE_FORMAT_IEEE_FLOAT
+	int16 channels;
+	int32 sampleRate;
+	int16 bitsPerSample;
+	uint64 dataOffset;
+	uint64 dataSize;
+};
+
+// Bytes read from the start of a streamed file to find its format and data chunks
+#define AUDIO_STREAM_HEADER_BYTES 4096
+
+static_assert(AUDIO_STREAM_RING_SAMPLES % AUDIO_STREAM_CHUNK_SAMPLES == 0,
+              "audio stream chunks must not wrap around the ring");
+
+const int ADPCM_STEPS[89] = {
+	7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31, 34, 37, 41, 45,
+	50, 55, 60, 66, 73, 80, 88, 97, 107, 118, 130, 143, 157, 173, 190, 209, 230, 253, 279, 307,
+	337, 371, 408, 449, 494, 544, 598, 658, 724, 796, 876, 963, 1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066,
+	2272, 2499, 2749, 3024, 3327, 3660, 4026, 4428, 4871, 5358, 5894, 6484, 7132, 7845, 8630, 9493, 10442, 11487, 12635, 13899,
+	15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794, 32767
+};
+const int ADPCM_INDEX_CHANGE[8] = { -1, -1, -1, -1, 2, 4, 6, 8 };
+
+// Finds the format and the sample data chunk in the first size bytes of a WAV file
+internal bool ParseWAVHeader(const uint8* data, uint64 size, const char* filePath, WaveInfo* outInfo)
+{
+	if (size < sizeof(ChunkRIFF) + sizeof(ChunkHeader) + sizeof(WaveFormat)) {
+		LOG_ERROR("WAV file too small: %s\n", filePath);
 		return false;
 	}
-    
-	ChunkRIFF* riff = (ChunkRIFF*)wavFile.data;
+
+	const ChunkRIFF* riff = (const ChunkRIFF*)data;
 	if (riff->header.c1 != 'R' || riff->header.c2 != 'I'
         || riff->header.c3 != 'F' || riff->header.c4 != 'F') {
 		LOG_ERROR("Invalid RIFF header on file %s\n", filePath);
@@ -52,83 +87,423 @@ bool LoadWAV(Allocator* allocator, const char* filePath, const GameAudio* gameAu
 		LOG_ERROR("Not a WAVE file: %s\n", filePath);
 		return false;
 	}
-    
-	ChunkHeader* fmtHeader = (ChunkHeader*)(riff + 1);
+
+	const ChunkHeader* fmtHeader = (const ChunkHeader*)(riff + 1);
 	if (fmtHeader->c1 != 'f' || fmtHeader->c2 != 'm' || fmtHeader->c3 != 't') {
 		LOG_ERROR("Invalid fmt header on file: %s\n", filePath);
 		return false;
 	}
-	WaveFormat* format = (WaveFormat*)(fmtHeader + 1);
-	if (format->audioFormat != WAVE_FORMAT_IEEE_FLOAT) {
-		LOG_ERROR("WAV format isn't IEEE float (%d) for %s\n",
-                  format->audioFormat, filePath);
-		return false;
+	const WaveFormat* format = (const WaveFormat*)(fmtHeader + 1);
+	int16 audioFormat = format->audioFormat;
+	if ((uint16)audioFormat == WAVE_FORMAT_EXTENSIBLE) {
+		if (fmtHeader->dataSize < (int32)sizeof(WaveFormatExtensible)
+            || sizeof(ChunkRIFF) + sizeof(ChunkHeader) + sizeof(WaveFormatExtensible) > size) {
+			LOG_ERROR("Invalid extensible WAV format for %s\n", filePath);
+			return false;
+		}
+		const WaveFormatExtensible* formatExt = (const WaveFormatExtensible*)format;
+		audioFormat = (int16)(formatExt->subFormat[0] | (formatExt->subFormat[1] << 8));
 	}
-	/*if (format->sampleRate != audio->sampleRate) {
-		LOG_ERROR("WAV file sample rate mismatch: %d vs %d, for %s\n",
-			format->sampleRate, audio->sampleRate, filePath);
+
+	bool validPCM = audioFormat == WAVE_FORMAT_PCM
+		&& (format->bitsPerSample == 8 || format->bitsPerSample == 16
+            || format->bitsPerSample == 24 || format->bitsPerSample == 32);
+	bool validFloat = audioFormat == WAVE_FORMAT_IEEE_FLOAT && format->bitsPerSample == 32;
+	if (!validPCM && !validFloat) {
+		LOG_ERROR("Unsupported WAV format %d (%d bits) for %s\n",
+                  audioFormat, format->bitsPerSample, filePath);
 		return false;
 	}
-	if (format->channels != audio->channels) {
-		LOG_ERROR("WAV file channels mismatch: %d vs %d, for %s\n",
-			format->channels, audio->channels, filePath);
+	if (format->channels != 1 && format->channels != 2) {
+		LOG_ERROR("WAV file has %d channels, only mono and stereo are supported: %s\n",
+                  format->channels, filePath);
 		return false;
-	}*/
-    
-	int bytesRead = sizeof(ChunkRIFF) + sizeof(ChunkHeader)
-		+ fmtHeader->dataSize;
-	ChunkHeader* header = (ChunkHeader*)((char*)format + fmtHeader->dataSize);
-	while (header->c1 != 'd' || header->c2 != 'a'
-           || header->c3 != 't' || header->c4 != 'a') {
-		int bytesToSkip = sizeof(ChunkHeader) + header->dataSize;
-		if (bytesRead + bytesToSkip >= wavFile.size) {
+	}
+
+	uint64 bytesRead = sizeof(ChunkRIFF) + sizeof(ChunkHeader) + fmtHeader->dataSize;
+	while (true) {
+		if (bytesRead + sizeof(ChunkHeader) > size) {
 			LOG_ERROR("WAV file has no data chunk: %s\n", filePath);
 			return false;
 		}
-		header = (ChunkHeader*)((char*)header + bytesToSkip);
-		bytesRead += bytesToSkip;
-	}
-    
-	void* data = (void*)(header + 1);
-	int bytesPerSample = format->bitsPerSample / 8;
-	int lengthSamples = header->dataSize / bytesPerSample / format->channels;
-	if (lengthSamples > AUDIO_MAX_SAMPLES) {
-		LOG_ERROR("WAV file too long: %s\n", filePath);
+		const ChunkHeader* header = (const ChunkHeader*)(data + bytesRead);
+		if (header->c1 == 'd' && header->c2 == 'a' && header->c3 == 't' && header->c4 == 'a') {
+			outInfo->format = audioFormat;
+			outInfo->channels = format->channels;
+			outInfo->sampleRate = format->sampleRate;
+			outInfo->bitsPerSample = format->bitsPerSample;
+			outInfo->dataOffset = bytesRead + sizeof(ChunkHeader);
+			outInfo->dataSize = header->dataSize;
+			return true;
+		}
+		bytesRead += sizeof(ChunkHeader) + header->dataSize;
+	}
+}
+
+// Converts n sample values from WAV data to float32 in [-1, 1]. PCM is converted 4 values per SSE register.
+internal void ConvertWAVSamples(const uint8* src, int16 format, int16 bitsPerSample, uint64 n, float32* dst)
+{
+	uint64 i = 0;
+	if (format == WAVE_FORMAT_IEEE_FLOAT) {
+		MemCopy(dst, src, n * sizeof(float32));
+		return;
+	}
+
+	switch (bitsPerSample) {
+		case 8: {
+			// Unsigned, centered on 128
+			const __m128i bias = _mm_set1_epi8((char)0x80);
+			const __m128 scale = _mm_set1_ps(1.0f / 128.0f);
+			for (; i + 16 <= n; i += 16) {
+				__m128i v = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(src + i)), bias);
+				__m128i lo16 = _mm_srai_epi16(_mm_unpacklo_epi8(v, v), 8);
+				__m128i hi16 = _mm_srai_epi16(_mm_unpackhi_epi8(v, v), 8);
+				_mm_storeu_ps(dst + i, _mm_mul_ps(_mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(lo16, lo16), 16)), scale));
+				_mm_storeu_ps(dst + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(lo16, lo16), 16)), scale));
+				_mm_storeu_ps(dst + i + 8, _mm_mul_ps(_mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(hi16, hi16), 16)), scale));
+				_mm_storeu_ps(dst + i + 12, _mm_mul_ps(_mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(hi16, hi16), 16)), scale));
+			}
+			for (; i < n; i++) {
+				dst[i] = ((int)src[i] - 128) / 128.0f;
+			}
+		} break;
+		case 16: {
+			const __m128 scale = _mm_set1_ps(1.0f / 32768.0f);
+			for (; i + 8 <= n; i += 8) {
+				__m128i v = _mm_loadu_si128((const __m128i*)(src + i * 2));
+				__m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16);
+				__m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16);
+				_mm_storeu_ps(dst + i, _mm_mul_ps(_mm_cvtepi32_ps(lo), scale));
+				_mm_storeu_ps(dst + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(hi), scale));
+			}
+			for (; i < n; i++) {
+				int16 value = (int16)(src[i * 2] | (src[i * 2 + 1] << 8));
+				dst[i] = value / 32768.0f;
+			}
+		} break;
+		case 24: {
+			// Packed 3 bytes per value, moved to the top of an int32 and converted like 32-bit
+			const __m128 scale = _mm_set1_ps(1.0f / 2147483648.0f);
+			int32 values[4];
+			for (; i + 4 <= n; i += 4) {
+				const uint8* s = src + i * 3;
+				for (int j = 0; j < 4; j++) {
+					values[j] = (int32)((uint32)s[j * 3] << 8 | (uint32)s[j * 3 + 1] << 16 | (uint32)s[j * 3 + 2] << 24);
+				}
+				__m128i v = _mm_loadu_si128((const __m128i*)values);
+				_mm_storeu_ps(dst + i, _mm_mul_ps(_mm_cvtepi32_ps(v), scale));
+			}
+			for (; i < n; i++) {
+				const uint8* s = src + i * 3;
+				int32 value = (int32)((uint32)s[0] << 8 | (uint32)s[1] << 16 | (uint32)s[2] << 24);
+				dst[i] = value / 2147483648.0f;
+			}
+		} break;
+		case 32: {
+			const __m128 scale = _mm_set1_ps(1.0f / 2147483648.0f);
+			for (; i + 4 <= n; i += 4) {
+				__m128i v = _mm_loadu_si128((const __m128i*)(src + i * 4));
+				_mm_storeu_ps(dst + i, _mm_mul_ps(_mm_cvtepi32_ps(v), scale));
+			}
+			for (; i < n; i++) {
+				int32 value;
+				MemCopy(&value, src + i * 4, sizeof(int32));
+				dst[i] = value / 2147483648.0f;
+			}
+		} break;
+		default: {
+			DEBUG_PANIC("Unhandled WAV bits per sample %d\n", bitsPerSample);
+		} break;
+	}
+}
+
+// Spreads numSamples mono values at the start of samples over both stereo channels, in place
+internal void MonoToStereo(float32* samples, uint64 numSamples)
+{
+	for (uint64 i = numSamples; i > 0; i--) {
+		float32 value = samples[i - 1];
+		samples[(i - 1) * 2] = value;
+		samples[(i - 1) * 2 + 1] = value;
+	}
+}
+
+template <typename Allocator, typename ClipAllocator>
+bool LoadWAV(Allocator* allocator, ClipAllocator* clipAllocator, const char* filePath,
+             const GameAudio* gameAudio, AudioFormat format, AudioBuffer* outAudioBuffer)
+{
+	DEBUG_ASSERT(gameAudio->channels == AUDIO_MAX_CHANNELS);
+
+	const auto& allocatorState = allocator->SaveState();
+	defer (allocator->LoadState(allocatorState));
+
+	Array<uint8> wavFile = LoadEntireFile(ToString(filePath), allocator);
+	if (!wavFile.data) {
+		LOG_ERROR("Failed to open WAV file at: %s\n", filePath);
 		return false;
 	}
-    
-	if ((uint32)format->sampleRate != gameAudio->sampleRate) {
-		float32* floatData = (float32*)data;
-		int targetLengthSamples = (int)((float32)lengthSamples /
-                                        format->sampleRate * gameAudio->sampleRate);
-		for (int i = 0; i < targetLengthSamples; i++) {
-			float32 t = (float32)i / (targetLengthSamples - 1);
-			float32 sample1 = LinearSample(gameAudio, floatData, lengthSamples, 0, t);
-			float32 sample2 = LinearSample(gameAudio, floatData, lengthSamples, 1, t);
-			outAudioBuffer->buffer[i * gameAudio->channels] = sample1;
-			outAudioBuffer->buffer[i * gameAudio->channels + 1] = sample2;
+
+	WaveInfo info;
+	if (!ParseWAVHeader(wavFile.data, wavFile.size, filePath, &info)) {
+		return false;
+	}
+	if (info.dataOffset + info.dataSize > wavFile.size) {
+		LOG_ERROR("WAV data chunk runs past the end of file: %s\n", filePath);
+		return false;
+	}
+
+	uint64 bytesPerSample = info.bitsPerSample / 8 * info.channels;
+	uint64 lengthSamples = info.dataSize / bytesPerSample;
+	bool resample = (uint32)info.sampleRate != gameAudio->sampleRate;
+	float64 step = (float64)info.sampleRate / gameAudio->sampleRate;
+	uint64 targetLengthSamples = resample ? (uint64)ceil(lengthSamples / step) : lengthSamples;
+	bool compress = format == AudioFormat::ADPCM;
+
+	// Decoded straight into the clip when nothing else needs doing, otherwise into temporary memory
+	uint64 decodedBytes = lengthSamples * AUDIO_MAX_CHANNELS * sizeof(float32);
+	float32* decoded = (resample || compress) ? (float32*)allocator->Allocate(decodedBytes)
+		: (float32*)clipAllocator->Allocate(decodedBytes);
+	if (decoded == nullptr) {
+		LOG_ERROR("Not enough memory to decode WAV file: %s\n", filePath);
+		return false;
+	}
+	ConvertWAVSamples(wavFile.data + info.dataOffset, info.format, info.bitsPerSample,
+                      lengthSamples * info.channels, decoded);
+	if (info.channels == 1) {
+		MonoToStereo(decoded, lengthSamples);
+	}
+
+	float32* samples = decoded;
+	if (resample) {
+		uint64 resampledBytes = targetLengthSamples * AUDIO_MAX_CHANNELS * sizeof(float32);
+		samples = compress ? (float32*)allocator->Allocate(resampledBytes)
+			: (float32*)clipAllocator->Allocate(resampledBytes);
+		ResampleFilter* filter = (ResampleFilter*)allocator->Allocate(sizeof(ResampleFilter));
+		if (samples == nullptr || filter == nullptr) {
+			LOG_ERROR("Not enough memory to resample WAV file: %s\n", filePath);
+			return false;
 		}
-		outAudioBuffer->bufferSizeSamples = targetLengthSamples;
+		InitResampleFilter(filter, MinFloat32((float32)(1.0 / step), 1.0f));
+		MemSet(samples, 0, resampledBytes);
+		ResampleStereo(filter, decoded, lengthSamples, 0.0, step, 1.0f, 1.0f, samples, targetLengthSamples);
+	}
+
+	outAudioBuffer->sampleRate = gameAudio->sampleRate;
+	outAudioBuffer->channels = AUDIO_MAX_CHANNELS;
+	outAudioBuffer->bufferSizeSamples = targetLengthSamples;
+	outAudioBuffer->format = format;
+	outAudioBuffer->buffer = nullptr;
+	outAudioBuffer->adpcmBlocks = nullptr;
+	if (compress) {
+		uint64 numBlocks = GetAdpcmBlockCount(targetLengthSamples);
+		AdpcmBlock* blocks = (AdpcmBlock*)clipAllocator->Allocate(numBlocks * sizeof(AdpcmBlock));
+		if (blocks == nullptr) {
+			LOG_ERROR("Not enough clip memory for WAV file: %s\n", filePath);
+			return false;
+		}
+		EncodeAdpcm(samples, targetLengthSamples, blocks);
+		outAudioBuffer->adpcmBlocks = blocks;
 	}
 	else {
-		MemCopy(outAudioBuffer->buffer, data, header->dataSize);
-		outAudioBuffer->bufferSizeSamples = lengthSamples;
+		outAudioBuffer->buffer = samples;
 	}
-    
-	outAudioBuffer->sampleRate = gameAudio->sampleRate;
-	outAudioBuffer->channels = gameAudio->channels;
-    
+
+	return true;
+}
+
+uint64 GetAdpcmBlockCount(uint64 numSamples)
+{
+	return (numSamples + AUDIO_ADPCM_BLOCK_SAMPLES - 1) / AUDIO_ADPCM_BLOCK_SAMPLES;
+}
+
+// Moves the decoder state by one 4-bit code. The encoder runs this too, so both stay in sync.
+internal void StepAdpcm(int code, int* predictor, int* stepIndex)
+{
+	int step = ADPCM_STEPS[*stepIndex];
+	int delta = step >> 3;
+	if (code & 4) {
+		delta += step;
+	}
+	if (code & 2) {
+		delta += step >> 1;
+	}
+	if (code & 1) {
+		delta += step >> 2;
+	}
+	*predictor = ClampInt((code & 8) ? *predictor - delta : *predictor + delta, -32768, 32767);
+	*stepIndex = ClampInt(*stepIndex + ADPCM_INDEX_CHANGE[code & 7], 0, 88);
+}
+
+internal int EncodeAdpcmValue(int value, int* predictor, int* stepIndex)
+{
+	int step = ADPCM_STEPS[*stepIndex];
+	int diff = value - *predictor;
+	int code = 0;
+	if (diff < 0) {
+		code = 8;
+		diff = -diff;
+	}
+	if (diff >= step) {
+		code |= 4;
+		diff -= step;
+	}
+	if (diff >= step >> 1) {
+		code |= 2;
+		diff -= step >> 1;
+	}
+	if (diff >= step >> 2) {
+		code |= 1;
+	}
+	StepAdpcm(code, predictor, stepIndex);
+	return code;
+}
+
+void EncodeAdpcm(const float32* samples, uint64 numSamples, AdpcmBlock* blocks)
+{
+	int predictor[AUDIO_MAX_CHANNELS] = {};
+	int stepIndex[AUDIO_MAX_CHANNELS] = {};
+	uint64 numBlocks = GetAdpcmBlockCount(numSamples);
+	for (uint64 b = 0; b < numBlocks; b++) {
+		AdpcmBlock* block = &blocks[b];
+		for (int c = 0; c < AUDIO_MAX_CHANNELS; c++) {
+			block->predictor[c] = (int16)predictor[c];
+			block->stepIndex[c] = (uint8)stepIndex[c];
+		}
+
+		for (int i = 0; i < AUDIO_ADPCM_BLOCK_SAMPLES; i++) {
+			uint64 sampleIndex = b * AUDIO_ADPCM_BLOCK_SAMPLES + i;
+			uint8 codes = 0;
+			for (int c = 0; c < AUDIO_MAX_CHANNELS; c++) {
+				// The last block is padded with silence
+				float32 sample = sampleIndex < numSamples ? samples[sampleIndex * AUDIO_MAX_CHANNELS + c] : 0.0f;
+				int value = ClampInt((int)lroundf(sample * 32767.0f), -32768, 32767);
+				codes |= (uint8)(EncodeAdpcmValue(value, &predictor[c], &stepIndex[c]) << (c * 4));
+			}
+			block->data[i] = codes;
+		}
+	}
+}
+
+void DecodeAdpcm(const AdpcmBlock* blocks, uint64 numBlocks, float32* dst)
+{
+	for (uint64 b = 0; b < numBlocks; b++) {
+		const AdpcmBlock* block = &blocks[b];
+		int predictorLeft = block->predictor[0];
+		int predictorRight = block->predictor[1];
+		int stepIndexLeft = block->stepIndex[0];
+		int stepIndexRight = block->stepIndex[1];
+		for (int i = 0; i < AUDIO_ADPCM_BLOCK_SAMPLES; i++) {
+			uint8 codes = block->data[i];
+			StepAdpcm(codes & 0xf, &predictorLeft, &stepIndexLeft);
+			StepAdpcm(codes >> 4, &predictorRight, &stepIndexRight);
+			dst[i * 2] = predictorLeft / 32768.0f;
+			dst[i * 2 + 1] = predictorRight / 32768.0f;
+		}
+		dst += AUDIO_ADPCM_BLOCK_SAMPLES * AUDIO_MAX_CHANNELS;
+	}
+}
+
+bool OpenAudioStream(const char* filePath, const GameAudio* gameAudio, bool loop, AudioStream* outStream)
+{
+	FILE* file = fopen(filePath, "rb");
+	if (file == nullptr) {
+		LOG_ERROR("Failed to open audio stream file at: %s\n", filePath);
+		return false;
+	}
+
+	uint8 header[AUDIO_STREAM_HEADER_BYTES];
+	uint64 headerSize = fread(header, 1, AUDIO_STREAM_HEADER_BYTES, file);
+	WaveInfo info;
+	if (!ParseWAVHeader(header, headerSize, filePath, &info)) {
+		fclose(file);
+		return false;
+	}
+	if ((uint32)info.sampleRate != gameAudio->sampleRate || info.channels != AUDIO_MAX_CHANNELS) {
+		LOG_ERROR("Audio stream must be stereo at %d Hz (got %d channels at %d Hz): %s\n",
+                  gameAudio->sampleRate, info.channels, info.sampleRate, filePath);
+		fclose(file);
+		return false;
+	}
+	uint64 bytesPerSample = info.bitsPerSample / 8 * AUDIO_MAX_CHANNELS;
+	if (info.dataSize < bytesPerSample) {
+		LOG_ERROR("Audio stream has no samples: %s\n", filePath);
+		fclose(file);
+		return false;
+	}
+
+	outStream->file = file;
+	outStream->dataOffset = info.dataOffset;
+	outStream->lengthSamples = info.dataSize / bytesPerSample;
+	outStream->waveFormat = info.format;
+	outStream->bitsPerSample = info.bitsPerSample;
+	outStream->loop = loop;
+	outStream->playing = false;
+	RewindAudioStream(outStream);
+
 	return true;
 }
 
-float32 LinearSample(const GameAudio* gameAudio,
-                     const float32* buffer, int bufferLengthSamples,
-                     int channel, float32 t)
+void CloseAudioStream(AudioStream* stream)
+{
+	if (stream->file != nullptr) {
+		fclose(stream->file);
+		stream->file = nullptr;
+	}
+}
+
+// Reads the chunk starting at ringEnd, wrapping to the start of the track when looping.
+// The chunk goes over samples the mixer is already past, and it only sees the new ones once ringEnd moves.
+internal void ReadAudioStreamChunk(AudioStream* stream, uint64 ringEnd)
+{
+	const uint64 bytesPerSample = stream->bitsPerSample / 8 * AUDIO_MAX_CHANNELS;
+	float32* dst = stream->ring + (ringEnd % AUDIO_STREAM_RING_SAMPLES) * AUDIO_MAX_CHANNELS;
+	uint64 index = ringEnd;
+	uint64 samplesLeft = AUDIO_STREAM_CHUNK_SAMPLES;
+	while (samplesLeft > 0) {
+		uint64 fileIndex = stream->loop ? index % stream->lengthSamples : index;
+		if (fileIndex >= stream->lengthSamples) {
+			MemSet(dst, 0, samplesLeft * AUDIO_MAX_CHANNELS * sizeof(float32));
+			break;
+		}
+
+		uint64 samples = MinUInt64(samplesLeft, stream->lengthSamples - fileIndex);
+		_fseeki64(stream->file, (int64)(stream->dataOffset + fileIndex * bytesPerSample), SEEK_SET);
+		uint64 samplesRead = fread(stream->chunkData, bytesPerSample, samples, stream->file);
+		ConvertWAVSamples(stream->chunkData, stream->waveFormat, stream->bitsPerSample,
+                          samplesRead * AUDIO_MAX_CHANNELS, dst);
+		if (samplesRead != samples) {
+			LOG_ERROR("Audio stream read failed at sample %llu\n", fileIndex + samplesRead);
+			MemSet(dst + samplesRead * AUDIO_MAX_CHANNELS, 0,
+                   (samplesLeft - samplesRead) * AUDIO_MAX_CHANNELS * sizeof(float32));
+			break;
+		}
+
+		dst += samples * AUDIO_MAX_CHANNELS;
+		index += samples;
+		samplesLeft -= samples;
+	}
+}
+
+void RewindAudioStream(AudioStream* stream)
+{
+	DEBUG_ASSERT(!stream->playing.load(std::memory_order_acquire));
+	stream->ringEnd.store(0, std::memory_order_relaxed);
+	stream->playIndex.store(0, std::memory_order_relaxed);
+	FillAudioStream(stream);
+}
+
+void FillAudioStream(AudioStream* stream)
 {
-	float32 iFloat = t * bufferLengthSamples;
-	int i1 = (int)floorf(iFloat);
-	int i2 = (int)ceilf(iFloat);
-	float32 val1 = buffer[i1 * gameAudio->channels + channel];
-	float32 val2 = buffer[i2 * gameAudio->channels + channel];
-	return Lerp(val1, val2, iFloat - i1);
+	DEBUG_ASSERT(stream->file != nullptr);
+
+	const uint64 playIndex = stream->playIndex.load(std::memory_order_acquire);
+	uint64 ringEnd = stream->ringEnd.load(std::memory_order_relaxed);
+	if (ringEnd < playIndex) {
+		// Playback got ahead of the ring (e.g. after a long hitch), skip the chunks that were missed
+		ringEnd = playIndex - playIndex % AUDIO_STREAM_CHUNK_SAMPLES;
+	}
+	while (ringEnd + AUDIO_STREAM_CHUNK_SAMPLES <= playIndex + AUDIO_STREAM_RING_SAMPLES) {
+		ReadAudioStreamChunk(stream, ringEnd);
+		ringEnd += AUDIO_STREAM_CHUNK_SAMPLES;
+		stream->ringEnd.store(ringEnd, std::memory_order_release);
+	}
 }
@@ -2,23 +2,84 @@
 
 #include <km_common/km_debug.h>
 #include <km_platform/main_platform.h>
+#include <stdio.h>
+#undef internal
+#include <atomic>
+#define internal static
 
-#define AUDIO_MAX_SAMPLERATE 48000
 #define AUDIO_MAX_CHANNELS 2
-#define AUDIO_MAX_LENGTH_SECS 2
-#define AUDIO_MAX_SAMPLES (AUDIO_MAX_SAMPLERATE * AUDIO_MAX_LENGTH_SECS)
 
+#define AUDIO_STREAM_CHUNK_SAMPLES 4096
+#define AUDIO_STREAM_RING_SAMPLES (AUDIO_STREAM_CHUNK_SAMPLES * 4)
+// Largest sample value in a WAV file, in bytes
+#define AUDIO_STREAM_VALUE_BYTES_MAX 4
+
+#define AUDIO_ADPCM_BLOCK_SAMPLES 256
+
+enum class AudioFormat
+{
+	FLOAT32,
+	ADPCM
+};
+
+// IMA ADPCM, 4 bits per sample value. Each block starts with the decoder state, so decoding can start at any block.
+struct AdpcmBlock
+{
+	int16 predictor[AUDIO_MAX_CHANNELS];
+	uint8 stepIndex[AUDIO_MAX_CHANNELS];
+	uint8 data[AUDIO_ADPCM_BLOCK_SAMPLES]; // sample i has its left code in the low 4 bits of byte i, right in the high 4
+};
+
+// A whole clip in memory, for short sounds. ADPCM clips are about a quarter the size of 16-bit PCM
+// (an eighth of float), and the mixer decodes them as they play.
 struct AudioBuffer
 {
 	uint32 sampleRate;
 	uint8 channels;
 	uint64 bufferSizeSamples;
-	float32 buffer[AUDIO_MAX_SAMPLES * AUDIO_MAX_CHANNELS];
+	AudioFormat format;
+	float32* buffer; // FLOAT32 clips
+	AdpcmBlock* adpcmBlocks; // ADPCM clips
+};
+
+// Long audio (music, ambience) read from disk a chunk at a time into a ring buffer, so memory
+// use doesn't depend on the track's length. Samples are indexed from the start of playback.
+// The stream's owner does all the disk reads (RewindAudioStream, FillAudioStream) and the mixer only
+// consumes the ring, so mixing never waits on the disk.
+struct AudioStream
+{
+	FILE* file;
+	uint64 dataOffset; // of the sample data in the file, in bytes
+	uint64 lengthSamples;
+	int16 waveFormat;
+	int16 bitsPerSample;
+	bool loop;
+
+	// Holds samples ringEnd - AUDIO_STREAM_RING_SAMPLES to ringEnd - 1 (ones past the end are silence),
+	// sample i at ring[(i % AUDIO_STREAM_RING_SAMPLES) * AUDIO_MAX_CHANNELS]
+	std::atomic<uint64> ringEnd; // moved by the owner
+	std::atomic<uint64> playIndex; // the playing voice's position, moved by the mixer
+	std::atomic<bool> playing; // set by the owner when it's played, cleared by the mixer when its voice is gone
+	float32 ring[AUDIO_STREAM_RING_SAMPLES * AUDIO_MAX_CHANNELS];
+	uint8 chunkData[AUDIO_STREAM_CHUNK_SAMPLES * AUDIO_MAX_CHANNELS * AUDIO_STREAM_VALUE_BYTES_MAX];
 };
 
-template <typename Allocator>
-bool LoadWAV(Allocator* allocator, const char* filePath, const GameAudio* gameAudio,
-             AudioBuffer* outAudioBuffer);
+// Reads 8, 16, 24 and 32-bit PCM and 32-bit float files, mono or stereo. Clip data is allocated from
+// clipAllocator in the given format, the file itself is temporary and loaded with allocator.
+template <typename Allocator, typename ClipAllocator>
+bool LoadWAV(Allocator* allocator, ClipAllocator* clipAllocator, const char* filePath,
+             const GameAudio* gameAudio, AudioFormat format, AudioBuffer* outAudioBuffer);
+
+uint64 GetAdpcmBlockCount(uint64 numSamples);
+// Encodes interleaved stereo samples into GetAdpcmBlockCount(numSamples) blocks
+void EncodeAdpcm(const float32* samples, uint64 numSamples, AdpcmBlock* blocks);
+// Decodes whole blocks to interleaved stereo samples
+void DecodeAdpcm(const AdpcmBlock* blocks, uint64 numBlocks, float32* dst);
 
-float32 LinearSample(const GameAudio* gameAudio, const float32* buffer, int bufferLengthSamples,
-                     int channel, float32 t);
+// The file must be stereo and match the device's sample rate
+bool OpenAudioStream(const char* filePath, const GameAudio* gameAudio, bool loop, AudioStream* outStream);
+void CloseAudioStream(AudioStream* stream);
+// Fills the ring, starting over from the beginning of the track. Not while a voice is playing the stream.
+void RewindAudioStream(AudioStream* stream);
+// Reads whole chunks ahead of the playing voice's position until the ring is full
+void FillAudioStream(AudioStream* stream);
@@ -479,7 +479,12 @@ bool LoadLevelData(LevelData* levelData, const_string name, float32 pixelsPerUni
         LOG_ERROR("Level ground collision not initialized (%.*s)\n", filePath.size, filePath.data);
         return false;
     }
+    PrecomputeLineColliderHeights(levelData);
 
+	FixedArray<uint64, LEVEL_SPRITES_MAX> objectInds;
+	FixedArray<float32, LEVEL_SPRITES_MAX> objectCoordX;
+	objectInds.Clear();
+	objectCoordX.Clear();
 	for (uint64 i = 0; i < levelData->sprites.size; i++) {
         const TextureGL* sprite = &levelData->sprites[i];
 		SpriteMetadata* spriteMetadata = &levelData->spriteMetadata[i];
@@ -490,12 +495,20 @@ bool LoadLevelData(LevelData* levelData, const_string name, float32 pixelsPerUni
 			spriteMetadata->coords = coords;
 			spriteMetadata->anchor = Vec2::one / 2.0f;
 
-			Vec2 floorPos, floorNormal;
-			levelData->floor.GetInfoFromCoordX(spriteMetadata->coords.x, &floorPos, &floorNormal);
-			spriteMetadata->restAngle = acosf(Dot(Vec2::unitY, floorNormal));
-			if (floorNormal.x > 0.0f) {
-				spriteMetadata->restAngle = -spriteMetadata->restAngle;
-			}
+			objectInds.Append(i);
+			objectCoordX.Append(coords.x);
+		}
+	}
+
+	Vec2 objectFloorPos[LEVEL_SPRITES_MAX];
+	Vec2 objectFloorNormal[LEVEL_SPRITES_MAX];
+	levelData->floor.GetInfoFromCoordXBatch(objectCoordX.data, objectCoordX.size, objectFloorPos, objectFloorNormal);
+	for (uint64 i = 0; i < objectInds.size; i++) {
+		SpriteMetadata* spriteMetadata = &levelData->spriteMetadata[objectInds[i]];
+		Vec2 floorNormal = objectFloorNormal[i];
+		spriteMetadata->restAngle = acosf(Dot(Vec2::unitY, floorNormal));
+		if (floorNormal.x > 0.0f) {
+			spriteMetadata->restAngle = -spriteMetadata->restAngle;
 		}
 	}
 
@@ -506,6 +519,20 @@ bool LoadLevelData(LevelData* levelData, const_string name, float32 pixelsPerUni
 	return true;
 }
 
+void PrecomputeLineColliderHeights(LevelData* levelData)
+{
+	for (uint64 i = 0; i < levelData->lineColliders.size; i++) {
+		levelData->lineColliders[i].PrecomputeHeightsFromFloor(levelData->floor);
+	}
+}
+
+void ClearLineColliderHeights(LevelData* levelData)
+{
+	for (uint64 i = 0; i < levelData->lineColliders.size; i++) {
+		levelData->lineColliders[i].heightSamples.Clear();
+	}
+}
+
 void UnloadLevelData(LevelData* levelData)
 {
 	for (uint64 i = 0; i < levelData->sprites.size; i++) {
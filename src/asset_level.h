@@ -58,3 +58,7 @@ struct LevelData
 
 bool LoadLevelData(LevelData* levelData, const_string name, float32 pixelsPerUnit, MemoryBlock transient);
 void UnloadLevelData(LevelData* levelData);
+// Line collider height tables depend on the floor, so call this after any change to the floor collider
+void PrecomputeLineColliderHeights(LevelData* levelData);
+// Drops the height tables, so line collider lookups raycast against the floor until they're precomputed again
+void ClearLineColliderHeights(LevelData* levelData);
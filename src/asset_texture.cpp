@@ -28,6 +28,21 @@ bool LoadTexture(const uint8* data, GLint width, GLint height, GLint format,
 	return true;
 }
 
+void ReplaceTexture(const uint8* data, GLint width, GLint height, GLint format, TextureGL* textureGL)
+{
+	glBindTexture(GL_TEXTURE_2D, textureGL->textureID);
+	glTexImage2D(GL_TEXTURE_2D, 0, format, width, height,
+                 0, format, GL_UNSIGNED_BYTE, (const GLvoid*)data);
+	textureGL->size = Vec2Int { width, height };
+}
+
+void UpdateTextureRect(const uint8* data, Vec2Int origin, Vec2Int size, GLint format, const TextureGL& textureGL)
+{
+	glBindTexture(GL_TEXTURE_2D, textureGL.textureID);
+	glTexSubImage2D(GL_TEXTURE_2D, 0, origin.x, origin.y, size.x, size.y,
+                    format, GL_UNSIGNED_BYTE, (const GLvoid*)data);
+}
+
 void UnloadTexture(const TextureGL& textureGL)
 {
 	glDeleteTextures(1, &textureGL.textureID);
@@ -14,6 +14,9 @@ struct TextureGL
 
 bool LoadTexture(const uint8* data, GLint width, GLint height, GLint format,
                  GLint magFilter, GLint minFilter, GLint wrapS, GLint wrapT, TextureGL* outTextureGL);
+// Both keep the texture's handle and parameters. ReplaceTexture can change its size.
+void ReplaceTexture(const uint8* data, GLint width, GLint height, GLint format, TextureGL* textureGL);
+void UpdateTextureRect(const uint8* data, Vec2Int origin, Vec2Int size, GLint format, const TextureGL& textureGL);
 void UnloadTexture(const TextureGL& textureGL);
 
 template <typename Allocator>
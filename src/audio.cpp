@@ -1,74 +1,392 @@
 #include "audio.h"
 
 #include <km_common/km_debug.h>
+#include <pmmintrin.h>
+#undef internal
+#include <chrono>
+#include <thread>
+#define internal static
 
 #include "main.h"
 
-template <typename Allocator>
-internal bool SoundInit(Allocator* allocator, const GameAudio* audio, Sound* sound,
-                        const char* filePath)
+// Waits for the device to use up some of the mix-ahead between mixer updates
+#define AUDIO_THREAD_SLEEP_MS 1
+
+static_assert(AUDIO_MIX_AHEAD_SAMPLES + AUDIO_MIX_BLOCK_SAMPLES <= AUDIO_RING_SAMPLES,
+              "the mixer must not overwrite samples the device hasn't been given yet");
+
+internal void ApplyAudioCommand(AudioState* audioState, const AudioCommand& command)
 {
-	sound->play = false;
-	sound->playing = false;
-	sound->sampleIndex = 0;
-    
-	return LoadWAV(allocator, filePath, audio, &sound->buffer);
+	AudioMixer* mixer = &audioState->mixer;
+	switch (command.type) {
+		case AudioCommandType::PLAY: {
+			if (PlayVoice(mixer, command.voice, command.buffer, command.bus, command.gain, command.pan,
+                          command.priority) && command.positional) {
+				SetVoicePosition(mixer, command.voice, command.coords, command.radius);
+			}
+		} break;
+		case AudioCommandType::PLAY_STREAM: {
+			if (!PlayStreamVoice(mixer, command.voice, command.stream, command.bus, command.gain, command.pan,
+                                 command.priority)) {
+				command.stream->playing.store(false, std::memory_order_release);
+			}
+			else if (command.positional) {
+				SetVoicePosition(mixer, command.voice, command.coords, command.radius);
+			}
+		} break;
+		case AudioCommandType::STOP: {
+			StopVoice(mixer, command.voice);
+		} break;
+		case AudioCommandType::SET_GAIN_PAN: {
+			SetVoiceGainPan(mixer, command.voice, command.gain, command.pan);
+		} break;
+		case AudioCommandType::SET_PITCH: {
+			SetVoicePitch(mixer, command.voice, command.pitch);
+		} break;
+		case AudioCommandType::SET_BUS: {
+			SetAudioBusParams(&audioState->busGraph, command.bus, command.busParams);
+		} break;
+		case AudioCommandType::SET_POSITION: {
+			SetVoicePosition(mixer, command.voice, command.coords, command.radius);
+		} break;
+		case AudioCommandType::SET_LISTENER: {
+			audioState->listenerCoords = command.coords;
+			audioState->floorLength = command.floorLength;
+		} break;
+	}
 }
 
-internal void SoundUpdate(const GameAudio* audio, Sound* sound)
+// Sets positional voices' attenuation and pan from where they are relative to the listener.
+// Voices at or beyond their radius get 0 attenuation, so they're culled.
+internal void SpatializeVoices(AudioState* audioState)
 {
-	if (sound->playing) {
-		sound->sampleIndex += audio->sampleDelta;
-		if (sound->sampleIndex >= sound->buffer.bufferSizeSamples) {
-			sound->playing = false;
+	AudioMixer* mixer = &audioState->mixer;
+	for (int i = 0; i < mixer->numVoices; i++) {
+		AudioVoice* voice = &mixer->voices[i];
+		if (!voice->positional) {
+			continue;
+		}
+
+		Vec2 offset = WrappedWorldOffset(audioState->listenerCoords, voice->coords, audioState->floorLength);
+		float32 falloff = voice->radius > 0.0f ? MaxFloat32(1.0f - Mag(offset) / voice->radius, 0.0f) : 0.0f;
+		float32 pan = ClampFloat32(offset.x / AUDIO_PAN_DISTANCE, -1.0f, 1.0f);
+		SetVoiceAttenuationPan(voice, falloff * falloff, pan);
+	}
+}
+
+// Runs the queued commands, then mixes blocks into the ring until it's far enough ahead of the device
+internal void UpdateMixer(AudioState* audioState)
+{
+	AudioCommandQueue* queue = &audioState->commands;
+	uint32 read = queue->read.load(std::memory_order_relaxed);
+	uint32 write = queue->write.load(std::memory_order_acquire);
+	for (; read != write; read++) {
+		ApplyAudioCommand(audioState, queue->commands[read % AUDIO_COMMANDS_MAX]);
+	}
+	queue->read.store(read, std::memory_order_release);
+	SpatializeVoices(audioState);
+
+	uint64 ringRead = audioState->ringRead.load(std::memory_order_acquire);
+	uint64 ringWrite = audioState->ringWrite.load(std::memory_order_relaxed);
+	if (ringWrite < ringRead) {
+		// The device got ahead of the mixer. Skip the samples it missed, but keep the voices in time.
+		audioState->mixerAdvance += ringRead - ringWrite;
+		ringWrite = ringRead;
+	}
+
+	// Filter states and reverb tails decay into denormals, which are very slow to compute with
+	const uint32 csr = _mm_getcsr();
+	_mm_setcsr(csr | _MM_FLUSH_ZERO_ON | _MM_DENORMALS_ZERO_ON);
+
+	AudioBusGraph* busGraph = &audioState->busGraph;
+	uint64 ringTarget = ringRead + audioState->mixAhead.load(std::memory_order_relaxed);
+	while (ringWrite < ringTarget) {
+		AdvanceVoices(&audioState->mixer, audioState->mixerAdvance);
+		audioState->mixerAdvance = AUDIO_MIX_BLOCK_SAMPLES;
+
+		BeginAudioBusBlock(busGraph);
+		for (int b = 0; b < (int)AudioBusId::MASTER; b++) {
+			const std::chrono::steady_clock::time_point busStart = std::chrono::steady_clock::now();
+			MixVoices(&audioState->mixer, (AudioBusId)b, busGraph->buses[b].buffer, AUDIO_MIX_BLOCK_SAMPLES);
+			ProcessAudioBus(busGraph, (AudioBusId)b);
+			const std::chrono::duration<float32> elapsed = std::chrono::steady_clock::now() - busStart;
+			RecordAudioBusTime(busGraph, (AudioBusId)b, elapsed.count());
 		}
+		const std::chrono::steady_clock::time_point masterStart = std::chrono::steady_clock::now();
+		ProcessMasterBus(busGraph, audioState->mixBlock);
+		const std::chrono::duration<float32> masterElapsed = std::chrono::steady_clock::now() - masterStart;
+		RecordAudioBusTime(busGraph, AudioBusId::MASTER, masterElapsed.count());
+
+		uint64 ringIndex = ringWrite % AUDIO_RING_SAMPLES;
+		uint64 samples1 = MinUInt64(AUDIO_MIX_BLOCK_SAMPLES, AUDIO_RING_SAMPLES - ringIndex);
+		MemCopy(audioState->ring + ringIndex * AUDIO_MAX_CHANNELS, audioState->mixBlock,
+                samples1 * AUDIO_MAX_CHANNELS * sizeof(float32));
+		MemCopy(audioState->ring, audioState->mixBlock + samples1 * AUDIO_MAX_CHANNELS,
+                (AUDIO_MIX_BLOCK_SAMPLES - samples1) * AUDIO_MAX_CHANNELS * sizeof(float32));
+
+		ringWrite += AUDIO_MIX_BLOCK_SAMPLES;
+		audioState->ringWrite.store(ringWrite, std::memory_order_release);
 	}
-	if (sound->play) {
-		sound->play = false;
-		sound->playing = true;
-		sound->sampleIndex = 0;
+
+	_mm_setcsr(csr);
+
+	int numCulledVoices = 0;
+	for (int i = 0; i < audioState->mixer.numVoices; i++) {
+		if (audioState->mixer.voices[i].attenuation == 0.0f) {
+			numCulledVoices++;
+		}
+	}
+	audioState->numVoices.store(audioState->mixer.numVoices, std::memory_order_relaxed);
+	audioState->numCulledVoices.store(numCulledVoices, std::memory_order_relaxed);
+	for (int b = 0; b < (int)AudioBusId::COUNT; b++) {
+		audioState->busTime[b].store(busGraph->busTime[b], std::memory_order_relaxed);
 	}
 }
 
-internal void SoundWriteSamples(const Sound* sound, float32 amplitude,
-                                GameAudio* audio)
+#if AUDIO_THREAD
+internal void AudioThreadMain(AudioState* audioState)
 {
-	if (!sound->playing) {
-		return;
+	while (true) {
+		UpdateMixer(audioState);
+		std::this_thread::sleep_for(std::chrono::milliseconds(AUDIO_THREAD_SLEEP_MS));
 	}
-    
-	const AudioBuffer* buffer = &sound->buffer;
-	uint64 samplesToWrite = audio->fillLength;
-	if (sound->sampleIndex + samplesToWrite > buffer->bufferSizeSamples) {
-		samplesToWrite = buffer->bufferSizeSamples - sound->sampleIndex;
-	}
-	for (uint64 i = 0; i < samplesToWrite; i++) {
-		uint64 sampleInd = sound->sampleIndex + i;
-		float32 sample1 = amplitude
-			* buffer->buffer[sampleInd * audio->channels];
-		float32 sample2 = amplitude
-			* buffer->buffer[sampleInd * audio->channels + 1];
-        
-		audio->buffer[i * audio->channels] += sample1;
-		audio->buffer[i * audio->channels + 1] += sample2;
+}
+#endif
+
+// Returns false (and drops the command) if the queue is full
+internal bool PushAudioCommand(AudioState* audioState, const AudioCommand& command)
+{
+	AudioCommandQueue* queue = &audioState->commands;
+	uint32 write = queue->write.load(std::memory_order_relaxed);
+	uint32 read = queue->read.load(std::memory_order_acquire);
+	if (write - read >= AUDIO_COMMANDS_MAX) {
+		LOG_ERROR("Audio command queue full, dropping command %d\n", (int)command.type);
+		return false;
+	}
+
+	queue->commands[write % AUDIO_COMMANDS_MAX] = command;
+	queue->write.store(write + 1, std::memory_order_release);
+	return true;
+}
+
+internal uint32 NextVoiceId(AudioState* audioState)
+{
+	uint32 id = audioState->nextVoice++;
+	if (audioState->nextVoice == AUDIO_VOICE_NONE) {
+		audioState->nextVoice++;
+	}
+	return id;
+}
+
+// Rewinds the stream and lists it for UpdateAudioStreams to read ahead on
+internal bool StartStream(AudioState* audioState, AudioStream* stream)
+{
+	if (stream->playing.load(std::memory_order_acquire)) {
+		LOG_ERROR("Audio stream is already playing\n");
+		return false;
+	}
+
+	// A stopped stream can still be listed, if UpdateAudioStreams hasn't run since
+	bool listed = false;
+	for (int i = 0; i < audioState->numStreams; i++) {
+		listed |= audioState->streams[i] == stream;
+	}
+	if (!listed) {
+		if (audioState->numStreams >= AUDIO_STREAMS_MAX) {
+			LOG_ERROR("Too many audio streams playing\n");
+			return false;
+		}
+		audioState->streams[audioState->numStreams++] = stream;
+	}
+
+	RewindAudioStream(stream);
+	stream->playing.store(true, std::memory_order_relaxed);
+	return true;
+}
+
+internal uint32 PushPlayStreamCommand(AudioState* audioState, const AudioCommand& command)
+{
+	if (!StartStream(audioState, command.stream)) {
+		return AUDIO_VOICE_NONE;
+	}
+	if (!PushAudioCommand(audioState, command)) {
+		// The mixer never saw it, so UpdateAudioStreams drops it
+		command.stream->playing.store(false, std::memory_order_relaxed);
+		return AUDIO_VOICE_NONE;
 	}
+	return command.voice;
+}
+
+// Reads ahead on playing streams, so the mixer never waits on the disk, and forgets the ones it's done with
+internal void UpdateAudioStreams(AudioState* audioState)
+{
+	int i = 0;
+	while (i < audioState->numStreams) {
+		AudioStream* stream = audioState->streams[i];
+		if (!stream->playing.load(std::memory_order_acquire)) {
+			audioState->streams[i] = audioState->streams[--audioState->numStreams];
+		}
+		else {
+			FillAudioStream(stream);
+			i++;
+		}
+	}
+}
+
+uint32 PlaySound(AudioState* audioState, const AudioBuffer* buffer, AudioBusId bus,
+                 float32 gain, float32 pan, int priority)
+{
+	AudioCommand command = {};
+	command.type = AudioCommandType::PLAY;
+	command.voice = NextVoiceId(audioState);
+	command.buffer = buffer;
+	command.bus = bus;
+	command.gain = gain;
+	command.pan = pan;
+	command.priority = priority;
+	return PushAudioCommand(audioState, command) ? command.voice : AUDIO_VOICE_NONE;
+}
+
+uint32 PlayStream(AudioState* audioState, AudioStream* stream, AudioBusId bus,
+                  float32 gain, float32 pan, int priority)
+{
+	AudioCommand command = {};
+	command.type = AudioCommandType::PLAY_STREAM;
+	command.voice = NextVoiceId(audioState);
+	command.stream = stream;
+	command.bus = bus;
+	command.gain = gain;
+	command.pan = pan;
+	command.priority = priority;
+	return PushPlayStreamCommand(audioState, command);
+}
+
+void StopSound(AudioState* audioState, uint32 voice)
+{
+	AudioCommand command = {};
+	command.type = AudioCommandType::STOP;
+	command.voice = voice;
+	PushAudioCommand(audioState, command);
+}
+
+void SetSoundGainPan(AudioState* audioState, uint32 voice, float32 gain, float32 pan)
+{
+	AudioCommand command = {};
+	command.type = AudioCommandType::SET_GAIN_PAN;
+	command.voice = voice;
+	command.gain = gain;
+	command.pan = pan;
+	PushAudioCommand(audioState, command);
+}
+
+void SetSoundPitch(AudioState* audioState, uint32 voice, float32 pitch)
+{
+	AudioCommand command = {};
+	command.type = AudioCommandType::SET_PITCH;
+	command.voice = voice;
+	command.pitch = pitch;
+	PushAudioCommand(audioState, command);
+}
+
+void SetBusParams(AudioState* audioState, AudioBusId bus, const AudioBusParams& params)
+{
+	AudioCommand command = {};
+	command.type = AudioCommandType::SET_BUS;
+	command.bus = bus;
+	command.busParams = params;
+	PushAudioCommand(audioState, command);
+}
+
+uint32 PlaySoundAt(AudioState* audioState, const AudioBuffer* buffer, AudioBusId bus,
+                   Vec2 coords, float32 radius, float32 gain, int priority)
+{
+	AudioCommand command = {};
+	command.type = AudioCommandType::PLAY;
+	command.voice = NextVoiceId(audioState);
+	command.buffer = buffer;
+	command.bus = bus;
+	command.gain = gain;
+	command.priority = priority;
+	command.positional = true;
+	command.coords = coords;
+	command.radius = radius;
+	return PushAudioCommand(audioState, command) ? command.voice : AUDIO_VOICE_NONE;
+}
+
+uint32 PlayStreamAt(AudioState* audioState, AudioStream* stream, AudioBusId bus,
+                    Vec2 coords, float32 radius, float32 gain, int priority)
+{
+	AudioCommand command = {};
+	command.type = AudioCommandType::PLAY_STREAM;
+	command.voice = NextVoiceId(audioState);
+	command.stream = stream;
+	command.bus = bus;
+	command.gain = gain;
+	command.priority = priority;
+	command.positional = true;
+	command.coords = coords;
+	command.radius = radius;
+	return PushPlayStreamCommand(audioState, command);
+}
+
+void SetSoundPosition(AudioState* audioState, uint32 voice, Vec2 coords, float32 radius)
+{
+	AudioCommand command = {};
+	command.type = AudioCommandType::SET_POSITION;
+	command.voice = voice;
+	command.coords = coords;
+	command.radius = radius;
+	PushAudioCommand(audioState, command);
+}
+
+void SetAudioListener(AudioState* audioState, Vec2 coords, float32 floorLength)
+{
+	AudioCommand command = {};
+	command.type = AudioCommandType::SET_LISTENER;
+	command.coords = coords;
+	command.floorLength = floorLength;
+	PushAudioCommand(audioState, command);
 }
 
 template <typename Allocator>
-bool InitAudioState(Allocator* allocator, AudioState* audioState, GameAudio* audio)
+bool InitAudioState(Allocator* allocator, MemoryBlock clipMemory, AudioState* audioState, GameAudio* audio)
 {
 	// audioState->globalMute = false;
 	audioState->globalMute = true;
+	audioState->nextVoice = 1;
+	audioState->numStreams = 0;
     
-	if (!SoundInit(allocator, audio, &audioState->soundJump, "data/audio/yow.wav")) {
+	LinearAllocator clipAllocator(clipMemory.size, clipMemory.memory);
+	if (!LoadWAV(allocator, &clipAllocator, "data/audio/yow.wav", audio, AudioFormat::ADPCM,
+                 &audioState->soundJump)) {
 		LOG_ERROR("Failed to init jump sound");
 		return false;
 	}
     
+	audioState->commands.write = 0;
+	audioState->commands.read = 0;
+	InitAudioMixer(&audioState->mixer);
+	InitAudioBusGraph(&audioState->busGraph, audio->sampleRate);
+	audioState->listenerCoords = Vec2::zero;
+	audioState->floorLength = 0.0f;
+	audioState->mixerAdvance = 0;
+	audioState->ringRead = 0;
+	audioState->ringWrite = 0;
+	audioState->mixAhead = AUDIO_MIX_AHEAD_SAMPLES;
+	audioState->numVoices = 0;
+	audioState->numCulledVoices = 0;
+	for (int b = 0; b < (int)AudioBusId::COUNT; b++) {
+		audioState->busTime[b] = 0.0f;
+	}
+    
 #if GAME_INTERNAL
 	audioState->debugView = false;
 #endif
     
+#if AUDIO_THREAD
+	std::thread(AudioThreadMain, audioState).detach();
+#endif
+    
 	return true;
 }
 
@@ -79,22 +397,38 @@ void OutputAudio(GameAudio* audio, GameState* gameState, const GameInput& input,
 	DEBUG_ASSERT(audio->channels == 2); // Stereo support only
 	AudioState* audioState = &gameState->audioState;
     
-	SoundUpdate(audio, &audioState->soundJump);
+	UpdateAudioStreams(audioState);
     
-	for (int i = 0; i < audio->fillLength; i++) {
-		audio->buffer[i * audio->channels] = 0.0f;
-		audio->buffer[i * audio->channels + 1] = 0.0f;
-	}
+	uint64 fillLength = (uint64)audio->fillLength;
+	uint64 ringRead = audioState->ringRead.load(std::memory_order_relaxed) + audio->sampleDelta;
+	audioState->mixAhead.store((uint32)MaxInt(AUDIO_MIX_AHEAD_SAMPLES, audio->fillLength),
+                               std::memory_order_relaxed);
+	audioState->ringRead.store(ringRead, std::memory_order_release);
+    
+#if !AUDIO_THREAD
+	UpdateMixer(audioState);
+#endif
     
+	// Whatever the mixer hasn't gotten to yet is silence
+	uint64 ringWrite = audioState->ringWrite.load(std::memory_order_acquire);
+	uint64 samples = ringWrite > ringRead ? MinUInt64(ringWrite - ringRead, fillLength) : 0;
 	if (audioState->globalMute) {
-		return;
+		samples = 0;
 	}
     
-	SoundWriteSamples(&audioState->soundJump, 1.0f, audio);
+	uint64 ringIndex = ringRead % AUDIO_RING_SAMPLES;
+	uint64 samples1 = MinUInt64(samples, AUDIO_RING_SAMPLES - ringIndex);
+	MemCopy(audio->buffer, audioState->ring + ringIndex * AUDIO_MAX_CHANNELS,
+            samples1 * AUDIO_MAX_CHANNELS * sizeof(float32));
+	MemCopy(audio->buffer + samples1 * AUDIO_MAX_CHANNELS, audioState->ring,
+            (samples - samples1) * AUDIO_MAX_CHANNELS * sizeof(float32));
+	ClearAudioBuffer(audio->buffer + samples * AUDIO_MAX_CHANNELS, fillLength - samples);
 }
 
 #if GAME_INTERNAL
 
+const char* AUDIO_BUS_NAMES[] = { "SFX", "Music", "Ambience", "Master" };
+
 internal void DrawAudioBuffer(
                               const GameState* gameState, const GameAudio* audio,
                               const float32* buffer, uint64 bufferSizeSamples, uint8 channel,
@@ -162,7 +496,7 @@ void DrawDebugAudioInfo(const GameAudio* audio, GameState* gameState,
 		};
 		Vec2Int audioInfoPos = {
 			screenInfo.size.x - MARGIN.x - PILLARBOX_WIDTH,
-			MARGIN.y + AbsInt(audioInfoStride.y) * 4
+			MARGIN.y + AbsInt(audioInfoStride.y) * (5 + (int)AudioBusId::COUNT)
 		};
 		DrawText(gameState->textGL, gameState->assets.fontFaceSmall, screenInfo,
                  ToString("Audio Engine"), audioInfoPos, TEXT_ANCHOR,
@@ -190,6 +524,29 @@ void DrawDebugAudioInfo(const GameAudio* audio, GameState* gameState,
                  debugFontColor,
                  &tempAllocator
                  );
+		stbsp_snprintf(strBuf, STR_BUF_LENGTH, "Voices: %d/%d (%d culled)",
+                       audioState->numVoices.load(std::memory_order_relaxed), AUDIO_VOICES_MAX,
+                       audioState->numCulledVoices.load(std::memory_order_relaxed));
+		audioInfoPos += audioInfoStride;
+		DrawText(gameState->textGL, gameState->assets.fontFaceSmall, screenInfo,
+                 ToString(strBuf), audioInfoPos, TEXT_ANCHOR,
+                 debugFontColor,
+                 &tempAllocator
+                 );
+		// Time per block, and as a share of the time the block plays for
+		DEBUG_ASSERT(C_ARRAY_LENGTH(AUDIO_BUS_NAMES) == (int)AudioBusId::COUNT);
+		const float32 blockTime = (float32)AUDIO_MIX_BLOCK_SAMPLES / audio->sampleRate;
+		for (int b = 0; b < (int)AudioBusId::COUNT; b++) {
+			float32 busTime = audioState->busTime[b].load(std::memory_order_relaxed);
+			stbsp_snprintf(strBuf, STR_BUF_LENGTH, "%s bus: %.1f us (%.2f%%)",
+                           AUDIO_BUS_NAMES[b], busTime * 1000000.0f, busTime / blockTime * 100.0f);
+			audioInfoPos += audioInfoStride;
+			DrawText(gameState->textGL, gameState->assets.fontFaceSmall, screenInfo,
+                     ToString(strBuf), audioInfoPos, TEXT_ANCHOR,
+                     debugFontColor,
+                     &tempAllocator
+                     );
+		}
         
 		DrawAudioBuffer(gameState, audio,
                         audio->buffer, audio->fillLength, 0,
@@ -1,35 +1,129 @@
 #pragma once
 
 #include <km_common/km_defines.h>
+#undef internal
+#include <atomic>
+#define internal static
 
 #include "asset_audio.h"
+#include "audio_mixer.h"
 
-struct Sound
+// The mixer runs on its own thread, ahead of the device. Internal builds can hot reload game code out from
+// under a running thread, so there it runs in OutputAudio instead, through the same command queue and ring.
+#define AUDIO_THREAD !GAME_INTERNAL
+
+#define AUDIO_COMMANDS_MAX 256
+#define AUDIO_RING_SAMPLES 16384
+#define AUDIO_MIX_BLOCK_SAMPLES AUDIO_BUS_BLOCK_SAMPLES
+// The mixer stays at least this many samples (or the platform's fill length, if larger) ahead of the device
+#define AUDIO_MIX_AHEAD_SAMPLES 2048
+// Horizontal distance from the listener, in floor units, at which positional sounds are panned fully to one side
+#define AUDIO_PAN_DISTANCE 6.0f
+// Streams playing at once. They're read ahead from disk on the game thread, in OutputAudio.
+#define AUDIO_STREAMS_MAX 8
+
+enum class AudioCommandType
+{
+	PLAY,
+	PLAY_STREAM,
+	STOP,
+	SET_GAIN_PAN,
+	SET_PITCH,
+	SET_BUS,
+	SET_POSITION,
+	SET_LISTENER
+};
+
+struct AudioCommand
+{
+	AudioCommandType type;
+	uint32 voice;
+	const AudioBuffer* buffer;
+	AudioStream* stream;
+	AudioBusId bus;
+	AudioBusParams busParams;
+	float32 gain;
+	float32 pan;
+	float32 pitch;
+	int priority;
+	bool positional; // for PLAY and PLAY_STREAM
+	Vec2 coords;
+	float32 radius;
+	float32 floorLength; // for SET_LISTENER
+};
+
+// Lock-free, single producer (the game thread) and single consumer (the mixer)
+struct AudioCommandQueue
 {
-	bool play;
-    bool playing;
-	uint64 sampleIndex;
-    
-	AudioBuffer buffer;
+	AudioCommand commands[AUDIO_COMMANDS_MAX];
+	std::atomic<uint32> write;
+	std::atomic<uint32> read;
 };
 
 struct AudioState
 {
-	Sound soundJump;
-    
+	// Game thread only
+	AudioBuffer soundJump;
+	uint32 nextVoice;
 	bool globalMute;
-    
+	AudioStream* streams[AUDIO_STREAMS_MAX]; // played and not yet handed back by the mixer
+	int numStreams;
+
+	AudioCommandQueue commands;
+
+	// Mixer only
+	AudioMixer mixer;
+	AudioBusGraph busGraph;
+	Vec2 listenerCoords;
+	float32 floorLength;
+	uint64 mixerAdvance; // samples mixed since the voices were last advanced
+	float32 mixBlock[AUDIO_MIX_BLOCK_SAMPLES * AUDIO_MAX_CHANNELS];
+
+	// Mixed output. Sample i is at ring[(i % AUDIO_RING_SAMPLES) * AUDIO_MAX_CHANNELS], where samples
+	// ringRead (the device position, moved by the game thread) to ringWrite - 1 (moved by the mixer) are ready.
+	float32 ring[AUDIO_RING_SAMPLES * AUDIO_MAX_CHANNELS];
+	std::atomic<uint64> ringRead;
+	std::atomic<uint64> ringWrite;
+	std::atomic<uint32> mixAhead;
+	std::atomic<int> numVoices;
+	std::atomic<int> numCulledVoices;
+	std::atomic<float32> busTime[(int)AudioBusId::COUNT]; // copied from busGraph, for the debug view
+
 #if GAME_INTERNAL
 	bool debugView;
 #endif
 };
 
 struct GameState;
+// Clips are loaded into clipMemory, which must last as long as the audio state
 template <typename Allocator>
-bool InitAudioState(Allocator* allocator, AudioState* audioState, GameAudio* audio);
+bool InitAudioState(Allocator* allocator, MemoryBlock clipMemory, AudioState* audioState, GameAudio* audio);
 void OutputAudio(GameAudio* audio, GameState* gameState, const GameInput& input,
                  MemoryBlock transient);
 
+// These queue a command for the mixer, so sounds start and change on its next block.
+// Returns the new voice's id, or AUDIO_VOICE_NONE if the command queue is full.
+// Streams are rewound here, and can't be played again until their voice is gone.
+uint32 PlaySound(AudioState* audioState, const AudioBuffer* buffer, AudioBusId bus,
+                 float32 gain, float32 pan, int priority);
+uint32 PlayStream(AudioState* audioState, AudioStream* stream, AudioBusId bus,
+                  float32 gain, float32 pan, int priority);
+void StopSound(AudioState* audioState, uint32 voice);
+void SetSoundGainPan(AudioState* audioState, uint32 voice, float32 gain, float32 pan);
+void SetSoundPitch(AudioState* audioState, uint32 voice, float32 pitch);
+void SetBusParams(AudioState* audioState, AudioBusId bus, const AudioBusParams& params);
+
+// Positional sounds are placed in floor coordinates. Their gain falls off with distance from the listener
+// (the camera) to 0 at radius, where they're culled, and they're panned by their horizontal offset from it.
+uint32 PlaySoundAt(AudioState* audioState, const AudioBuffer* buffer, AudioBusId bus,
+                   Vec2 coords, float32 radius, float32 gain, int priority);
+uint32 PlayStreamAt(AudioState* audioState, AudioStream* stream, AudioBusId bus,
+                    Vec2 coords, float32 radius, float32 gain, int priority);
+// Moves a positional sound, e.g. to follow the entity it's attached to
+void SetSoundPosition(AudioState* audioState, uint32 voice, Vec2 coords, float32 radius);
+// Call every frame with the camera's floor coordinates
+void SetAudioListener(AudioState* audioState, Vec2 coords, float32 floorLength);
+
 #if GAME_INTERNAL
 void DrawDebugAudioInfo(const GameAudio* audio, GameState* gameState,
                         const GameInput& input, ScreenInfo screenInfo, MemoryBlock transient, Vec4 debugFontColor);
@@ -0,0 +1,200 @@
+#include "audio_bus.h"
+
+#include <emmintrin.h>
+#include <km_common/km_debug.h>
+#include <km_common/km_lib.h>
+#include <km_common/km_math.h>
+#include <math.h>
+
+// Weight of the latest block in the smoothed bus times
+#define AUDIO_BUS_TIME_SMOOTHING 0.05f
+
+#define AUDIO_REVERB_FEEDBACK 0.8f
+#define AUDIO_REVERB_DAMPING 0.45f // lowpass coefficient in the feedback loop, lower is darker
+#define AUDIO_REVERB_WET 0.35f
+
+static_assert(AUDIO_BUS_BLOCK_SAMPLES % 2 == 0, "bus blocks are processed 2 stereo samples at a time");
+static_assert((AUDIO_REVERB_LINE_SAMPLES & (AUDIO_REVERB_LINE_SAMPLES - 1)) == 0,
+              "reverb line indices wrap with a mask");
+
+// Mutually prime, around 28-41 ms at 48 kHz, so the echoes don't line up
+const uint32 REVERB_DELAYS[AUDIO_REVERB_LINES] = { 1327, 1523, 1777, 1949 };
+
+internal float32 OnePoleCoeff(float32 hz, uint32 sampleRate)
+{
+	return 1.0f - expf(-2.0f * PI_F * hz / sampleRate);
+}
+
+internal void UpdateBusCoeffs(AudioBus* bus, uint32 sampleRate)
+{
+	bool wasFiltered = bus->lowpassCoeff != 1.0f || bus->highpassCoeff != 0.0f;
+
+	const AudioBusParams& params = bus->params;
+	bool lowpass = params.lowpassHz > 0.0f && params.lowpassHz < sampleRate / 2.0f;
+	bus->lowpassCoeff = lowpass ? OnePoleCoeff(params.lowpassHz, sampleRate) : 1.0f;
+	bus->highpassCoeff = params.highpassHz > 0.0f ? OnePoleCoeff(params.highpassHz, sampleRate) : 0.0f;
+
+	if (!wasFiltered) {
+		// Don't start from whatever the filters held when they were last on
+		bus->lowpassState[0] = 0.0f;
+		bus->lowpassState[1] = 0.0f;
+		bus->highpassState[0] = 0.0f;
+		bus->highpassState[1] = 0.0f;
+	}
+}
+
+void InitAudioBusGraph(AudioBusGraph* graph, uint32 sampleRate)
+{
+	graph->sampleRate = sampleRate;
+	for (int b = 0; b < (int)AudioBusId::COUNT; b++) {
+		AudioBus* bus = &graph->buses[b];
+		bus->params.gain = 1.0f;
+		bus->params.lowpassHz = 0.0f;
+		bus->params.highpassHz = 0.0f;
+		bus->params.reverbSend = 0.0f;
+		bus->gain = 1.0f;
+		bus->lowpassCoeff = 1.0f;
+		bus->highpassCoeff = 0.0f;
+		UpdateBusCoeffs(bus, sampleRate);
+		graph->busTime[b] = 0.0f;
+	}
+
+	AudioReverb* reverb = &graph->reverb;
+	MemSet(reverb->lines, 0, sizeof(reverb->lines));
+	reverb->writeIndex = 0;
+	for (int i = 0; i < AUDIO_REVERB_LINES; i++) {
+		DEBUG_ASSERT(REVERB_DELAYS[i] < AUDIO_REVERB_LINE_SAMPLES);
+		reverb->dampingState[i] = 0.0f;
+	}
+}
+
+void SetAudioBusParams(AudioBusGraph* graph, AudioBusId bus, const AudioBusParams& params)
+{
+	DEBUG_ASSERT(bus < AudioBusId::COUNT);
+	AudioBus* audioBus = &graph->buses[(int)bus];
+	audioBus->params = params;
+	UpdateBusCoeffs(audioBus, graph->sampleRate);
+}
+
+void BeginAudioBusBlock(AudioBusGraph* graph)
+{
+	AudioBus* master = &graph->buses[(int)AudioBusId::MASTER];
+	MemSet(master->buffer, 0, sizeof(master->buffer));
+	MemSet(graph->reverb.input, 0, sizeof(graph->reverb.input));
+}
+
+// Lowpass, then highpass (the input minus a second lowpass), with both channels in one register
+internal void FilterBus(AudioBus* bus)
+{
+	if (bus->lowpassCoeff == 1.0f && bus->highpassCoeff == 0.0f) {
+		return;
+	}
+
+	const __m128 lowpassCoeff = _mm_set1_ps(bus->lowpassCoeff);
+	const __m128 highpassCoeff = _mm_set1_ps(bus->highpassCoeff);
+	__m128 lowpass = _mm_loadl_pi(_mm_setzero_ps(), (const __m64*)bus->lowpassState);
+	__m128 highpass = _mm_loadl_pi(_mm_setzero_ps(), (const __m64*)bus->highpassState);
+	for (int i = 0; i < AUDIO_BUS_BLOCK_SAMPLES; i++) {
+		float32* sample = bus->buffer + i * 2;
+		__m128 x = _mm_loadl_pi(_mm_setzero_ps(), (const __m64*)sample);
+		lowpass = _mm_add_ps(lowpass, _mm_mul_ps(lowpassCoeff, _mm_sub_ps(x, lowpass)));
+		highpass = _mm_add_ps(highpass, _mm_mul_ps(highpassCoeff, _mm_sub_ps(lowpass, highpass)));
+		_mm_storel_pi((__m64*)sample, _mm_sub_ps(lowpass, highpass));
+	}
+	_mm_storel_pi((__m64*)bus->lowpassState, lowpass);
+	_mm_storel_pi((__m64*)bus->highpassState, highpass);
+}
+
+// Scales the bus buffer in place, ramping from last block's gain to the current one
+internal void ApplyBusGain(AudioBus* bus)
+{
+	const float32 gainStep = (bus->params.gain - bus->gain) / AUDIO_BUS_BLOCK_SAMPLES;
+	const __m128 gainStep2 = _mm_set1_ps(gainStep * 2.0f);
+	__m128 gains = _mm_setr_ps(bus->gain + gainStep, bus->gain + gainStep,
+                               bus->gain + gainStep * 2.0f, bus->gain + gainStep * 2.0f);
+	for (int i = 0; i < AUDIO_BUS_BLOCK_SAMPLES; i += 2) {
+		float32* samples = bus->buffer + i * 2;
+		_mm_storeu_ps(samples, _mm_mul_ps(_mm_loadu_ps(samples), gains));
+		gains = _mm_add_ps(gains, gainStep2);
+	}
+	bus->gain = bus->params.gain;
+}
+
+internal void AddScaled(const float32* src, float32 scale, float32* dst)
+{
+	const __m128 scales = _mm_set1_ps(scale);
+	for (int i = 0; i < AUDIO_BUS_BLOCK_SAMPLES * 2; i += 4) {
+		__m128 sum = _mm_add_ps(_mm_loadu_ps(dst + i), _mm_mul_ps(_mm_loadu_ps(src + i), scales));
+		_mm_storeu_ps(dst + i, sum);
+	}
+}
+
+void ProcessAudioBus(AudioBusGraph* graph, AudioBusId bus)
+{
+	DEBUG_ASSERT(bus < AudioBusId::MASTER);
+	AudioBus* audioBus = &graph->buses[(int)bus];
+
+	FilterBus(audioBus);
+	ApplyBusGain(audioBus);
+	AddScaled(audioBus->buffer, 1.0f, graph->buses[(int)AudioBusId::MASTER].buffer);
+	if (audioBus->params.reverbSend > 0.0f) {
+		AddScaled(audioBus->buffer, audioBus->params.reverbSend, graph->reverb.input);
+	}
+}
+
+// Runs the delay lines one sample at a time, with the 4 lines in the 4 lanes of a register
+internal void ProcessReverb(AudioReverb* reverb, float32* output)
+{
+	const uint32 mask = AUDIO_REVERB_LINE_SAMPLES - 1;
+	const __m128 damping = _mm_set1_ps(AUDIO_REVERB_DAMPING);
+	// Hadamard matrix as 2 butterfly stages, scaled by 1/2 so it doesn't add energy
+	const __m128 signs1 = _mm_setr_ps(1.0f, -1.0f, 1.0f, -1.0f);
+	const __m128 signs2 = _mm_setr_ps(1.0f, 1.0f, -1.0f, -1.0f);
+	const __m128 feedback = _mm_set1_ps(AUDIO_REVERB_FEEDBACK * 0.5f);
+
+	__m128 state = _mm_loadu_ps(reverb->dampingState);
+	uint32 writeIndex = reverb->writeIndex;
+	float32 lineInputs[AUDIO_REVERB_LINES];
+	for (int i = 0; i < AUDIO_BUS_BLOCK_SAMPLES; i++) {
+		__m128 delayed = _mm_setr_ps(
+			reverb->lines[0][(writeIndex - REVERB_DELAYS[0]) & mask],
+			reverb->lines[1][(writeIndex - REVERB_DELAYS[1]) & mask],
+			reverb->lines[2][(writeIndex - REVERB_DELAYS[2]) & mask],
+			reverb->lines[3][(writeIndex - REVERB_DELAYS[3]) & mask]);
+		state = _mm_add_ps(state, _mm_mul_ps(damping, _mm_sub_ps(delayed, state)));
+
+		// Lines 0 and 2 go left, 1 and 3 right
+		__m128 out = _mm_add_ps(state, _mm_movehl_ps(state, state));
+		out = _mm_mul_ps(out, _mm_set1_ps(AUDIO_REVERB_WET));
+		__m128 dst = _mm_loadl_pi(_mm_setzero_ps(), (const __m64*)(output + i * 2));
+		_mm_storel_pi((__m64*)(output + i * 2), _mm_add_ps(dst, out));
+
+		__m128 mixed = _mm_add_ps(_mm_mul_ps(state, signs1), _mm_shuffle_ps(state, state, _MM_SHUFFLE(2, 3, 0, 1)));
+		mixed = _mm_add_ps(_mm_mul_ps(mixed, signs2), _mm_shuffle_ps(mixed, mixed, _MM_SHUFFLE(1, 0, 3, 2)));
+		float32 input = (reverb->input[i * 2] + reverb->input[i * 2 + 1]) * 0.5f;
+		_mm_storeu_ps(lineInputs, _mm_add_ps(_mm_mul_ps(mixed, feedback), _mm_set1_ps(input)));
+		for (int l = 0; l < AUDIO_REVERB_LINES; l++) {
+			reverb->lines[l][writeIndex] = lineInputs[l];
+		}
+		writeIndex = (writeIndex + 1) & mask;
+	}
+
+	_mm_storeu_ps(reverb->dampingState, state);
+	reverb->writeIndex = writeIndex;
+}
+
+void ProcessMasterBus(AudioBusGraph* graph, float32* output)
+{
+	AudioBus* master = &graph->buses[(int)AudioBusId::MASTER];
+	ProcessReverb(&graph->reverb, master->buffer);
+	FilterBus(master);
+	ApplyBusGain(master);
+	MemCopy(output, master->buffer, sizeof(master->buffer));
+}
+
+void RecordAudioBusTime(AudioBusGraph* graph, AudioBusId bus, float32 seconds)
+{
+	DEBUG_ASSERT(bus < AudioBusId::COUNT);
+	float32* busTime = &graph->busTime[(int)bus];
+	*busTime = Lerp(*busTime, seconds, AUDIO_BUS_TIME_SMOOTHING);
+}
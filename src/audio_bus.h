@@ -0,0 +1,72 @@
+#pragma once
+
+#include <km_common/km_defines.h>
+
+#define AUDIO_BUS_BLOCK_SAMPLES 256
+// Feedback delay network lines, one per SSE lane
+#define AUDIO_REVERB_LINES 4
+#define AUDIO_REVERB_LINE_SAMPLES 2048
+
+enum class AudioBusId
+{
+	SFX,
+	MUSIC,
+	AMBIENCE,
+	MASTER,
+
+	COUNT
+};
+
+struct AudioBusParams
+{
+	float32 gain;
+	float32 lowpassHz; // 0 disables the lowpass
+	float32 highpassHz; // 0 disables the highpass
+	float32 reverbSend; // gain into the shared reverb, ignored on the master bus
+};
+
+struct AudioBus
+{
+	AudioBusParams params;
+	float32 gain; // ramps to params.gain over a block, so gain changes don't click
+	float32 lowpassCoeff; // 1 when disabled
+	float32 highpassCoeff; // 0 when disabled
+	float32 lowpassState[2];
+	float32 highpassState[2];
+
+	float32 buffer[AUDIO_BUS_BLOCK_SAMPLES * 2];
+};
+
+// A cheap mono-in, stereo-out reverb: 4 delay lines of different lengths, with damping and
+// a Hadamard matrix mixing each line's output back into all of them
+struct AudioReverb
+{
+	float32 lines[AUDIO_REVERB_LINES][AUDIO_REVERB_LINE_SAMPLES];
+	uint32 writeIndex;
+	float32 dampingState[AUDIO_REVERB_LINES];
+
+	float32 input[AUDIO_BUS_BLOCK_SAMPLES * 2]; // sum of the bus sends
+};
+
+// SFX, music and ambience are mixed into their own buses, which feed the master bus and the reverb. The reverb
+// feeds the master bus, which writes the final output. Everything is processed in AUDIO_BUS_BLOCK_SAMPLES blocks.
+struct AudioBusGraph
+{
+	AudioBus buses[(int)AudioBusId::COUNT];
+	AudioReverb reverb;
+	uint32 sampleRate;
+
+	// Smoothed seconds per block spent on each bus, including mixing its voices (the master includes the reverb)
+	float32 busTime[(int)AudioBusId::COUNT];
+};
+
+void InitAudioBusGraph(AudioBusGraph* graph, uint32 sampleRate);
+void SetAudioBusParams(AudioBusGraph* graph, AudioBusId bus, const AudioBusParams& params);
+// Clears the master bus and the reverb input. Source bus buffers are overwritten by mixing voices into them.
+void BeginAudioBusBlock(AudioBusGraph* graph);
+// Filters and scales a source bus's buffer, then adds it to the master bus and the reverb input
+void ProcessAudioBus(AudioBusGraph* graph, AudioBusId bus);
+// Runs the reverb into the master bus, then writes the master bus to output (interleaved stereo)
+void ProcessMasterBus(AudioBusGraph* graph, float32* output);
+// Folds a block's measured time into the smoothed bus time
+void RecordAudioBusTime(AudioBusGraph* graph, AudioBusId bus, float32 seconds);
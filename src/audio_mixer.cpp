@@ -0,0 +1,367 @@
+#include "audio_mixer.h"
+
+#include <emmintrin.h>
+#include <km_common/km_debug.h>
+#include <km_common/km_math.h>
+#include <math.h>
+
+const float32 PITCH_FILTER_MAX[AUDIO_PITCH_FILTERS] = { 1.0f, 1.5f, 2.0f, AUDIO_PITCH_MAX };
+
+internal void SetVoiceGains(AudioVoice* voice, float32 gain, float32 pan)
+{
+	// Unity gain on both channels when centered, so stereo clips play back unchanged, with an
+	// equal-power falloff on the side being panned away from
+	pan = ClampFloat32(pan, -1.0f, 1.0f);
+	voice->gain = gain;
+	voice->pan = pan;
+	float32 audibleGain = gain * voice->attenuation;
+	voice->gainLeft = audibleGain * cosf(MaxFloat32(pan, 0.0f) * PI_F / 2.0f);
+	voice->gainRight = audibleGain * cosf(MaxFloat32(-pan, 0.0f) * PI_F / 2.0f);
+}
+
+internal int FindVoice(const AudioMixer* mixer, uint32 id)
+{
+	if (id == AUDIO_VOICE_NONE) {
+		return -1;
+	}
+	for (int i = 0; i < mixer->numVoices; i++) {
+		if (mixer->voices[i].id == id) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+// Hands a stream back to its owner once the mixer won't touch it again
+internal void ReleaseVoiceStream(AudioVoice* voice)
+{
+	if (voice->stream != nullptr) {
+		voice->stream->playing.store(false, std::memory_order_release);
+		voice->stream = nullptr;
+	}
+}
+
+internal void RemoveVoice(AudioMixer* mixer, int index)
+{
+	DEBUG_ASSERT(index >= 0 && index < mixer->numVoices);
+	ReleaseVoiceStream(&mixer->voices[index]);
+	mixer->voices[index] = mixer->voices[mixer->numVoices - 1];
+	mixer->numVoices--;
+}
+
+// Looping streams never finish
+internal uint64 GetVoiceLength(const AudioVoice& voice)
+{
+	if (voice.stream != nullptr) {
+		return voice.stream->loop ? (uint64)-1 : voice.stream->lengthSamples;
+	}
+	return voice.buffer->bufferSizeSamples;
+}
+
+// Returns true if voice a should be stolen before voice b
+internal bool IsBetterVictim(const AudioVoice& a, const AudioVoice& b)
+{
+	if (a.priority != b.priority) {
+		return a.priority < b.priority;
+	}
+	// Culled voices first, since they aren't being heard
+	float32 gainA = a.gain * a.attenuation;
+	float32 gainB = b.gain * b.attenuation;
+	if (gainA != gainB) {
+		return gainA < gainB;
+	}
+	uint64 remainingA = GetVoiceLength(a) - a.sampleIndex;
+	uint64 remainingB = GetVoiceLength(b) - b.sampleIndex;
+	return remainingA < remainingB;
+}
+
+void InitAudioMixer(AudioMixer* mixer)
+{
+	mixer->numVoices = 0;
+
+	// Pitching up is downsampling, so each filter cuts off low enough for its max pitch not to alias
+	for (int i = 0; i < AUDIO_PITCH_FILTERS; i++) {
+		InitResampleFilter(&mixer->pitchFilters[i], 1.0f / PITCH_FILTER_MAX[i]);
+	}
+}
+
+internal AudioVoice* AllocateVoice(AudioMixer* mixer, uint32 id, AudioBusId bus, int priority)
+{
+	DEBUG_ASSERT(id != AUDIO_VOICE_NONE);
+	DEBUG_ASSERT(bus < AudioBusId::MASTER);
+
+	int index;
+	if (mixer->numVoices < AUDIO_VOICES_MAX) {
+		index = mixer->numVoices++;
+	}
+	else {
+		index = 0;
+		for (int i = 1; i < mixer->numVoices; i++) {
+			if (IsBetterVictim(mixer->voices[i], mixer->voices[index])) {
+				index = i;
+			}
+		}
+		if (mixer->voices[index].priority > priority) {
+			return nullptr;
+		}
+		ReleaseVoiceStream(&mixer->voices[index]);
+	}
+
+	AudioVoice* voice = &mixer->voices[index];
+	voice->id = id;
+	voice->sampleIndex = 0;
+	voice->sampleFraction = 0.0f;
+	voice->pitch = 1.0f;
+	voice->attenuation = 1.0f;
+	voice->bus = bus;
+	voice->priority = priority;
+	voice->started = false;
+	voice->positional = false;
+	return voice;
+}
+
+bool PlayVoice(AudioMixer* mixer, uint32 id, const AudioBuffer* buffer, AudioBusId bus,
+	float32 gain, float32 pan, int priority)
+{
+	DEBUG_ASSERT(buffer->channels == 2); // Stereo support only
+
+	AudioVoice* voice = AllocateVoice(mixer, id, bus, priority);
+	if (voice == nullptr) {
+		return false;
+	}
+
+	voice->buffer = buffer;
+	voice->stream = nullptr;
+	SetVoiceGains(voice, gain, pan);
+	return true;
+}
+
+bool PlayStreamVoice(AudioMixer* mixer, uint32 id, AudioStream* stream, AudioBusId bus,
+	float32 gain, float32 pan, int priority)
+{
+	AudioVoice* voice = AllocateVoice(mixer, id, bus, priority);
+	if (voice == nullptr) {
+		return false;
+	}
+
+	voice->buffer = nullptr;
+	voice->stream = stream;
+	SetVoiceGains(voice, gain, pan);
+	return true;
+}
+
+bool SetVoiceGainPan(AudioMixer* mixer, uint32 id, float32 gain, float32 pan)
+{
+	int index = FindVoice(mixer, id);
+	if (index == -1) {
+		return false;
+	}
+
+	SetVoiceGains(&mixer->voices[index], gain, pan);
+	return true;
+}
+
+bool SetVoicePosition(AudioMixer* mixer, uint32 id, Vec2 coords, float32 radius)
+{
+	int index = FindVoice(mixer, id);
+	if (index == -1) {
+		return false;
+	}
+
+	AudioVoice* voice = &mixer->voices[index];
+	if (!voice->positional) {
+		voice->positional = true;
+		SetVoiceAttenuationPan(voice, 0.0f, voice->pan);
+	}
+	voice->coords = coords;
+	voice->radius = radius;
+	return true;
+}
+
+void SetVoiceAttenuationPan(AudioVoice* voice, float32 attenuation, float32 pan)
+{
+	voice->attenuation = attenuation;
+	SetVoiceGains(voice, voice->gain, pan);
+}
+
+bool SetVoicePitch(AudioMixer* mixer, uint32 id, float32 pitch)
+{
+	int index = FindVoice(mixer, id);
+	if (index == -1 || mixer->voices[index].stream != nullptr) {
+		return false;
+	}
+
+	mixer->voices[index].pitch = ClampFloat32(pitch, AUDIO_PITCH_MIN, AUDIO_PITCH_MAX);
+	return true;
+}
+
+void StopVoice(AudioMixer* mixer, uint32 id)
+{
+	int index = FindVoice(mixer, id);
+	if (index != -1) {
+		RemoveVoice(mixer, index);
+	}
+}
+
+void AdvanceVoices(AudioMixer* mixer, uint64 samples)
+{
+	int i = 0;
+	while (i < mixer->numVoices) {
+		AudioVoice* voice = &mixer->voices[i];
+		if (voice->started) {
+			float64 advance = voice->sampleFraction + samples * (float64)voice->pitch;
+			uint64 advanceSamples = (uint64)advance;
+			voice->sampleIndex += advanceSamples;
+			voice->sampleFraction = (float32)(advance - advanceSamples);
+		}
+		voice->started = true;
+
+		if (voice->sampleIndex >= GetVoiceLength(*voice)) {
+			RemoveVoice(mixer, i);
+		}
+		else {
+			if (voice->stream != nullptr) {
+				voice->stream->playIndex.store(voice->sampleIndex, std::memory_order_release);
+			}
+			i++;
+		}
+	}
+}
+
+internal void MixSamples(const float32* src, uint64 samples, float32 gainLeft, float32 gainRight,
+	float32* buffer)
+{
+	// 4 stereo samples per iteration, as 2 left-right pairs per register
+	const __m128 gains = _mm_setr_ps(gainLeft, gainRight, gainLeft, gainRight);
+	uint64 i = 0;
+	for (; i + 4 <= samples; i += 4) {
+		__m128 src1 = _mm_loadu_ps(src + i * 2);
+		__m128 src2 = _mm_loadu_ps(src + i * 2 + 4);
+		__m128 dst1 = _mm_loadu_ps(buffer + i * 2);
+		__m128 dst2 = _mm_loadu_ps(buffer + i * 2 + 4);
+		_mm_storeu_ps(buffer + i * 2, _mm_add_ps(dst1, _mm_mul_ps(src1, gains)));
+		_mm_storeu_ps(buffer + i * 2 + 4, _mm_add_ps(dst2, _mm_mul_ps(src2, gains)));
+	}
+	for (; i < samples; i++) {
+		buffer[i * 2] += src[i * 2] * gainLeft;
+		buffer[i * 2 + 1] += src[i * 2 + 1] * gainRight;
+	}
+}
+
+// Longest piece of a clip mixed at once. ADPCM clips are decoded a piece at a time into a stack buffer.
+#define MIX_PIECE_SAMPLES 1024
+#define MIX_SCRATCH_SAMPLES (MIX_PIECE_SAMPLES + RESAMPLE_TAPS + AUDIO_ADPCM_BLOCK_SAMPLES * 2)
+
+static_assert(MIX_PIECE_SAMPLES % 4 == 0, "mix pieces are processed 4 stereo samples at a time");
+
+// Returns clip samples [start, start + count), either in place or decoded into scratch
+internal const float32* GetClipSamples(const AudioBuffer* clip, uint64 start, uint64 count, float32* scratch)
+{
+	DEBUG_ASSERT(start + count <= clip->bufferSizeSamples);
+
+	switch (clip->format) {
+		case AudioFormat::FLOAT32: {
+			return clip->buffer + start * AUDIO_MAX_CHANNELS;
+		} break;
+		case AudioFormat::ADPCM: {
+			uint64 firstBlock = start / AUDIO_ADPCM_BLOCK_SAMPLES;
+			uint64 endBlock = GetAdpcmBlockCount(start + count);
+			DEBUG_ASSERT((endBlock - firstBlock) * AUDIO_ADPCM_BLOCK_SAMPLES <= MIX_SCRATCH_SAMPLES);
+			DecodeAdpcm(clip->adpcmBlocks + firstBlock, endBlock - firstBlock, scratch);
+			return scratch + (start - firstBlock * AUDIO_ADPCM_BLOCK_SAMPLES) * AUDIO_MAX_CHANNELS;
+		} break;
+		default: {
+			DEBUG_PANIC("Unhandled audio format %d\n", clip->format);
+			return nullptr;
+		} break;
+	}
+}
+
+internal void MixClipVoice(const AudioMixer* mixer, const AudioVoice& voice, float32* buffer, uint64 fillLength)
+{
+	const AudioBuffer* clip = voice.buffer;
+	float32 scratch[MIX_SCRATCH_SAMPLES * AUDIO_MAX_CHANNELS];
+
+	if (voice.pitch == 1.0f && voice.sampleFraction == 0.0f) {
+		uint64 samples = MinUInt64(fillLength, clip->bufferSizeSamples - voice.sampleIndex);
+		for (uint64 i = 0; i < samples; i += MIX_PIECE_SAMPLES) {
+			uint64 pieceSamples = MinUInt64(samples - i, MIX_PIECE_SAMPLES);
+			const float32* src = GetClipSamples(clip, voice.sampleIndex + i, pieceSamples, scratch);
+			MixSamples(src, pieceSamples, voice.gainLeft, voice.gainRight, buffer + i * AUDIO_MAX_CHANNELS);
+		}
+		return;
+	}
+
+	int filter = 0;
+	while (voice.pitch > PITCH_FILTER_MAX[filter]) {
+		filter++;
+	}
+	float64 pos = voice.sampleIndex + (float64)voice.sampleFraction;
+	uint64 samples = MinUInt64(fillLength, (uint64)ceil((clip->bufferSizeSamples - pos) / voice.pitch));
+
+	// Each piece of output reads the source samples its filter taps cover, clamped to the clip
+	const uint64 piecePitched = MIX_PIECE_SAMPLES / 4;
+	for (uint64 i = 0; i < samples; i += piecePitched) {
+		uint64 pieceSamples = MinUInt64(samples - i, piecePitched);
+		float64 piecePos = pos + i * (float64)voice.pitch;
+		float64 pieceLast = piecePos + (pieceSamples - 1) * (float64)voice.pitch;
+		int64 srcStart = (int64)floor(piecePos) - RESAMPLE_TAPS / 2 + 1;
+		int64 srcEnd = (int64)floor(pieceLast) + RESAMPLE_TAPS / 2 + 1;
+		srcStart = srcStart < 0 ? 0 : srcStart;
+		srcEnd = srcEnd > (int64)clip->bufferSizeSamples ? (int64)clip->bufferSizeSamples : srcEnd;
+		if (srcStart >= srcEnd) {
+			continue;
+		}
+
+		const float32* src = GetClipSamples(clip, srcStart, srcEnd - srcStart, scratch);
+		ResampleStereo(&mixer->pitchFilters[filter], src, srcEnd - srcStart, piecePos - srcStart, voice.pitch,
+			voice.gainLeft, voice.gainRight, buffer + i * AUDIO_MAX_CHANNELS, pieceSamples);
+	}
+}
+
+internal void MixVoice(const AudioMixer* mixer, const AudioVoice& voice, float32* buffer, uint64 fillLength)
+{
+	DEBUG_ASSERT(voice.sampleIndex < GetVoiceLength(voice));
+
+	if (voice.stream == nullptr) {
+		MixClipVoice(mixer, voice, buffer, fillLength);
+		return;
+	}
+
+	// Only what's been read ahead, in at most 2 pieces split where the ring wraps around
+	const AudioStream* stream = voice.stream;
+	DEBUG_ASSERT(voice.pitch == 1.0f && voice.sampleFraction == 0.0f);
+	uint64 samples = MinUInt64(fillLength, GetVoiceLength(voice) - voice.sampleIndex);
+	const uint64 ringEnd = stream->ringEnd.load(std::memory_order_acquire);
+	samples = ringEnd > voice.sampleIndex ? MinUInt64(samples, ringEnd - voice.sampleIndex) : 0;
+	uint64 ringIndex = voice.sampleIndex % AUDIO_STREAM_RING_SAMPLES;
+	uint64 samples1 = MinUInt64(samples, AUDIO_STREAM_RING_SAMPLES - ringIndex);
+	MixSamples(stream->ring + ringIndex * AUDIO_MAX_CHANNELS, samples1, voice.gainLeft, voice.gainRight, buffer);
+	MixSamples(stream->ring, samples - samples1, voice.gainLeft, voice.gainRight,
+		buffer + samples1 * AUDIO_MAX_CHANNELS);
+}
+
+void ClearAudioBuffer(float32* buffer, uint64 fillLength)
+{
+	const __m128 zero = _mm_setzero_ps();
+	uint64 i = 0;
+	for (; i + 2 <= fillLength; i += 2) {
+		_mm_storeu_ps(buffer + i * 2, zero);
+	}
+	for (; i < fillLength; i++) {
+		buffer[i * 2] = 0.0f;
+		buffer[i * 2 + 1] = 0.0f;
+	}
+}
+
+void MixVoices(const AudioMixer* mixer, AudioBusId bus, float32* buffer, uint64 fillLength)
+{
+	ClearAudioBuffer(buffer, fillLength);
+
+	// The output chunk is a few KB, so it stays in cache while every voice is accumulated into it
+	for (int v = 0; v < mixer->numVoices; v++) {
+		if (mixer->voices[v].bus == bus && mixer->voices[v].attenuation > 0.0f) {
+			MixVoice(mixer, mixer->voices[v], buffer, fillLength);
+		}
+	}
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <km_common/km_defines.h>
+#include <km_common/km_math.h>
+
+#include "asset_audio.h"
+#include "audio_bus.h"
+#include "audio_resample.h"
+
+#define AUDIO_VOICES_MAX 64
+#define AUDIO_VOICE_NONE 0
+// Pitched voices are resampled with the first filter whose max pitch is at least the voice's pitch
+#define AUDIO_PITCH_FILTERS 4
+#define AUDIO_PITCH_MIN 0.25f
+#define AUDIO_PITCH_MAX 4.0f
+
+// One playing instance of a clip or stream. Ids are picked by the caller and should never be reused, so a stale
+// id (from a voice that finished or was stolen) doesn't affect the sound that replaced it.
+struct AudioVoice
+{
+	const AudioBuffer* buffer; // exactly one of buffer and stream is set
+	AudioStream* stream;
+	uint64 sampleIndex;
+	float32 sampleFraction; // position between sampleIndex and the next sample, for pitched voices
+	float32 pitch; // playback rate, 1 is unchanged
+	float32 gain;
+	float32 pan; // -1 is full left, 1 is full right
+	float32 attenuation; // from distance, 0 culls the voice: it keeps its place in the clip but isn't mixed
+	float32 gainLeft;
+	float32 gainRight;
+	AudioBusId bus;
+	int priority;
+	uint32 id;
+	bool started; // set on the first AdvanceVoices, so a new voice isn't advanced before it's heard
+
+	// Positional voices are placed in floor coordinates, and their owner sets the attenuation and pan from them
+	bool positional;
+	Vec2 coords;
+	float32 radius; // audible distance
+};
+
+// Voices 0 to numVoices - 1 are playing. Finished voices are swapped out from the end.
+struct AudioMixer
+{
+	AudioVoice voices[AUDIO_VOICES_MAX];
+	int numVoices;
+
+	ResampleFilter pitchFilters[AUDIO_PITCH_FILTERS];
+};
+
+void InitAudioMixer(AudioMixer* mixer);
+// When all voices are busy, steals the lowest priority one (then the quietest, then the one closest to
+// finishing). Returns false if every playing voice has a higher priority than the new one.
+bool PlayVoice(AudioMixer* mixer, uint32 id, const AudioBuffer* buffer, AudioBusId bus,
+	float32 gain, float32 pan, int priority);
+// Plays the stream from its start, so its owner must have rewound it. A stream should only be played by one
+// voice at a time, and its playing flag is cleared once the voice is stopped, finished or stolen.
+bool PlayStreamVoice(AudioMixer* mixer, uint32 id, AudioStream* stream, AudioBusId bus,
+	float32 gain, float32 pan, int priority);
+// Returns false if the voice isn't playing anymore
+bool SetVoiceGainPan(AudioMixer* mixer, uint32 id, float32 gain, float32 pan);
+// Makes the voice positional. It stays silent (culled) until its attenuation is set.
+bool SetVoicePosition(AudioMixer* mixer, uint32 id, Vec2 coords, float32 radius);
+// Sets a voice's distance attenuation and replaces its pan, keeping its gain
+void SetVoiceAttenuationPan(AudioVoice* voice, float32 attenuation, float32 pan);
+// Clamped to [AUDIO_PITCH_MIN, AUDIO_PITCH_MAX]. Streams always play at pitch 1, so this returns false for them.
+bool SetVoicePitch(AudioMixer* mixer, uint32 id, float32 pitch);
+void StopVoice(AudioMixer* mixer, uint32 id);
+// Moves voices forward by the number of samples the platform played since the last call,
+// and publishes the positions of streams for their owners to read ahead from
+void AdvanceVoices(AudioMixer* mixer, uint64 samples);
+// Zeroes fillLength interleaved stereo samples
+void ClearAudioBuffer(float32* buffer, uint64 fillLength);
+// Overwrites buffer (interleaved stereo) with the next fillLength samples of every voice on the bus,
+// skipping culled voices
+void MixVoices(const AudioMixer* mixer, AudioBusId bus, float32* buffer, uint64 fillLength);
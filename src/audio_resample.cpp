@@ -0,0 +1,83 @@
+#include "audio_resample.h"
+
+#include <emmintrin.h>
+#include <km_common/km_debug.h>
+#include <km_common/km_math.h>
+#include <math.h>
+
+static_assert(RESAMPLE_TAPS % 2 == 0, "resample taps are processed 2 stereo samples at a time");
+
+// Blackman window over [-1, 1]
+internal float64 ResampleWindow(float64 x)
+{
+	return 0.42 + 0.5 * cos(PI_F * x) + 0.08 * cos(2.0 * PI_F * x);
+}
+
+void InitResampleFilter(ResampleFilter* filter, float32 cutoff)
+{
+	DEBUG_ASSERT(cutoff > 0.0f && cutoff <= 1.0f);
+
+	const float64 halfWidth = RESAMPLE_TAPS / 2;
+	for (int p = 0; p <= RESAMPLE_PHASES; p++) {
+		// Tap k is source sample floor(pos) - RESAMPLE_TAPS / 2 + 1 + k
+		float64 frac = (float64)p / RESAMPLE_PHASES;
+		float64 taps[RESAMPLE_TAPS];
+		float64 sum = 0.0;
+		for (int k = 0; k < RESAMPLE_TAPS; k++) {
+			float64 d = (float64)(k - RESAMPLE_TAPS / 2 + 1) - frac;
+			float64 x = PI_F * cutoff * d;
+			float64 sinc = x == 0.0 ? 1.0 : sin(x) / x;
+			float64 window = fabs(d) < halfWidth ? ResampleWindow(d / halfWidth) : 0.0;
+			taps[k] = sinc * window;
+			sum += taps[k];
+		}
+
+		// Normalized per phase for unity gain at DC
+		for (int k = 0; k < RESAMPLE_TAPS; k++) {
+			float32 tap = (float32)(taps[k] / sum);
+			filter->coeffs[p][k * 2] = tap;
+			filter->coeffs[p][k * 2 + 1] = tap;
+		}
+	}
+}
+
+void ResampleStereo(const ResampleFilter* filter, const float32* src, uint64 srcSamples,
+	float64 srcPos, float64 step, float32 gainLeft, float32 gainRight, float32* dst, uint64 dstSamples)
+{
+	DEBUG_ASSERT(step > 0.0);
+
+	const __m128 gains = _mm_setr_ps(gainLeft, gainRight, 0.0f, 0.0f);
+	for (uint64 i = 0; i < dstSamples; i++) {
+		float64 pos = srcPos + i * step;
+		float64 posFloor = floor(pos);
+		int phase = (int)((pos - posFloor) * RESAMPLE_PHASES + 0.5);
+		const float32* coeffs = filter->coeffs[phase];
+		int64 first = (int64)posFloor - RESAMPLE_TAPS / 2 + 1;
+
+		// Both channels at once: each register holds 2 stereo samples (L R L R) and their taps
+		__m128 acc = _mm_setzero_ps();
+		if (first >= 0 && first + RESAMPLE_TAPS <= (int64)srcSamples) {
+			const float32* s = src + first * 2;
+			for (int k = 0; k < RESAMPLE_TAPS; k += 2) {
+				acc = _mm_add_ps(acc, _mm_mul_ps(_mm_loadu_ps(s + k * 2), _mm_loadu_ps(coeffs + k * 2)));
+			}
+		}
+		else {
+			if (first >= (int64)srcSamples || first + RESAMPLE_TAPS <= 0) {
+				continue;
+			}
+			int kStart = first < 0 ? (int)-first : 0;
+			int kEnd = (int64)srcSamples - first < RESAMPLE_TAPS ? (int)((int64)srcSamples - first) : RESAMPLE_TAPS;
+			for (int k = kStart; k < kEnd; k++) {
+				__m128 sample = _mm_loadl_pi(_mm_setzero_ps(), (const __m64*)(src + (first + k) * 2));
+				acc = _mm_add_ps(acc, _mm_mul_ps(sample, _mm_loadu_ps(coeffs + k * 2)));
+			}
+		}
+
+		// Even and odd taps are in the low and high halves
+		acc = _mm_add_ps(acc, _mm_movehl_ps(acc, acc));
+		__m128 out = _mm_loadl_pi(_mm_setzero_ps(), (const __m64*)(dst + i * 2));
+		out = _mm_add_ps(out, _mm_mul_ps(acc, gains));
+		_mm_storel_pi((__m64*)(dst + i * 2), out);
+	}
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <km_common/km_defines.h>
+
+#define RESAMPLE_TAPS 16
+#define RESAMPLE_PHASES 128
+
+// Windowed-sinc filter bank for polyphase resampling. Each source position uses the row for its
+// fractional part (rounded to the nearest phase) and the RESAMPLE_TAPS samples around it.
+struct ResampleFilter
+{
+	// Row p is for a fractional position of p / RESAMPLE_PHASES, each tap repeated for the left and right channels
+	float32 coeffs[RESAMPLE_PHASES + 1][RESAMPLE_TAPS * 2];
+};
+
+// cutoff is relative to the source's Nyquist frequency. Use 1 when upsampling and
+// output rate / source rate when downsampling, so the result doesn't alias.
+void InitResampleFilter(ResampleFilter* filter, float32 cutoff);
+// Adds dstSamples interleaved stereo samples to dst, read from src at srcPos, srcPos + step, srcPos + 2 * step, ...
+// and scaled by the channel gains. Source samples outside [0, srcSamples) are silence.
+void ResampleStereo(const ResampleFilter* filter, const float32* src, uint64 srcSamples,
+	float64 srcPos, float64 step, float32 gainLeft, float32 gainRight, float32* dst, uint64 dstSamples);
@@ -1,8 +1,15 @@
 #include "collision.h"
 
+#include <emmintrin.h>
+
 #include <km_common/km_debug.h>
 
-#define FLOOR_PRECOMPUTED_STEP_LENGTH 0.05f
+#define FLOOR_EDGE_NEIGHBORS 10
+
+#define LINE_COLLIDER_SWEEP_SUBSTEP_LENGTH 0.25f
+#define LINE_COLLIDER_SWEEP_SUBSTEPS_MAX 16
+
+#define LINE_COLLIDER_HEIGHT_SAMPLE_PADDING 4
 
 internal Vec2 GetQuadraticBezierPoint(Vec2 v1, Vec2 v2, Vec2 v3, float32 t)
 {
@@ -29,6 +36,70 @@ void FloorCollider::GetInfoFromCoordX(float32 coordX, Vec2* outPos, Vec2* outNor
 	*outNormal = Normalize(Lerp(sampleVertex1.normal, sampleVertex2.normal, lerpT));
 }
 
+void FloorCollider::GetInfoFromCoordXBatch(const float32* coordX, uint64 n, Vec2* outPos, Vec2* outNormal) const
+{
+    DEBUG_ASSERT(sampleVertices.size > 0);
+
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 lengthV = _mm_set1_ps(length);
+    const __m128 stepV = _mm_set1_ps(FLOOR_PRECOMPUTED_STEP_LENGTH);
+    const __m128 indMax = _mm_set1_ps((float32)(sampleVertices.size - 1));
+
+    uint64 i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128 x = _mm_loadu_ps(coordX + i);
+        x = _mm_add_ps(x, _mm_and_ps(_mm_cmplt_ps(x, zero), lengthV));
+        x = _mm_sub_ps(x, _mm_and_ps(_mm_cmpgt_ps(x, lengthV), lengthV));
+
+        const __m128 indFloat = _mm_div_ps(x, stepV);
+        const __m128 ind1Float = _mm_cvtepi32_ps(_mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(indFloat, zero), indMax)));
+        const __m128 ind2Float = _mm_min_ps(_mm_add_ps(ind1Float, one), indMax);
+        const __m128 t = _mm_sub_ps(indFloat, ind1Float);
+
+        alignas(16) int32 ind1[4];
+        alignas(16) int32 ind2[4];
+        _mm_store_si128((__m128i*)ind1, _mm_cvttps_epi32(ind1Float));
+        _mm_store_si128((__m128i*)ind2, _mm_cvttps_epi32(ind2Float));
+
+        const FloorSampleVertex& a0 = sampleVertices[ind1[0]];
+        const FloorSampleVertex& a1 = sampleVertices[ind1[1]];
+        const FloorSampleVertex& a2 = sampleVertices[ind1[2]];
+        const FloorSampleVertex& a3 = sampleVertices[ind1[3]];
+        const FloorSampleVertex& b0 = sampleVertices[ind2[0]];
+        const FloorSampleVertex& b1 = sampleVertices[ind2[1]];
+        const FloorSampleVertex& b2 = sampleVertices[ind2[2]];
+        const FloorSampleVertex& b3 = sampleVertices[ind2[3]];
+
+        const __m128 posX1 = _mm_setr_ps(a0.pos.x, a1.pos.x, a2.pos.x, a3.pos.x);
+        const __m128 posY1 = _mm_setr_ps(a0.pos.y, a1.pos.y, a2.pos.y, a3.pos.y);
+        const __m128 normalX1 = _mm_setr_ps(a0.normal.x, a1.normal.x, a2.normal.x, a3.normal.x);
+        const __m128 normalY1 = _mm_setr_ps(a0.normal.y, a1.normal.y, a2.normal.y, a3.normal.y);
+        const __m128 posX2 = _mm_setr_ps(b0.pos.x, b1.pos.x, b2.pos.x, b3.pos.x);
+        const __m128 posY2 = _mm_setr_ps(b0.pos.y, b1.pos.y, b2.pos.y, b3.pos.y);
+        const __m128 normalX2 = _mm_setr_ps(b0.normal.x, b1.normal.x, b2.normal.x, b3.normal.x);
+        const __m128 normalY2 = _mm_setr_ps(b0.normal.y, b1.normal.y, b2.normal.y, b3.normal.y);
+
+        const __m128 posX = _mm_add_ps(posX1, _mm_mul_ps(_mm_sub_ps(posX2, posX1), t));
+        const __m128 posY = _mm_add_ps(posY1, _mm_mul_ps(_mm_sub_ps(posY2, posY1), t));
+        const __m128 normalX = _mm_add_ps(normalX1, _mm_mul_ps(_mm_sub_ps(normalX2, normalX1), t));
+        const __m128 normalY = _mm_add_ps(normalY1, _mm_mul_ps(_mm_sub_ps(normalY2, normalY1), t));
+        const __m128 normalMag = _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(normalX, normalX), _mm_mul_ps(normalY, normalY)));
+        const __m128 normalXUnit = _mm_div_ps(normalX, normalMag);
+        const __m128 normalYUnit = _mm_div_ps(normalY, normalMag);
+
+        // Interleave back into Vec2s
+        _mm_storeu_ps(&outPos[i].x, _mm_unpacklo_ps(posX, posY));
+        _mm_storeu_ps(&outPos[i + 2].x, _mm_unpackhi_ps(posX, posY));
+        _mm_storeu_ps(&outNormal[i].x, _mm_unpacklo_ps(normalXUnit, normalYUnit));
+        _mm_storeu_ps(&outNormal[i + 2].x, _mm_unpackhi_ps(normalXUnit, normalYUnit));
+    }
+
+    for (; i < n; i++) {
+        GetInfoFromCoordX(coordX[i], &outPos[i], &outNormal[i]);
+    }
+}
+
 Vec2 FloorCollider::GetWorldPosFromCoords(Vec2 coords) const
 {
 	Vec2 floorPos, floorNormal;
@@ -61,8 +132,6 @@ Vec2 FloorCollider::GetCoordsFromWorldPos(Vec2 worldPos) const
 
 void FloorCollider::GetInfoFromCoordXSlow(float32 coordX, Vec2* outFloorPos, Vec2* outNormal) const
 {
-    const int EDGE_NEIGHBORS = 10;
-    
     *outFloorPos = Vec2::zero;
     *outNormal = Vec2::unitY;
     
@@ -75,43 +144,7 @@ void FloorCollider::GetInfoFromCoordXSlow(float32 coordX, Vec2* outFloorPos, Vec
         float32 edgeLength = Mag(edge);
         if (t + edgeLength >= coordX) {
             float32 tEdge = (coordX - t) / edgeLength;
-            Vec2 sumNormals = Vec2::zero;
-            for (int n = -EDGE_NEIGHBORS; n <= EDGE_NEIGHBORS; n++) {
-                float32 edgeWeight = (float32)EDGE_NEIGHBORS
-                    - AbsFloat32((float32)n - (tEdge - 0.5f)) + 0.5f;
-                edgeWeight = MaxFloat32(edgeWeight, 0.0f);
-                int edgeVertInd1 = (int)i + n - 1;
-                if (edgeVertInd1 < 0) {
-                    edgeVertInd1 += (int)line.size;
-                }
-                else if (edgeVertInd1 >= line.size) {
-                    edgeVertInd1 -= (int)line.size;
-                }
-                int edgeVertInd2 = (int)i + n;
-                if (edgeVertInd2 < 0) {
-                    edgeVertInd2 += (int)line.size;
-                }
-                else if (edgeVertInd2 >= line.size) {
-                    edgeVertInd2 -= (int)line.size;
-                }
-                Vec2 neighborEdge = line[edgeVertInd2] - line[edgeVertInd1];
-                Vec2 neighborNormal = Normalize(Vec2 { -neighborEdge.y, neighborEdge.x });
-                sumNormals += neighborNormal * edgeWeight;
-                //}
-            }
-            uint64 iPrevPrev = i - 2;
-            if (i == 1) {
-                iPrevPrev = line.size - 1;
-            }
-            iPrevPrev %= line.size;
-            uint64 iNext = (i + 1) % line.size;
-            Vec2 tangentPrev = Normalize(line[iPrev] - line[iPrevPrev]);
-            Vec2 tangentNext = Normalize(line[iNext] - line[iWrap]);
-            Vec2 bezierMid = (line[iPrev] + tangentPrev * edgeLength / 2.0f
-                              + line[iWrap] - tangentNext * edgeLength / 2.0f) / 2.0f;
-            *outFloorPos = GetQuadraticBezierPoint(line[iPrev], bezierMid, line[iWrap],
-                                                   tEdge);
-            *outNormal = Normalize(sumNormals);
+            GetInfoFromEdge(i, tEdge, outFloorPos, outNormal);
             return;
         }
         
@@ -120,22 +153,181 @@ void FloorCollider::GetInfoFromCoordXSlow(float32 coordX, Vec2* outFloorPos, Vec
     }
 }
 
+// Edge i goes from line[i - 1] to line[i], with vertex indices wrapped around the loop
+void FloorCollider::GetInfoFromEdge(uint64 edge, float32 tEdge, Vec2* outFloorPos, Vec2* outNormal) const
+{
+    const int lineSize = (int)line.size;
+    const uint64 i = edge % line.size;
+    
+    Vec2 sumNormals = Vec2::zero;
+    for (int n = -FLOOR_EDGE_NEIGHBORS; n <= FLOOR_EDGE_NEIGHBORS; n++) {
+        float32 edgeWeight = (float32)FLOOR_EDGE_NEIGHBORS
+            - AbsFloat32((float32)n - (tEdge - 0.5f)) + 0.5f;
+        edgeWeight = MaxFloat32(edgeWeight, 0.0f);
+        int edgeVertInd1 = ((int)i + n - 1) % lineSize;
+        if (edgeVertInd1 < 0) {
+            edgeVertInd1 += lineSize;
+        }
+        int edgeVertInd2 = ((int)i + n) % lineSize;
+        if (edgeVertInd2 < 0) {
+            edgeVertInd2 += lineSize;
+        }
+        Vec2 neighborEdge = line[edgeVertInd2] - line[edgeVertInd1];
+        Vec2 neighborNormal = Normalize(Vec2 { -neighborEdge.y, neighborEdge.x });
+        sumNormals += neighborNormal * edgeWeight;
+    }
+    
+    uint64 iPrev = (i + line.size - 1) % line.size;
+    uint64 iPrevPrev = (i + line.size - 2) % line.size;
+    uint64 iNext = (i + 1) % line.size;
+    float32 edgeLength = Mag(line[i] - line[iPrev]);
+    Vec2 tangentPrev = Normalize(line[iPrev] - line[iPrevPrev]);
+    Vec2 tangentNext = Normalize(line[iNext] - line[i]);
+    Vec2 bezierMid = (line[iPrev] + tangentPrev * edgeLength / 2.0f
+                      + line[i] - tangentNext * edgeLength / 2.0f) / 2.0f;
+    *outFloorPos = GetQuadraticBezierPoint(line[iPrev], bezierMid, line[i], tEdge);
+    *outNormal = Normalize(sumNormals);
+}
+
+// Returns the first edge (1 to line.size) whose end is at or past coordX, same as GetInfoFromCoordXSlow
+internal uint64 GetEdgeFromCoordX(const FixedArray<float32, FLOOR_COLLIDER_MAX_VERTICES + 1>& vertexCoordX,
+                                  float32 coordX)
+{
+    uint64 low = 1;
+    uint64 high = vertexCoordX.size - 1;
+    while (low < high) {
+        uint64 mid = (low + high) / 2;
+        if (vertexCoordX[mid] >= coordX) {
+            high = mid;
+        }
+        else {
+            low = mid + 1;
+        }
+    }
+    return low;
+}
+
+void FloorCollider::PrecomputeSampleVertexRange(uint64 sampleStart, uint64 sampleEnd)
+{
+    if (sampleStart >= sampleEnd) {
+        return;
+    }
+    
+    const uint64 lastEdge = vertexCoordX.size - 1;
+    uint64 edge = GetEdgeFromCoordX(vertexCoordX, sampleStart * FLOOR_PRECOMPUTED_STEP_LENGTH);
+    for (uint64 i = sampleStart; i < sampleEnd; i++) {
+        float32 coordX = i * FLOOR_PRECOMPUTED_STEP_LENGTH;
+        while (edge < lastEdge && vertexCoordX[edge] < coordX) {
+            edge++;
+        }
+        float32 edgeStart = vertexCoordX[edge - 1];
+        float32 tEdge = (coordX - edgeStart) / (vertexCoordX[edge] - edgeStart);
+        GetInfoFromEdge(edge, tEdge, &sampleVertices[i].pos, &sampleVertices[i].normal);
+    }
+}
+
 void FloorCollider::PrecomputeSampleVerticesFromLine()
 {
-	float32 lineLength = 0.0f;
-	for (uint64 i = 1; i < line.size; i++) {
-		lineLength += Mag(line[i] - line[i - 1]);
+    vertexCoordX.size = line.size + 1;
+    vertexCoordX[0] = 0.0f;
+	for (uint64 i = 1; i <= line.size; i++) {
+		vertexCoordX[i] = vertexCoordX[i - 1] + Mag(line[i % line.size] - line[i - 1]);
 	}
-    lineLength += Mag(line[0] - line[line.size - 1]);
-	length = lineLength;
+	length = vertexCoordX[line.size];
     
-	uint64 precomputedPoints = (uint64)(lineLength / FLOOR_PRECOMPUTED_STEP_LENGTH) + 1;
+	uint64 precomputedPoints = (uint64)(length / FLOOR_PRECOMPUTED_STEP_LENGTH) + 1;
 	DEBUG_ASSERT(precomputedPoints <= FLOOR_PRECOMPUTED_POINTS_MAX);
 	sampleVertices.size = precomputedPoints;
-	for (uint64 i = 0; i < precomputedPoints; i++) {
-		float32 coordX = i * FLOOR_PRECOMPUTED_STEP_LENGTH;
-		GetInfoFromCoordXSlow(coordX, &sampleVertices[i].pos, &sampleVertices[i].normal);
-	}
+    PrecomputeSampleVertexRange(0, precomputedPoints);
+}
+
+void FloorCollider::PrecomputeSampleVerticesFromVertexMove(uint64 vertex)
+{
+    DEBUG_ASSERT(vertex < line.size);
+    
+    // Samples on edge i read edge normals from i - FLOOR_EDGE_NEIGHBORS to i + FLOOR_EDGE_NEIGHBORS and tangents
+    // from the adjacent edges. The moved vertex ends edge "vertex" and starts edge "vertex + 1".
+    const int n = (int)line.size;
+    const int dirtyEdgeFirst = (int)vertex - FLOOR_EDGE_NEIGHBORS - 1;
+    const int dirtyEdgeLast = (int)vertex + 1 + FLOOR_EDGE_NEIGHBORS + 1;
+    if (dirtyEdgeLast - dirtyEdgeFirst + 1 >= n || vertexCoordX.size != line.size + 1) {
+        PrecomputeSampleVerticesFromLine();
+        return;
+    }
+    
+    // Edges outside the dirty range keep their shape. Edges before the range (if it doesn't wrap) keep their
+    // arc length offsets too, while the edges in cleanEdgeFirst..cleanEdgeLast are shifted by a constant amount.
+    uint64 staticEdgeLast = 0;
+    uint64 cleanEdgeFirst, cleanEdgeLast;
+    if (dirtyEdgeFirst < 1) {
+        cleanEdgeFirst = dirtyEdgeLast + 1;
+        cleanEdgeLast = dirtyEdgeFirst + n - 1;
+    }
+    else if (dirtyEdgeLast > n) {
+        cleanEdgeFirst = dirtyEdgeLast - n + 1;
+        cleanEdgeLast = dirtyEdgeFirst - 1;
+    }
+    else {
+        staticEdgeLast = dirtyEdgeFirst - 1;
+        cleanEdgeFirst = dirtyEdgeLast + 1;
+        cleanEdgeLast = n;
+    }
+    
+    const float32 cleanStartPrev = vertexCoordX[cleanEdgeFirst - 1];
+    const uint64 edgeIn = vertex == 0 ? line.size : vertex;
+    const uint64 edgeOut = vertex + 1;
+    const float32 deltaIn = Mag(line[vertex] - line[edgeIn - 1])
+        - (vertexCoordX[edgeIn] - vertexCoordX[edgeIn - 1]);
+    const float32 deltaOut = Mag(line[edgeOut % line.size] - line[vertex])
+        - (vertexCoordX[edgeOut] - vertexCoordX[edgeOut - 1]);
+    for (uint64 i = edgeIn; i <= line.size; i++) {
+        vertexCoordX[i] += deltaIn;
+    }
+    for (uint64 i = edgeOut; i <= line.size; i++) {
+        vertexCoordX[i] += deltaOut;
+    }
+    length = vertexCoordX[line.size];
+    const float32 shift = vertexCoordX[cleanEdgeFirst - 1] - cleanStartPrev;
+    
+    const uint64 prevPoints = sampleVertices.size;
+    const uint64 precomputedPoints = (uint64)(length / FLOOR_PRECOMPUTED_STEP_LENGTH) + 1;
+	DEBUG_ASSERT(precomputedPoints <= FLOOR_PRECOMPUTED_POINTS_MAX);
+    sampleVertices.size = precomputedPoints;
+    
+    // Samples strictly inside the clean edges, resampled from their previous (shifted) location.
+    // Iterate away from the direction of the shift so that we only read samples that haven't been written yet.
+    const float32 shiftSamples = shift / FLOOR_PRECOMPUTED_STEP_LENGTH;
+    uint64 cleanSampleStart = precomputedPoints;
+    uint64 cleanSampleEnd = precomputedPoints;
+    if (cleanEdgeFirst <= cleanEdgeLast) {
+        cleanSampleStart = (uint64)(vertexCoordX[cleanEdgeFirst - 1] / FLOOR_PRECOMPUTED_STEP_LENGTH) + 1;
+        cleanSampleEnd = (uint64)ceilf(vertexCoordX[cleanEdgeLast] / FLOOR_PRECOMPUTED_STEP_LENGTH);
+        // The last sample before the end of the loop has no next sample to lerp to
+        uint64 resampleEnd = (uint64)MaxFloat32((float32)(prevPoints - 1) + shiftSamples, 0.0f);
+        cleanSampleEnd = MinUInt64(MinUInt64(cleanSampleEnd, resampleEnd), precomputedPoints);
+        cleanSampleStart = MinUInt64(cleanSampleStart, cleanSampleEnd);
+    }
+    const uint64 cleanSamplesToShift = shift == 0.0f ? 0 : cleanSampleEnd - cleanSampleStart;
+    for (uint64 k = 0; k < cleanSamplesToShift; k++) {
+        uint64 i = shift > 0.0f ? cleanSampleEnd - 1 - k : cleanSampleStart + k;
+        float32 indFloat = MaxFloat32((float32)i - shiftSamples, 0.0f);
+        uint64 ind1 = MinUInt64((uint64)indFloat, prevPoints - 1);
+        uint64 ind2 = MinUInt64(ind1 + 1, prevPoints - 1);
+        FloorSampleVertex sampleVertex1 = sampleVertices[ind1];
+        FloorSampleVertex sampleVertex2 = sampleVertices[ind2];
+        float32 lerpT = indFloat - (float32)ind1;
+        sampleVertices[i].pos = Lerp(sampleVertex1.pos, sampleVertex2.pos, lerpT);
+        sampleVertices[i].normal = Normalize(Lerp(sampleVertex1.normal, sampleVertex2.normal, lerpT));
+    }
+    
+    // Samples before the dirty range (non-wrapping case only) are untouched, re-evaluate everything else
+    uint64 staticSampleEnd = 0;
+    if (staticEdgeLast > 0) {
+        staticSampleEnd = (uint64)ceilf(vertexCoordX[staticEdgeLast] / FLOOR_PRECOMPUTED_STEP_LENGTH);
+        staticSampleEnd = MinUInt64(staticSampleEnd, cleanSampleStart);
+    }
+    PrecomputeSampleVertexRange(staticSampleEnd, cleanSampleStart);
+    PrecomputeSampleVertexRange(cleanSampleEnd, precomputedPoints);
 }
 
 internal float32 Cross2D(Vec2 v1, Vec2 v2)
@@ -171,7 +363,8 @@ bool RayIntersectionCoefficients(Vec2 line1Start, Vec2 line1Dir, Vec2 line2Start
     }
 }
 
-bool LineSegmentIntersection(Vec2 line1Start, Vec2 line1Dir, Vec2 line2Start, Vec2 line2Dir, Vec2* outIntersect)
+bool LineSegmentIntersection(Vec2 line1Start, Vec2 line1Dir, Vec2 line2Start, Vec2 line2Dir, Vec2* outIntersect,
+                             float32* outT1)
 {
     float32 t1, t2;
     bool rayIntersect = RayIntersectionCoefficients(line1Start, line1Dir, line2Start, line2Dir, &t1, &t2);
@@ -180,6 +373,7 @@ bool LineSegmentIntersection(Vec2 line1Start, Vec2 line1Dir, Vec2 line2Start, Ve
     }
     else if (0.0f <= t1 && t1 <= 1.0f && 0.0f <= t2 && t2 <= 1.0f) {
         *outIntersect = line1Start + line1Dir * t1;
+        *outT1 = t1;
         return true;
     }
     else {
@@ -199,6 +393,8 @@ void GetLineColliderIntersections(const Array<LineCollider>& lineColliders, Vec2
 	Vec2 dir = deltaPos / deltaPosMag;
 	Vec2 playerDelta = deltaPos + dir * movementMargin;
     
+	const float32 tScale = (deltaPosMag + movementMargin) / deltaPosMag;
+    
 	for (uint64 c = 0; c < lineColliders.size; c++) {
 		DEBUG_ASSERT(lineColliders[c].line.size >= 2);
 		Vec2 vertPrev = lineColliders[c].line[0];
@@ -206,11 +402,13 @@ void GetLineColliderIntersections(const Array<LineCollider>& lineColliders, Vec2
 			Vec2 vert = lineColliders[c].line[v];
 			Vec2 edge = vert - vertPrev;
 			Vec2 intersectPoint;
-			if (LineSegmentIntersection(pos, playerDelta, vertPrev, edge, &intersectPoint)) {
+			float32 t;
+			if (LineSegmentIntersection(pos, playerDelta, vertPrev, edge, &intersectPoint, &t)) {
 				Vec2 edgeDir = Normalize(edge);
                 LineColliderIntersect* intersect = outIntersects->Append();
 				intersect->pos = intersectPoint;
 				intersect->normal = Vec2 { -edgeDir.y, edgeDir.x };
+				intersect->t = t * tScale;
 				// TODO can't use [] operator directly because of it being a function probably,
 				// some lvalue/rvalue mess. Look it up?
 				intersect->collider = &lineColliders.data[c];
@@ -221,12 +419,97 @@ void GetLineColliderIntersections(const Array<LineCollider>& lineColliders, Vec2
 	}
 }
 
-bool GetLineColliderCoordYFromFloorCoordX(const LineCollider& lineCollider, const FloorCollider& floorCollider,
-                                          float32 coordX, float32* outHeight)
+// Movement in floor coordinates follows the floor curvature in world space, so a single straight sweep from
+// start to end can cut corners and skip platforms. Instead, sweep the world-space path in up to
+// LINE_COLLIDER_SWEEP_SUBSTEPS_MAX straight pieces, keeping the earliest hit for each collider.
+template <uint64 S>
+void GetLineColliderIntersectionsAlongFloor(const Array<LineCollider>& lineColliders, const FloorCollider& floor,
+                                            Vec2 coords, Vec2 deltaCoords, float32 movementMargin,
+                                            FixedArray<LineColliderIntersect, S>* outIntersects)
 {
-    Vec2 floorPos, floorNormal;
-    floorCollider.GetInfoFromCoordX(coordX, &floorPos, &floorNormal);
+	outIntersects->size = 0;
+	float32 deltaCoordsMag = Mag(deltaCoords);
+	if (deltaCoordsMag == 0.0f) {
+		return;
+	}
+    
+	int substeps = (int)ceilf(deltaCoordsMag / LINE_COLLIDER_SWEEP_SUBSTEP_LENGTH);
+	substeps = ClampInt(substeps, 1, LINE_COLLIDER_SWEEP_SUBSTEPS_MAX);
+	const float32 substepT = 1.0f / (float32)substeps;
     
+	// At most one hit per collider, and no more than the output can hold
+	const uint64 maxIntersects = MinUInt64(lineColliders.size, S);
+	Vec2 posPrev = floor.GetWorldPosFromCoords(coords);
+	for (int s = 0; s < substeps && outIntersects->size < maxIntersects; s++) {
+		Vec2 pos = floor.GetWorldPosFromCoords(coords + deltaCoords * ((float32)(s + 1) * substepT));
+		Vec2 substepDelta = pos - posPrev;
+		float32 substepDeltaMag = Mag(substepDelta);
+		float32 tScale = 1.0f;
+		if (s == substeps - 1 && substepDeltaMag > 0.0f) {
+			// Margin only extends the end of the movement
+			substepDelta += substepDelta / substepDeltaMag * movementMargin;
+			tScale = (substepDeltaMag + movementMargin) / substepDeltaMag;
+		}
+        
+		for (uint64 c = 0; c < lineColliders.size && outIntersects->size < maxIntersects; c++) {
+			const LineCollider* collider = &lineColliders.data[c];
+			bool alreadyHit = false;
+			for (uint64 i = 0; i < outIntersects->size; i++) {
+				if ((*outIntersects)[i].collider == collider) {
+					alreadyHit = true;
+					break;
+				}
+			}
+			if (alreadyHit) {
+				continue;
+			}
+            
+			DEBUG_ASSERT(collider->line.size >= 2);
+			float32 tMin = 2.0f;
+			Vec2 intersectPos, intersectEdge;
+			Vec2 vertPrev = collider->line[0];
+			for (uint64 v = 1; v < collider->line.size; v++) {
+				Vec2 vert = collider->line[v];
+				Vec2 edge = vert - vertPrev;
+				Vec2 intersectPoint;
+				float32 t;
+				if (LineSegmentIntersection(posPrev, substepDelta, vertPrev, edge, &intersectPoint, &t)
+                    && t < tMin) {
+					tMin = t;
+					intersectPos = intersectPoint;
+					intersectEdge = edge;
+				}
+				vertPrev = vert;
+			}
+            
+			if (tMin <= 1.0f) {
+				Vec2 edgeDir = Normalize(intersectEdge);
+				LineColliderIntersect* intersect = outIntersects->Append();
+				intersect->pos = intersectPos;
+				intersect->normal = Vec2 { -edgeDir.y, edgeDir.x };
+				intersect->t = ((float32)s + tMin * tScale) * substepT;
+				intersect->collider = collider;
+			}
+		}
+        
+		posPrev = pos;
+	}
+    
+	// Sort by time of impact, there are only a handful of these
+	for (uint64 i = 1; i < outIntersects->size; i++) {
+		LineColliderIntersect intersect = (*outIntersects)[i];
+		uint64 j = i;
+		while (j > 0 && (*outIntersects)[j - 1].t > intersect.t) {
+			(*outIntersects)[j] = (*outIntersects)[j - 1];
+			j--;
+		}
+		(*outIntersects)[j] = intersect;
+	}
+}
+
+internal bool GetLineColliderHeightAlongRay(const LineCollider& lineCollider, Vec2 floorPos, Vec2 floorNormal,
+                                            float32* outHeight)
+{
     DEBUG_ASSERT(lineCollider.line.size >= 2);
     Vec2 vertPrev = lineCollider.line[0];
     for (uint64 v = 1; v < lineCollider.line.size; v++) {
@@ -240,6 +523,108 @@ bool GetLineColliderCoordYFromFloorCoordX(const LineCollider& lineCollider, cons
         }
         vertPrev = vert;
     }
-    
+
     return false;
+}
+
+void LineCollider::PrecomputeHeightsFromFloor(const FloorCollider& floor)
+{
+    DEBUG_ASSERT(line.size >= 2);
+    heightSamples.Clear();
+
+    // Unwrapped coordX span of the vertices, relative to the first one
+    const float32 halfLength = floor.length / 2.0f;
+    const float32 coordXFirst = floor.GetCoordsFromWorldPos(line[0]).x;
+    float32 coordXPrev = coordXFirst;
+    float32 offset = 0.0f;
+    float32 offsetMin = 0.0f;
+    float32 offsetMax = 0.0f;
+    for (uint64 v = 1; v < line.size; v++) {
+        float32 coordX = floor.GetCoordsFromWorldPos(line[v]).x;
+        float32 delta = coordX - coordXPrev;
+        if (delta > halfLength) {
+            delta -= floor.length;
+        }
+        else if (delta < -halfLength) {
+            delta += floor.length;
+        }
+        offset += delta;
+        offsetMin = MinFloat32(offsetMin, offset);
+        offsetMax = MaxFloat32(offsetMax, offset);
+        coordXPrev = coordX;
+    }
+
+    // Pad a few samples on each side, since rays along a curved floor's normals can land slightly outside
+    // the span of the vertices' closest floor points
+    const int64 padding = LINE_COLLIDER_HEIGHT_SAMPLE_PADDING;
+    int64 sampleStart = (int64)floorf((coordXFirst + offsetMin) / FLOOR_PRECOMPUTED_STEP_LENGTH) - padding;
+    int64 sampleEnd = (int64)ceilf((coordXFirst + offsetMax) / FLOOR_PRECOMPUTED_STEP_LENGTH) + padding;
+    uint64 numSamples = (uint64)(sampleEnd - sampleStart + 1);
+    if (numSamples > LINE_COLLIDER_HEIGHT_SAMPLES_MAX) {
+        // The table is only a shortcut, lookups on this collider keep raycasting
+        LOG_WARN("Line collider too long for height samples (%llu, max %d)\n",
+                 numSamples, LINE_COLLIDER_HEIGHT_SAMPLES_MAX);
+        return;
+    }
+
+    heightCoordXStart = sampleStart * FLOOR_PRECOMPUTED_STEP_LENGTH;
+    if (heightCoordXStart < 0.0f) {
+        heightCoordXStart += floor.length;
+    }
+    else if (heightCoordXStart >= floor.length) {
+        heightCoordXStart -= floor.length;
+    }
+
+    for (uint64 i = 0; i < numSamples; i++) {
+        float32 coordX = heightCoordXStart + i * FLOOR_PRECOMPUTED_STEP_LENGTH;
+        if (coordX >= floor.length) {
+            coordX -= floor.length;
+        }
+        Vec2 floorPos, floorNormal;
+        floor.GetInfoFromCoordX(coordX, &floorPos, &floorNormal);
+        float32 height;
+        if (!GetLineColliderHeightAlongRay(*this, floorPos, floorNormal, &height)) {
+            height = LINE_COLLIDER_NO_HEIGHT;
+        }
+        heightSamples.Append(height);
+    }
+}
+
+bool GetLineColliderCoordYFromFloorCoordX(const LineCollider& lineCollider, const FloorCollider& floorCollider,
+                                          float32 coordX, float32* outHeight)
+{
+    if (lineCollider.heightSamples.size > 0) {
+        float32 offset = coordX - lineCollider.heightCoordXStart;
+        if (offset < 0.0f) {
+            offset += floorCollider.length;
+        }
+        else if (offset >= floorCollider.length) {
+            offset -= floorCollider.length;
+        }
+        if (offset < 0.0f) {
+            return false;
+        }
+        float32 indFloat = offset / FLOOR_PRECOMPUTED_STEP_LENGTH;
+        uint64 ind1 = (uint64)indFloat;
+        if (ind1 + 1 >= lineCollider.heightSamples.size) {
+            return false;
+        }
+
+        float32 height1 = lineCollider.heightSamples[ind1];
+        float32 height2 = lineCollider.heightSamples[ind1 + 1];
+        bool hit1 = height1 != LINE_COLLIDER_NO_HEIGHT;
+        bool hit2 = height2 != LINE_COLLIDER_NO_HEIGHT;
+        if (hit1 && hit2) {
+            *outHeight = Lerp(height1, height2, indFloat - (float32)ind1);
+            return true;
+        }
+        else if (!hit1 && !hit2) {
+            return false;
+        }
+        // One of the collider's ends lies between these samples, raycast for the exact edge
+    }
+
+    Vec2 floorPos, floorNormal;
+    floorCollider.GetInfoFromCoordX(coordX, &floorPos, &floorNormal);
+    return GetLineColliderHeightAlongRay(lineCollider, floorPos, floorNormal, outHeight);
 }
\ No newline at end of file
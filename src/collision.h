@@ -3,9 +3,13 @@
 #include <km_common/km_lib.h>
 #include <km_common/km_math.h>
 
+#define FLOOR_PRECOMPUTED_STEP_LENGTH 0.05f
 #define FLOOR_PRECOMPUTED_POINTS_MAX 262144
 #define FLOOR_COLLIDER_MAX_VERTICES 8192
 #define LINE_COLLIDER_MAX_VERTICES 32
+#define LINE_COLLIDER_HEIGHT_SAMPLES_MAX 4096
+// Height sample value where the floor normal ray misses the line collider
+#define LINE_COLLIDER_NO_HEIGHT -1.0f
 
 struct FloorSampleVertex
 {
@@ -19,31 +23,55 @@ struct FloorCollider
     
 	// Precomputed fields
 	float32 length;
+	// Arc length at the start of each line vertex, plus the total length at the end (line.size + 1 entries)
+	FixedArray<float32, FLOOR_COLLIDER_MAX_VERTICES + 1> vertexCoordX;
 	FixedArray<FloorSampleVertex, FLOOR_PRECOMPUTED_POINTS_MAX> sampleVertices;
     
 	void GetInfoFromCoordX(float32 coordX, Vec2* outFloorPos, Vec2* outNormal) const;
+	// Same as GetInfoFromCoordX for n coordinates at once, 4 at a time with SSE
+	void GetInfoFromCoordXBatch(const float32* coordX, uint64 n, Vec2* outFloorPos, Vec2* outNormal) const;
 	Vec2 GetWorldPosFromCoords(Vec2 coords) const;
     
     Vec2 GetCoordsFromWorldPos(Vec2 worldPos) const;
 	void GetInfoFromCoordXSlow(float32 coordX, Vec2* outFloorPos, Vec2* outNormal) const;
+	void GetInfoFromEdge(uint64 edge, float32 tEdge, Vec2* outFloorPos, Vec2* outNormal) const;
 	void PrecomputeSampleVerticesFromLine();
+	// Cheaper alternative to PrecomputeSampleVerticesFromLine when only line[vertex] has moved.
+	// Samples past the affected edges are shifted by resampling, so call the full version once edits settle.
+	void PrecomputeSampleVerticesFromVertexMove(uint64 vertex);
+	void PrecomputeSampleVertexRange(uint64 sampleStart, uint64 sampleEnd);
 };
 
 struct LineCollider
 {
 	FixedArray<Vec2, LINE_COLLIDER_MAX_VERTICES> line;
+
+	// Precomputed fields
+	// Height above the floor sampled every FLOOR_PRECOMPUTED_STEP_LENGTH along the collider's coordX span,
+	// starting at heightCoordXStart. Empty if not precomputed, in which case lookups raycast the line.
+	float32 heightCoordXStart;
+	FixedArray<float32, LINE_COLLIDER_HEIGHT_SAMPLES_MAX> heightSamples;
+
+	// Must be called again whenever the floor collider changes. Leaves the table empty if the collider spans
+	// more than LINE_COLLIDER_HEIGHT_SAMPLES_MAX samples.
+	void PrecomputeHeightsFromFloor(const FloorCollider& floor);
 };
 
 struct LineColliderIntersect
 {
 	Vec2 pos;
 	Vec2 normal;
+	float32 t; // time of impact, as a fraction of the swept movement
 	const LineCollider* collider;
 };
 
 template <uint64 S>
 void GetLineColliderIntersections(const Array<LineCollider>& lineColliders, Vec2 pos, Vec2 deltaPos,
                                   float32 movementMargin, FixedArray<LineColliderIntersect, S>* outIntersects);
+template <uint64 S>
+void GetLineColliderIntersectionsAlongFloor(const Array<LineCollider>& lineColliders, const FloorCollider& floor,
+                                            Vec2 coords, Vec2 deltaCoords, float32 movementMargin,
+                                            FixedArray<LineColliderIntersect, S>* outIntersects);
 
 bool GetLineColliderCoordYFromFloorCoordX(const LineCollider& lineCollider,
                                           const FloorCollider& floorCollider, float32 coordX,
@@ -0,0 +1,68 @@
+#include "jobs.h"
+
+#include <km_common/km_debug.h>
+#include <km_common/km_math.h>
+#undef internal
+#include <atomic>
+#include <thread>
+#define internal static
+
+struct JobBatch
+{
+	JobFunction function;
+	void* data;
+	int numJobs;
+	std::atomic<int> nextJob;
+};
+
+internal void RunJobBatch(JobBatch* batch)
+{
+	while (true) {
+		int job = batch->nextJob.fetch_add(1);
+		if (job >= batch->numJobs) {
+			break;
+		}
+		batch->function(batch->data, job);
+	}
+}
+
+int GetProcessorCount()
+{
+	unsigned int count = std::thread::hardware_concurrency();
+	return count == 0 ? 1 : (int)count;
+}
+
+JobSystem CreateJobSystem(int numThreads)
+{
+	JobSystem jobSystem;
+	jobSystem.numThreads = ClampInt(numThreads, 1, JOB_THREADS_MAX);
+	return jobSystem;
+}
+
+void RunJobs(const JobSystem& jobSystem, int numJobs, JobFunction function, void* data)
+{
+	DEBUG_ASSERT(1 <= jobSystem.numThreads && jobSystem.numThreads <= JOB_THREADS_MAX);
+
+	int numHelpers = MinInt(jobSystem.numThreads, numJobs) - 1;
+	if (numHelpers <= 0) {
+		for (int i = 0; i < numJobs; i++) {
+			function(data, i);
+		}
+		return;
+	}
+
+	JobBatch batch;
+	batch.function = function;
+	batch.data = data;
+	batch.numJobs = numJobs;
+	batch.nextJob = 0;
+
+	std::thread helpers[JOB_THREADS_MAX - 1];
+	for (int i = 0; i < numHelpers; i++) {
+		helpers[i] = std::thread(RunJobBatch, &batch);
+	}
+	RunJobBatch(&batch);
+	for (int i = 0; i < numHelpers; i++) {
+		helpers[i].join();
+	}
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <km_common/km_defines.h>
+
+#define JOB_THREADS_MAX 16
+
+typedef void (*JobFunction)(void* data, int jobIndex);
+
+// Fork-join job runner. Each RunJobs call starts its helper threads and joins them before returning,
+// so no game code is left running on another thread across a hot reload.
+struct JobSystem
+{
+	int numThreads; // including the calling thread
+};
+
+// Number of hardware threads, at least 1
+int GetProcessorCount();
+JobSystem CreateJobSystem(int numThreads);
+// Calls function(data, j) for every j in [0, numJobs), spread over the job system's threads.
+// Jobs are picked up in no particular order, so results must not depend on which thread runs which job.
+void RunJobs(const JobSystem& jobSystem, int numJobs, JobFunction function, void* data);
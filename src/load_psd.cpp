@@ -583,6 +583,44 @@ bool PsdFile::LoadLayerAtPsdSizeTextureGL(uint64 layerIndex, LayerChannelID chan
 	return true;
 }
 
+int PsdFile::GetGroupTimelineLayers(string groupName, uint64* outLayers, int maxLayers)
+{
+	int numLayers = 0;
+	float64 lastStart = -1.0f;
+	while (true) {
+		uint64 nextLayerIndex = layers.size;
+		float64 earliestStart = 1e6;
+		for (uint64 i = 0; i < layers.size; i++) {
+			if (!layers[i].inTimeline) {
+				continue;
+			}
+			if (layers[i].parentIndex == layers.size) {
+				continue;
+			}
+			uint64 parentIndex = layers[i].parentIndex;
+			if (!StringEquals(layers[parentIndex].name.ToArray(), groupName)) {
+				continue;
+			}
+			float64 start = layers[i].timelineStart;
+			if (start < earliestStart && start > lastStart) {
+				earliestStart = start;
+				nextLayerIndex = i;
+			}
+		}
+		if (nextLayerIndex == layers.size) {
+			break;
+		}
+
+		if (numLayers >= maxLayers) {
+			return -1;
+		}
+		outLayers[numLayers++] = nextLayerIndex;
+		lastStart = earliestStart;
+	}
+
+	return numLayers;
+}
+
 // Reference: Official Adobe File Formats specification document
 // https://www.adobe.com/devnet-apps/photoshop/fileformatashtml/
 template <typename Allocator>
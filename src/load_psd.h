@@ -61,6 +61,9 @@ struct PsdFile
 	template <typename Allocator>
         bool LoadLayerImageData(uint64 layerIndex, LayerChannelID channel, Allocator* allocator,
                                 ImageData* outImageData);
+	// Fills outLayers with the timeline layers in the named group (e.g. an animation's frames), in timeline
+	// order. Returns the number of layers, or -1 if there are more than maxLayers.
+	int GetGroupTimelineLayers(string groupName, uint64* outLayers, int maxLayers);
 	template <typename Allocator>
         bool LoadLayerTextureGL(uint64 layerIndex, LayerChannelID channel, GLint magFilter,
                                 GLint minFilter, GLint wrapS, GLint wrapT, Allocator* allocator, TextureGL* outTextureGL);
@@ -9,9 +9,6 @@
 #include <km_common/km_os.h>
 #include <km_common/km_string.h>
 #include <km_platform/main_platform.h>
-#undef internal
-#include <random>
-#define internal static
 #include <stb_image.h>
 #include <stb_sprintf.h>
 
@@ -30,26 +27,75 @@ const float32 PLAYER_HEIGHT = 1.3f;
 
 const float32 LINE_COLLIDER_MARGIN = 0.05f;
 
-global_var const char* KID_ANIMATION_IDLE = "idle";
-global_var const char* KID_ANIMATION_WALK = "walk";
-global_var const char* KID_ANIMATION_JUMP = "jump";
-global_var const char* KID_ANIMATION_FALL = "fall";
-global_var const char* KID_ANIMATION_LAND = "land";
-
-inline float32 RandFloat32()
+const Vec2 PHYSICS_GRAVITY = Vec2 { 0.0f, -9.8f };
+const float32 PHYSICS_GROUND_FRICTION = 4.0f;
+
+// Particle storage, carved out of permanent memory right after GameState
+const uint64 PARTICLE_POOL_MEMORY_SIZE = MEGABYTES(4);
+// Loaded audio clips, right after the particle pool
+const uint64 AUDIO_CLIP_MEMORY_SIZE = MEGABYTES(4);
+
+// Rain falls from a cloud above these overworld floor coordinates
+const LevelId RAIN_LEVEL = LevelId::OVERWORLD;
+const Vec2 RAIN_CLOUD_COORDS = Vec2 { 86.0f, 7.0f };
+const float32 RAIN_CLOUD_WIDTH = 4.0f;
+const int RAIN_PARTICLES_MAX = 4096;
+const int RAIN_PARTICLES_PER_SEC = 600;
+const float32 RAIN_UPDATE_BUDGET = 0.001f;
+
+// Fixed so runs are reproducible. Reseed gameState->random for replays.
+const uint64 GAME_RANDOM_SEED = 0x6b69642d6f6c64ull;
+
+global_var const char* KID_ANIMATION_NAMES[(int)KidAnimation::COUNT] = {
+    "idle",
+    "walk",
+    "jump",
+    "fall",
+    "land"
+};
+
+// Looks up the kid sprite's animation ids once, so the per-frame animation logic only compares ints
+internal bool LoadKidAnimationIds(GameState* gameState)
 {
-	return (float32)rand() / RAND_MAX;
+    const AnimatedSprite* spriteKid = GetAnimatedSprite(gameState->assets, AnimatedSpriteId::KID);
+    for (int i = 0; i < (int)KidAnimation::COUNT; i++) {
+        int id = GetAnimationId(*spriteKid, HashKey(KID_ANIMATION_NAMES[i]));
+        if (id == ANIMATION_ID_NONE) {
+            LOG_ERROR("Kid sprite has no animation %s\n", KID_ANIMATION_NAMES[i]);
+            return false;
+        }
+        gameState->kidAnimations[i] = id;
+    }
+
+    return true;
 }
-inline float32 RandFloat32(float32 min, float32 max)
+
+internal void InitRainParticle(ParticleSystem* ps, Particle* particle, const float32* random, void* data)
 {
-	DEBUG_ASSERT(max > min);
-	return RandFloat32() * (max - min) + min;
+	particle->life = 0.0f;
+	particle->pos = Vec3 {
+		RAIN_CLOUD_COORDS.x + (random[0] - 0.5f) * RAIN_CLOUD_WIDTH,
+		RAIN_CLOUD_COORDS.y + random[1] * 0.5f,
+		0.0f
+	};
+	particle->vel = Vec3 { 0.0f, -6.0f - random[2] * 2.0f, 0.0f };
+	particle->color = Vec4 { 0.55f, 0.6f, 0.75f, 1.0f };
+	particle->size = Vec2 { 0.03f, 0.2f + random[3] * 0.1f };
+	particle->bounceMult = 0.0f;
+	particle->frictionMult = 0.0f;
 }
 
-inline int RandInt(int min, int max)
+// Points the rain at its level's floor and line colliders.
+// Call again whenever that level is reloaded or its colliders change.
+internal void SetRainTerrain(GameState* gameState)
 {
-	DEBUG_ASSERT(max > min);
-	return rand() % (max - min) + min;
+	const LevelData* levelData = GetLevelData(gameState->assets, RAIN_LEVEL);
+	if (gameState->rain == nullptr || levelData == nullptr) {
+		return;
+	}
+
+	SetParticleSystemTerrain(gameState->rain, &levelData->floor,
+                             levelData->lineColliders.data, (int)levelData->lineColliders.size, COLLIDER_SINK);
 }
 
 internal float32 ScaleExponentToWorldScale(float32 exponent)
@@ -149,8 +195,8 @@ Vec2 ScreenToWorld(Vec2Int screenPos, ScreenInfo screenInfo,
 	return Vec2 { result.x, result.y };
 }
 
-internal bool SetActiveLevel(LevelState* levelState, GameAssets* assets, LevelId levelId,
-                             Vec2 startCoords, float32 pixelsPerUnit, MemoryBlock transient)
+internal bool SetActiveLevel(LevelState* levelState, GameAssets* assets, AnimationSystem* animationSystem,
+                             LevelId levelId, Vec2 startCoords, float32 pixelsPerUnit, MemoryBlock transient)
 {
 	const LevelData* levelData = GetLevelData(assets, levelId);
     if (levelData == nullptr) {
@@ -175,16 +221,9 @@ internal bool SetActiveLevel(LevelState* levelState, GameAssets* assets, LevelId
 	}
 	else {
 		levelState->playerState = PlayerState::GROUNDED;
-		levelState->kid.activeFrame = 0;
-		levelState->kid.activeFrameRepeat = 0;
-		levelState->kid.activeFrameTime = 0.0f;
 	}
 
-    levelState->kid.animatedSpriteId = AnimatedSpriteId::KID;
-    levelState->kid.activeAnimationKey.WriteString(KID_ANIMATION_IDLE);
-    levelState->kid.activeFrame = 0;
-    levelState->kid.activeFrameRepeat = 0;
-    levelState->kid.activeFrameTime = 0.0f;
+    ResetAnimationInstances(animationSystem, *assets, AnimatedSpriteId::KID);
 
 	if (levelData->lockedCamera) {
 		levelState->cameraCoords = levelData->cameraCoords;
@@ -196,7 +235,7 @@ internal bool SetActiveLevel(LevelState* levelState, GameAssets* assets, LevelId
 	return true;
 }
 
-internal Vec2 WrappedWorldOffset(Vec2 fromCoords, Vec2 toCoords, float32 floorLength)
+Vec2 WrappedWorldOffset(Vec2 fromCoords, Vec2 toCoords, float32 floorLength)
 {
 	Vec2 offset = toCoords - fromCoords;
 	float32 distX = AbsFloat32(offset.x);
@@ -248,7 +287,7 @@ internal void UpdateWorld(GameState* gameState, float32 deltaTime, const GameInp
                 && AbsFloat32(toPlayer.y) <= levelData->levelTransitions[i].range.y) {
 				LevelId newLevelId = (LevelId)levelData->levelTransitions[i].toLevel;
 				Vec2 startCoords = levelData->levelTransitions[i].toCoords;
-				if (!SetActiveLevel(levelState, &gameState->assets, newLevelId, startCoords,
+				if (!SetActiveLevel(levelState, &gameState->assets, &gameState->animationSystem, newLevelId, startCoords,
                                     gameState->refPixelsPerUnit, transient)) {
 					DEBUG_PANIC("Failed to load level %llu\n", i);
 				}
@@ -259,17 +298,18 @@ internal void UpdateWorld(GameState* gameState, float32 deltaTime, const GameInp
 
 	const LevelData* levelData = GetLevelData(gameState->assets, levelState->activeLevelId);
 
-	HashKey ANIM_IDLE(KID_ANIMATION_IDLE);
-	HashKey ANIM_WALK(KID_ANIMATION_WALK);
-	HashKey ANIM_JUMP(KID_ANIMATION_JUMP);
-	HashKey ANIM_FALL(KID_ANIMATION_FALL);
-	HashKey ANIM_LAND(KID_ANIMATION_LAND);
+	const int ANIM_IDLE = gameState->kidAnimations[(int)KidAnimation::IDLE];
+	const int ANIM_WALK = gameState->kidAnimations[(int)KidAnimation::WALK];
+	const int ANIM_JUMP = gameState->kidAnimations[(int)KidAnimation::JUMP];
+	const int ANIM_FALL = gameState->kidAnimations[(int)KidAnimation::FALL];
+	const int ANIM_LAND = gameState->kidAnimations[(int)KidAnimation::LAND];
 
 	const float32 PLAYER_WALK_SPEED = 3.6f;
 	const float32 PLAYER_JUMP_HOLD_DURATION_MIN = 0.02f;
 	const float32 PLAYER_JUMP_HOLD_DURATION_MAX = 0.3f;
 	const float32 PLAYER_JUMP_MAG_MAX = 1.2f;
 	const float32 PLAYER_JUMP_MAG_MIN = 0.4f;
+	const float32 JUMP_SOUND_RADIUS = 20.0f;
 
 	float32 speedMultiplier = 1.0f;
 
@@ -316,14 +356,14 @@ internal void UpdateWorld(GameState* gameState, float32 deltaTime, const GameInp
             || IsKeyPressed(input, KM_KEY_ARROW_UP)
             || (input.controllers[0].isConnected && input.controllers[0].a.isDown);
         if (levelState->playerState == PlayerState::GROUNDED && jumpPressed
-            && !KeyCompare(levelState->kid.activeAnimationKey, ANIM_FALL) /* TODO fall anim + grounded state seems sketchy */) {
+            && GetActiveAnimation(gameState->animationSystem, levelState->kid) != ANIM_FALL /* TODO fall anim + grounded state seems sketchy */) {
             levelState->playerState = PlayerState::JUMPING;
             levelState->currentPlatform = nullptr;
             levelState->playerJumpHolding = true;
             levelState->playerJumpHold = 0.0f;
             levelState->playerJumpMag = PLAYER_JUMP_MAG_MAX;
-            gameState->audioState.soundJump.playing = true;
-            gameState->audioState.soundJump.sampleIndex = 0;
+            PlaySoundAt(&gameState->audioState, &gameState->audioState.soundJump, AudioBusId::SFX,
+                        levelState->playerCoords, JUMP_SOUND_RADIUS, 1.0f, 0);
         }
 
         if (levelState->playerJumpHolding) {
@@ -339,10 +379,10 @@ internal void UpdateWorld(GameState* gameState, float32 deltaTime, const GameInp
         }
 	}
 
-	FixedArray<HashKey, 4> nextAnimations;
+	FixedArray<int, 4> nextAnimations;
 	nextAnimations.size = 0;
 	if (levelState->playerState == PlayerState::JUMPING) {
-		if (!KeyCompare(levelState->kid.activeAnimationKey, ANIM_JUMP)) {
+		if (GetActiveAnimation(gameState->animationSystem, levelState->kid) != ANIM_JUMP) {
 			nextAnimations.Append(ANIM_JUMP);
 		}
 		else {
@@ -363,20 +403,23 @@ internal void UpdateWorld(GameState* gameState, float32 deltaTime, const GameInp
 		}
 	}
 
-	float32 animDeltaTime = deltaTime;
+	float32 animTimeScale = 1.0f;
 	if (levelState->playerState == PlayerState::GROUNDED) {
-		animDeltaTime *= speedMultiplier;
+		animTimeScale *= speedMultiplier;
 	}
 	if (levelState->playerState == PlayerState::JUMPING) {
-		animDeltaTime /= Lerp(levelState->playerJumpMag, 1.0f, 0.5f);
+		animTimeScale /= Lerp(levelState->playerJumpMag, 1.0f, 0.5f);
 	}
-	Vec2 rootMotion = UpdateAnimatedSprite(&levelState->kid, gameState->assets, animDeltaTime, nextAnimations.ToArray());
+	SetNextAnimations(&gameState->animationSystem, levelState->kid, nextAnimations.ToArray());
+	SetAnimationTimeScale(&gameState->animationSystem, levelState->kid, animTimeScale);
+	UpdateAnimationInstances(&gameState->animationSystem, gameState->assets, deltaTime);
+	Vec2 rootMotion = GetRootMotion(gameState->animationSystem, levelState->kid);
 	if (levelState->playerState == PlayerState::JUMPING) {
 		rootMotion *= levelState->playerJumpMag;
 	}
 
 	if (levelState->playerState == PlayerState::JUMPING
-        && KeyCompare(levelState->kid.activeAnimationKey, ANIM_FALL)) {
+        && GetActiveAnimation(gameState->animationSystem, levelState->kid) == ANIM_FALL) {
 		levelState->playerState = PlayerState::FALLING;
 	}
 
@@ -384,23 +427,15 @@ internal void UpdateWorld(GameState* gameState, float32 deltaTime, const GameInp
 
 	Vec2 deltaCoords = levelState->playerVel * deltaTime + rootMotion;
 
-	Vec2 playerPos = floor.GetWorldPosFromCoords(levelState->playerCoords);
-	Vec2 playerPosNew = floor.GetWorldPosFromCoords(levelState->playerCoords + deltaCoords);
-	Vec2 deltaPos = playerPosNew - playerPos;
-
 	FixedArray<LineColliderIntersect, LINE_COLLIDERS_MAX> intersects;
-	GetLineColliderIntersections(levelData->lineColliders.ToArray(), playerPos, deltaPos,
-                                 LINE_COLLIDER_MARGIN, &intersects);
+	GetLineColliderIntersectionsAlongFloor(levelData->lineColliders.ToArray(), floor,
+                                           levelState->playerCoords, deltaCoords, LINE_COLLIDER_MARGIN, &intersects);
 	for (uint64 i = 0; i < intersects.size; i++) {
 		if (levelState->currentPlatform == intersects[i].collider) {
 			continue;
 		}
 
-		float32 newDeltaCoordX = deltaCoords.x;
-		if (deltaPos.x != 0.0f) {
-			float32 tX = (intersects[i].pos.x - playerPos.x) / deltaPos.x;
-			newDeltaCoordX = deltaCoords.x * tX;
-		}
+		float32 newDeltaCoordX = deltaCoords.x * intersects[i].t;
 		Vec2 newFloorPos, newFloorNormal;
 		floor.GetInfoFromCoordX(levelState->playerCoords.x + newDeltaCoordX, &newFloorPos, &newFloorNormal);
 
@@ -411,11 +446,13 @@ internal void UpdateWorld(GameState* gameState, float32 deltaTime, const GameInp
 			if (levelState->playerState == PlayerState::FALLING) {
 				levelState->currentPlatform = intersects[i].collider;
 				deltaCoords.x = newDeltaCoordX;
+				break; // intersects are sorted by time of impact, the rest happen after landing
 			}
 		}
 		else {
 			// Floor at steep angle (wall)
 			deltaCoords = Vec2::zero;
+			break;
 		}
 	}
 
@@ -441,12 +478,12 @@ internal void UpdateWorld(GameState* gameState, float32 deltaTime, const GameInp
 		levelState->playerState = PlayerState::GROUNDED;
 	}
 
-    const TextureGL* textureRock = GetTexture(gameState->assets, TextureId::ROCK);
+	PhysicsWorld* physicsWorld = &gameState->physicsWorld;
+	UpdatePhysicsWorld(physicsWorld, floor, levelData->lineColliders.ToArray(), LINE_COLLIDER_MARGIN, deltaTime);
+
 	{ // rock
-		Vec2 size = ToVec2(textureRock->size) / gameState->refPixelsPerUnit;
-		float32 radius = size.y / 2.0f * 0.8f;
-		gameState->rock.angle = -gameState->rock.coords.x / radius;
-		gameState->rock.coords.y = radius;
+		const uint64 rockBody = gameState->rock.body;
+		gameState->rock.angle = -physicsWorld->coords[rockBody].x / physicsWorld->radius[rockBody];
 	}
 
 	const float32 GRAB_RANGE = 0.2f;
@@ -454,10 +491,10 @@ internal void UpdateWorld(GameState* gameState, float32 deltaTime, const GameInp
 	if (isInteractKeyPressed && levelState->grabbedObject.coordsPtr == nullptr) {
 		FixedArray<GrabbedObjectInfo, 10> candidates;
 		candidates.size = 0;
-		Vec2 rockSize = ToVec2(textureRock->size) / gameState->refPixelsPerUnit;
-		float32 rockRadius = rockSize.y / 2.0f * 0.8f;
+		const uint64 rockBody = gameState->rock.body;
+		float32 rockRadius = physicsWorld->radius[rockBody];
 		candidates.Append({
-                              &gameState->rock.coords,
+                              &physicsWorld->coords[rockBody],
                               Vec2 { rockRadius * 1.2f, rockRadius * 1.7f },
                               Vec2 { 0.0f, rockRadius * 2.0f }
                           });
@@ -553,10 +590,6 @@ internal void UpdateWorld(GameState* gameState, float32 deltaTime, const GameInp
 	}
 	levelState->playerCoords = playerCoordsNew;
 
-	Array<HashKey> paperNextAnims;
-	paperNextAnims.size = 0;
-	UpdateAnimatedSprite(&gameState->paper, gameState->assets, deltaTime, paperNextAnims);
-
 	if (gameState->kmKey) {
 		return;
 	}
@@ -605,31 +638,76 @@ internal void UpdateWorld(GameState* gameState, float32 deltaTime, const GameInp
 	}
 	levelState->cameraPos = camFloorPos + camFloorNormal * levelState->cameraCoords.y;
 	levelState->cameraRot = QuatFromAngleUnitAxis(angle, Vec3::unitZ);
+
+	SetAudioListener(&gameState->audioState, levelState->cameraCoords, floor.length);
 }
 
-internal void DrawWorld(const GameState* gameState, SpriteDataGL* spriteDataGL,
-                        Mat4 projection, ScreenInfo screenInfo)
+// The kid's world position and rotation, standing on the floor at its coords
+internal void GetPlayerTransform(const GameState* gameState, Vec2* outPos, Quat* outRot)
 {
     const LevelState* levelState = &gameState->levelState;
     const LevelData* levelData = GetLevelData(gameState->assets, levelState->activeLevelId);
-	const FloorCollider& floor = levelData->floor;
-
-	spriteDataGL->numSprites = 0;
 
 	Vec2 playerFloorPos, playerFloorNormal;
-	floor.GetInfoFromCoordX(levelState->playerCoords.x, &playerFloorPos, &playerFloorNormal);
-	Vec2 playerPos = playerFloorPos + playerFloorNormal * levelState->playerCoords.y;
+	levelData->floor.GetInfoFromCoordX(levelState->playerCoords.x, &playerFloorPos, &playerFloorNormal);
+	*outPos = playerFloorPos + playerFloorNormal * levelState->playerCoords.y;
 	float32 playerAngle = acosf(Dot(Vec2::unitY, playerFloorNormal));
 	if (playerFloorNormal.x > 0.0f) {
 		playerAngle = -playerAngle;
 	}
-	Quat playerRot = QuatFromAngleUnitAxis(playerAngle, Vec3::unitZ);
+	*outRot = QuatFromAngleUnitAxis(playerAngle, Vec3::unitZ);
+}
+
+// Places the kid on the floor and the paper over the screen, for DrawWorld
+internal void UpdateAnimationTransforms(GameState* gameState, const ScreenInfo& screenInfo,
+                                        Vec2 playerPos, Quat playerRot)
+{
+    const LevelState* levelState = &gameState->levelState;
     const AnimatedSprite* kidSprite = GetAnimatedSprite(gameState->assets, AnimatedSpriteId::KID);
 	Vec2 playerSize = ToVec2(kidSprite->textureSize) / gameState->refPixelsPerUnit;
 	Vec2 anchorUnused = Vec2::zero;
-	DrawAnimatedSprite(levelState->kid, gameState->assets, spriteDataGL,
-                       playerPos, playerSize, anchorUnused, playerRot, 1.0f, !levelState->facingRight);
+	SetAnimationTransform(&gameState->animationSystem, levelState->kid,
+                          playerPos, playerSize, anchorUnused, playerRot, 1.0f, !levelState->facingRight);
+
+	const float32 aspectRatio = (float32)screenInfo.size.x / screenInfo.size.y;
+	const float32 screenHeightUnits = (float32)gameState->refPixelScreenHeight / gameState->refPixelsPerUnit;
+	const Vec2 screenSizeWorld = { screenHeightUnits * aspectRatio, screenHeightUnits };
+	SetAnimationTransform(&gameState->animationSystem, gameState->paper,
+                          Vec2::zero, screenSizeWorld, Vec2::one / 2.0f, Quat::one, 0.5f, false);
+}
+
+internal void DrawWorld(const GameState* gameState, SpriteDataGL* spriteDataGL,
+                        Mat4 projection, Vec2 playerPos, Quat playerRot, MemoryBlock transient)
+{
+    const LevelState* levelState = &gameState->levelState;
+    const LevelData* levelData = GetLevelData(gameState->assets, levelState->activeLevelId);
+	const FloorCollider& floor = levelData->floor;
+
+	spriteDataGL->numSprites = 0;
 
+	const PhysicsWorld& physicsWorld = gameState->physicsWorld;
+	const uint64 rockBody = gameState->rock.body;
+	const Vec2 rockCenterCoords = physicsWorld.coords[rockBody] + Vec2 { 0.0f, physicsWorld.radius[rockBody] };
+
+	// Gather all floor queries for this draw: rock, then one slot per level sprite
+	const uint64 FLOOR_QUERY_ROCK = 0;
+	const uint64 FLOOR_QUERY_SPRITES = 1;
+	const uint64 numFloorQueries = FLOOR_QUERY_SPRITES + levelData->sprites.size;
+	float32 floorQueryCoordX[FLOOR_QUERY_SPRITES + LEVEL_SPRITES_MAX];
+	Vec2 floorQueryPos[FLOOR_QUERY_SPRITES + LEVEL_SPRITES_MAX];
+	Vec2 floorQueryNormal[FLOOR_QUERY_SPRITES + LEVEL_SPRITES_MAX];
+	floorQueryCoordX[FLOOR_QUERY_ROCK] = rockCenterCoords.x;
+	for (uint64 i = 0; i < levelData->sprites.size; i++) {
+		floorQueryCoordX[FLOOR_QUERY_SPRITES + i] = levelData->spriteMetadata[i].coords.x;
+	}
+	floor.GetInfoFromCoordXBatch(floorQueryCoordX, numFloorQueries, floorQueryPos, floorQueryNormal);
+
+	Mat4 view = CalculateViewMatrix(levelState->cameraPos, levelState->cameraRot,
+                                    gameState->refPixelScreenHeight, gameState->refPixelsPerUnit, gameState->cameraOffsetFracY);
+	DrawAnimationInstances(gameState->animationSystem, gameState->assets, AnimationLayer::WORLD,
+                           gameState->renderState, projection * view, spriteDataGL);
+
+	static_assert(LEVEL_SPRITES_MAX + 1 <= SPRITE_BATCH_SIZE, "level sprites and the rock are drawn in one batch");
 	{ // level sprites
 		for (uint64 i = 0; i < levelData->sprites.size; i++) {
             const TextureGL* sprite = &levelData->sprites[i];
@@ -640,8 +718,8 @@ internal void DrawWorld(const GameState* gameState, SpriteDataGL* spriteDataGL,
 			if (spriteMetadata->type == SpriteType::OBJECT) {
 				baseRot = QuatFromAngleUnitAxis(-spriteMetadata->restAngle, Vec3::unitZ);
 
-				Vec2 floorPos, floorNormal;
-				floor.GetInfoFromCoordX(spriteMetadata->coords.x, &floorPos, &floorNormal);
+				Vec2 floorPos = floorQueryPos[FLOOR_QUERY_SPRITES + i];
+				Vec2 floorNormal = floorQueryNormal[FLOOR_QUERY_SPRITES + i];
 				pos = floorPos + floorNormal * spriteMetadata->coords.y;
 				if (spriteMetadata == levelState->liftedObject.spritePtr) {
 					rot = playerRot;
@@ -674,17 +752,25 @@ internal void DrawWorld(const GameState* gameState, SpriteDataGL* spriteDataGL,
 
     const TextureGL* textureRock = GetTexture(gameState->assets, TextureId::ROCK);
 	{ // rock
-		Vec2 pos = floor.GetWorldPosFromCoords(gameState->rock.coords);
+		Vec2 pos = floorQueryPos[FLOOR_QUERY_ROCK] + floorQueryNormal[FLOOR_QUERY_ROCK] * rockCenterCoords.y;
 		Vec2 size = ToVec2(textureRock->size) / gameState->refPixelsPerUnit;
 		Quat rot = QuatFromAngleUnitAxis(gameState->rock.angle, Vec3::unitZ);
 		Mat4 transform = CalculateTransform(pos, size, Vec2::one / 2.0f, rot, false);
 		PushSprite(spriteDataGL, transform, 1.0f, textureRock->textureID);
 	}
 
-	Mat4 view = CalculateViewMatrix(levelState->cameraPos, levelState->cameraRot,
-                                    gameState->refPixelScreenHeight, gameState->refPixelsPerUnit, gameState->cameraOffsetFracY);
 	DrawSprites(gameState->renderState, *spriteDataGL, projection * view);
 
+	if (gameState->rain != nullptr && levelState->activeLevelId == RAIN_LEVEL) {
+		// Face the particles toward the camera, which rotates with the floor
+		const Mat4 cameraRot = UnitQuatToMat4(levelState->cameraRot);
+		const Vec4 camRight = cameraRot * Vec4 { 1.0f, 0.0f, 0.0f, 0.0f };
+		const Vec4 camUp = cameraRot * Vec4 { 0.0f, 1.0f, 0.0f, 0.0f };
+		DrawParticleSystem2D(gameState->particleSystemGL, gameState->rain,
+                             Vec3 { camRight.x, camRight.y, camRight.z }, Vec3 { camUp.x, camUp.y, camUp.z },
+                             projection * view, transient);
+	}
+
 	spriteDataGL->numSprites = 0;
 
 	if (gameState->kmKey) {
@@ -692,14 +778,8 @@ internal void DrawWorld(const GameState* gameState, SpriteDataGL* spriteDataGL,
 		return;
 	}
 
-	const float32 aspectRatio = (float32)screenInfo.size.x / screenInfo.size.y;
-	const float32 screenHeightUnits = (float32)gameState->refPixelScreenHeight / gameState->refPixelsPerUnit;
-	const Vec2 screenSizeWorld = { screenHeightUnits * aspectRatio, screenHeightUnits };
-	DrawAnimatedSprite(gameState->paper, gameState->assets, spriteDataGL,
-                       Vec2::zero, screenSizeWorld, Vec2::one / 2.0f, Quat::one, 0.5f,
-                       false);
-
-	DrawSprites(gameState->renderState, *spriteDataGL, projection);
+	DrawAnimationInstances(gameState->animationSystem, gameState->assets, AnimationLayer::SCREEN,
+                           gameState->renderState, projection, spriteDataGL);
 }
 
 void GameUpdateAndRender(const PlatformFunctions& platformFuncs, const GameInput& input,
@@ -714,7 +794,7 @@ void GameUpdateAndRender(const PlatformFunctions& platformFuncs, const GameInput
 	// This function is expected to update the state of the game
 	// and draw the frame that will be displayed, ideally, some constant
 	// amount of time in the future.
-	DEBUG_ASSERT(sizeof(GameState) <= memory->permanent.size);
+	DEBUG_ASSERT(sizeof(GameState) + PARTICLE_POOL_MEMORY_SIZE + AUDIO_CLIP_MEMORY_SIZE <= memory->permanent.size);
 	GameState *gameState = (GameState*)memory->permanent.memory;
 
 	// NOTE make sure deltaTime values are reasonable
@@ -736,6 +816,11 @@ platformFuncs.glFunctions.name;
 			GL_FUNCTIONS_ALL
 #undef FUNC
 
+		if (memory->isInitialized && gameState->rain != nullptr) {
+			// Function pointers into game code move when it's reloaded
+			gameState->rain->initParticleFunc = InitRainParticle;
+		}
+
 		memory->shouldInitGlobalVariables = false;
 		LOG_INFO("Initialized global variables\n");
 	}
@@ -779,12 +864,21 @@ platformFuncs.glFunctions.name;
         if (!LoadOrRefreshAssets(&gameState->assets, gameState->refPixelsPerUnit, memory->transient)) {
             DEBUG_PANIC("Failed to load game assets\n");
         }
+        if (!LoadKidAnimationIds(gameState)) {
+            DEBUG_PANIC("Failed to load kid animation ids\n");
+        }
+
+        InitAnimationSystem(&gameState->animationSystem);
+        gameState->levelState.kid = CreateAnimationInstance(&gameState->animationSystem, gameState->assets,
+                                                            AnimatedSpriteId::KID, AnimationLayer::WORLD);
+        gameState->paper = CreateAnimationInstance(&gameState->animationSystem, gameState->assets,
+                                                   AnimatedSpriteId::PAPER, AnimationLayer::SCREEN);
 
         // Level loading
         // TODO might wanna move this...
 		const LevelId FIRST_LEVEL = LevelId::OVERWORLD;
         Vec2 startPos = { 83.9f, 1.0f };
-		if (!SetActiveLevel(&gameState->levelState, &gameState->assets, FIRST_LEVEL, startPos,
+		if (!SetActiveLevel(&gameState->levelState, &gameState->assets, &gameState->animationSystem, FIRST_LEVEL, startPos,
                             gameState->refPixelsPerUnit, memory->transient)) {
 			DEBUG_PANIC("Failed to load level %d\n", FIRST_LEVEL);
 		}
@@ -796,19 +890,43 @@ platformFuncs.glFunctions.name;
 
         LinearAllocator allocator(memory->transient.size, memory->transient.memory);
 
-		if (!InitAudioState(&allocator, &gameState->audioState, audio)) {
+        MemoryBlock audioClipMemory;
+        audioClipMemory.size = AUDIO_CLIP_MEMORY_SIZE;
+        audioClipMemory.memory = (uint8*)memory->permanent.memory + sizeof(GameState) + PARTICLE_POOL_MEMORY_SIZE;
+		if (!InitAudioState(&allocator, audioClipMemory, &gameState->audioState, audio)) {
 			DEBUG_PANIC("Failed to init audio state\n");
 		}
 
-        const AnimatedSprite* spritePaper = GetAnimatedSprite(gameState->assets, AnimatedSpriteId::PAPER);
-        gameState->paper.animatedSpriteId = AnimatedSpriteId::PAPER;
-        gameState->paper.activeAnimationKey = spritePaper->startAnimationKey;
-        gameState->paper.activeFrame = 0;
-        gameState->paper.activeFrameRepeat = 0;
-        gameState->paper.activeFrameTime = 0.0f;
+        SeedRandom(&gameState->random, GAME_RANDOM_SEED, 0);
 
         const LevelData* levelData = GetLevelData(gameState->assets, gameState->levelState.activeLevelId);
-        gameState->rock.coords = { levelData->floor.length - 10.0f, 0.0f };
+        InitPhysicsWorld(&gameState->physicsWorld, PHYSICS_GRAVITY, PHYSICS_GROUND_FRICTION);
+
+        gameState->jobSystem = CreateJobSystem(GetProcessorCount());
+
+        MemoryBlock particlePoolMemory;
+        particlePoolMemory.size = PARTICLE_POOL_MEMORY_SIZE;
+        particlePoolMemory.memory = (uint8*)memory->permanent.memory + sizeof(GameState);
+        if (!InitParticlePool(&gameState->particlePool, particlePoolMemory)) {
+            DEBUG_PANIC("Failed to init particle pool\n");
+        }
+        const TextureGL* texturePixel = GetTexture(gameState->assets, TextureId::PIXEL);
+        gameState->rain = CreateParticleSystem(&gameState->particlePool, RAIN_PARTICLES_MAX,
+                                               RAIN_PARTICLES_PER_SEC, 2.0f, Vec3 { 0.0f, -9.8f, 0.0f },
+                                               0.0f, 0.0f,
+                                               nullptr, 0, nullptr, 0, nullptr, 0, nullptr, 0,
+                                               InitRainParticle, texturePixel->textureID);
+        if (gameState->rain == nullptr) {
+            DEBUG_PANIC("Failed to create rain particle system\n");
+        }
+        SetParticleSystemBudget(gameState->rain, RAIN_UPDATE_BUDGET);
+        SetRainTerrain(gameState);
+
+        const TextureGL* textureRock = GetTexture(gameState->assets, TextureId::ROCK);
+        float32 rockRadius = ToVec2(textureRock->size).y / gameState->refPixelsPerUnit / 2.0f * 0.8f;
+        gameState->rock.body = AddPhysicsBody(&gameState->physicsWorld,
+                                              Vec2 { levelData->floor.length - 10.0f, 0.0f }, rockRadius);
+        DEBUG_ASSERT(gameState->rock.body != PHYSICS_BODIES_MAX);
         gameState->rock.angle = 0.0f;
 
 		// Rendering stuff
@@ -818,6 +936,7 @@ platformFuncs.glFunctions.name;
 		gameState->texturedRectGL = InitTexturedRectGL(&allocator);
 		gameState->lineGL = InitLineGL(&allocator);
 		gameState->textGL = InitTextGL(&allocator);
+		gameState->particleSystemGL = InitParticleSystemGL(&allocator);
 
 		InitializeFramebuffers(NUM_FRAMEBUFFERS_COLOR_DEPTH, gameState->framebuffersColorDepth);
 		InitializeFramebuffers(NUM_FRAMEBUFFERS_COLOR, gameState->framebuffersColor);
@@ -906,20 +1025,33 @@ platformFuncs.glFunctions.name;
 			UnloadLevelData(activeLevelData);
 		}
 
-		if (!SetActiveLevel(&gameState->levelState, &gameState->assets, gameState->levelState.activeLevelId,
-                            gameState->levelState.playerCoords, gameState->refPixelsPerUnit, memory->transient)) {
+		if (!SetActiveLevel(&gameState->levelState, &gameState->assets, &gameState->animationSystem,
+                            gameState->levelState.activeLevelId, gameState->levelState.playerCoords, gameState->refPixelsPerUnit, memory->transient)) {
 			DEBUG_PANIC("Failed to reload level %.*s\n",
                         (int)activeLevelName.size, activeLevelName.data);
 		}
+		SetRainTerrain(gameState);
 	}
-	if (FileChangedSinceLastCall(ToString("data/kmkv/animations/kid.kmkv"))
-		|| FileChangedSinceLastCall(ToString("data/psd/kid.psd"))) {
+	// Both need checking every frame, so neither change is missed
+	const bool kidKmkvChanged = FileChangedSinceLastCall(ToString("data/kmkv/animations/kid.kmkv"));
+	const bool kidPsdChanged = FileChangedSinceLastCall(ToString("data/psd/kid.psd"));
+	if (kidKmkvChanged || kidPsdChanged) {
 		LOG_INFO("reloading kid animation sprite\n");
 
         AnimatedSprite* spriteKid = GetAnimatedSprite(&gameState->assets, AnimatedSpriteId::KID);
-		UnloadAnimatedSprite(spriteKid);
-		if (!LoadAnimatedSprite(spriteKid, ToString("kid"), gameState->refPixelsPerUnit, memory->transient)) {
-			DEBUG_PANIC("Failed to reload kid animation sprite\n");
+		int animationIds[SPRITE_MAX_ANIMATIONS];
+		if (!ReloadAnimatedSprite(spriteKid, ToString("kid"), gameState->refPixelsPerUnit, kidPsdChanged,
+                                  KID_ANIMATION_NAMES, (int)KidAnimation::COUNT, memory->transient, animationIds)) {
+			// The old sprite is still there, so keep playing it until the files are fixed
+			LOG_ERROR("Failed to reload kid animation sprite\n");
+		}
+		else {
+			// Can't fail, the reload already checked for every kid animation
+			if (!LoadKidAnimationIds(gameState)) {
+				DEBUG_PANIC("Failed to reload kid animation ids\n");
+			}
+			RemapAnimationInstances(&gameState->animationSystem, gameState->assets, AnimatedSpriteId::KID,
+                                    animationIds);
 		}
 	}
 
@@ -933,6 +1065,9 @@ platformFuncs.glFunctions.name;
 #endif
 
 	UpdateWorld(gameState, deltaTime, input, memory->transient);
+	if (gameState->levelState.activeLevelId == RAIN_LEVEL) {
+		UpdateParticleSystem(gameState->rain, deltaTime, nullptr, gameState->jobSystem);
+	}
 
 	// ---------------------------- Begin Rendering ---------------------------
 	glEnable(GL_DEPTH_TEST);
@@ -950,8 +1085,15 @@ platformFuncs.glFunctions.name;
 
 	DEBUG_ASSERT(memory->transient.size >= sizeof(SpriteDataGL));
 	SpriteDataGL* spriteDataGL = (SpriteDataGL*)memory->transient.memory;
+	MemoryBlock drawTransient;
+	drawTransient.size = memory->transient.size - sizeof(SpriteDataGL);
+	drawTransient.memory = (uint8*)memory->transient.memory + sizeof(SpriteDataGL);
 
-	DrawWorld(gameState, spriteDataGL, projection, screenInfo);
+	Vec2 playerPos;
+	Quat playerRot;
+	GetPlayerTransform(gameState, &playerPos, &playerRot);
+	UpdateAnimationTransforms(gameState, screenInfo, playerPos, playerRot);
+	DrawWorld(gameState, spriteDataGL, projection, playerPos, playerRot, drawTransient);
 
     if (!gameState->kmKey) {
         // Draw border
@@ -1095,7 +1237,9 @@ platformFuncs.glFunctions.name;
 		panelDebug.Text(string::empty);
 
 		panelDebug.Text(AllocPrintf(&tempAllocator, "%d - STATE", levelState->playerState));
-		const HashKey& kidActiveAnimKey = levelState->kid.activeAnimationKey;
+		const AnimatedSprite* kidSprite = GetAnimatedSprite(gameState->assets, AnimatedSpriteId::KID);
+		const int kidActiveAnim = GetActiveAnimation(gameState->animationSystem, levelState->kid);
+		const HashKey& kidActiveAnimKey = kidSprite->animationNames[kidActiveAnim];
 		panelDebug.Text(AllocPrintf(&tempAllocator, "%.*s -- ANIM",
                                     (int)kidActiveAnimKey.s.size, kidActiveAnimKey.s.data));
 
@@ -1199,12 +1343,31 @@ platformFuncs.glFunctions.name;
 				const float32 FLOOR_HEIGHT_STEP = 0.5f;
 				const float32 FLOOR_NORMAL_LENGTH = FLOOR_HEIGHT_STEP;
 				const float32 FLOOR_LENGTH = floor.length;
+
+				// Query the floor once for all steps, the same samples are reused for every height.
+				// Scratch memory goes after lineData, which lives at the start of transient memory.
+				uint64 numSteps = 0;
+				for (float32 floorX = 0.0f; floorX < FLOOR_LENGTH; floorX += FLOOR_SMOOTH_STEPS) {
+					numSteps++;
+				}
+				LinearAllocator floorAllocator(memory->transient.size - sizeof(LineGLData),
+                                               (uint8*)memory->transient.memory + sizeof(LineGLData));
+				float32* stepCoordX = (float32*)floorAllocator.Allocate(numSteps * sizeof(float32));
+				Vec2* stepPos = (Vec2*)floorAllocator.Allocate(numSteps * sizeof(Vec2));
+				Vec2* stepNormal = (Vec2*)floorAllocator.Allocate(numSteps * sizeof(Vec2));
+				DEBUG_ASSERT(stepCoordX != nullptr && stepPos != nullptr && stepNormal != nullptr);
+				uint64 step = 0;
+				for (float32 floorX = 0.0f; floorX < FLOOR_LENGTH; floorX += FLOOR_SMOOTH_STEPS) {
+					stepCoordX[step++] = floorX;
+				}
+				floor.GetInfoFromCoordXBatch(stepCoordX, numSteps, stepPos, stepNormal);
+
 				for (int i = 0; i < FLOOR_HEIGHT_NUM_STEPS; i++) {
 					float32 height = i * FLOOR_HEIGHT_STEP;
 					lineData->count = 0;
-					for (float32 floorX = 0.0f; floorX < FLOOR_LENGTH; floorX += FLOOR_SMOOTH_STEPS) {
-						Vec2 fPos, fNormal;
-						floor.GetInfoFromCoordX(floorX, &fPos, &fNormal);
+					for (uint64 j = 0; j < numSteps; j++) {
+						Vec2 fPos = stepPos[j];
+						Vec2 fNormal = stepNormal[j];
 						Vec2 pos = fPos + fNormal * height;
 						lineData->pos[lineData->count++] = ToVec3(pos, 0.0f);
 						lineData->pos[lineData->count++] = ToVec3(
@@ -1244,8 +1407,14 @@ platformFuncs.glFunctions.name;
 					lineData->pos[3] = lineData->pos[0];
 					lineData->pos[3].y += range.y * 2.0f;
 					lineData->pos[4] = lineData->pos[0];
+					float32 cornerCoordX[5];
+					Vec2 cornerFloorPos[5], cornerFloorNormal[5];
 					for (int p = 0; p < 5; p++) {
-						Vec2 worldPos = floor.GetWorldPosFromCoords(ToVec2(lineData->pos[p]));
+						cornerCoordX[p] = lineData->pos[p].x;
+					}
+					floor.GetInfoFromCoordXBatch(cornerCoordX, 5, cornerFloorPos, cornerFloorNormal);
+					for (int p = 0; p < 5; p++) {
+						Vec2 worldPos = cornerFloorPos[p] + cornerFloorNormal[p] * lineData->pos[p].y;
 						lineData->pos[p] = ToVec3(worldPos, 0.0f);
 					}
 					DrawLine(gameState->lineGL, viewProjection, lineData, levelTransitionColor);
@@ -1258,18 +1427,14 @@ platformFuncs.glFunctions.name;
 				if (levelData->bounded) {
 					lineData->count = 2;
 
-					Vec2 boundLeftPos, boundLeftNormal;
-					floor.GetInfoFromCoordX(levelData->bounds.x, &boundLeftPos, &boundLeftNormal);
-					Vec2 boundLeft = floor.GetWorldPosFromCoords(Vec2 { levelData->bounds.x, 0.0f });
-					lineData->pos[0] = ToVec3(boundLeftPos, 0.0f);
-					lineData->pos[1] = ToVec3(boundLeftPos + boundLeftNormal * screenHeightUnits, 0.0f);
-					DrawLine(gameState->lineGL, viewProjection, lineData, boundsColor);
-
-					Vec2 boundRightPos, boundRightNormal;
-					floor.GetInfoFromCoordX(levelData->bounds.y, &boundRightPos, &boundRightNormal);
-					lineData->pos[0] = ToVec3(boundRightPos, 0.0f);
-					lineData->pos[1] = ToVec3(boundRightPos + boundRightNormal * screenHeightUnits, 0.0f);
-					DrawLine(gameState->lineGL, viewProjection, lineData, boundsColor);
+					const float32 boundsCoordX[2] = { levelData->bounds.x, levelData->bounds.y };
+					Vec2 boundPos[2], boundNormal[2];
+					floor.GetInfoFromCoordXBatch(boundsCoordX, 2, boundPos, boundNormal);
+					for (int b = 0; b < 2; b++) {
+						lineData->pos[0] = ToVec3(boundPos[b], 0.0f);
+						lineData->pos[1] = ToVec3(boundPos[b] + boundNormal[b] * screenHeightUnits, 0.0f);
+						DrawLine(gameState->lineGL, viewProjection, lineData, boundsColor);
+					}
 				}
 			}
 
@@ -1293,7 +1458,7 @@ platformFuncs.glFunctions.name;
         alphabetAtlas = false;
     }
     if (alphabetAtlas) {
-        AlphabetAtlasUpdateAndRender(&gameState->assets.alphabet, input, memory->transient,
+        AlphabetAtlasUpdateAndRender(&gameState->assets.alphabet, &gameState->random, input, memory->transient,
                                      gameState->rectGL, gameState->texturedRectGL, gameState->textGL,
                                      screenInfo, gameState->assets.fontFaceSmall, gameState->assets.fontFaceMedium);
     }
@@ -1301,7 +1466,8 @@ platformFuncs.glFunctions.name;
         LevelState* levelState = &gameState->levelState;
         LinearAllocator tempAllocator(memory->transient.size, memory->transient.memory);
 
-        FloorCollider* floor = &(GetLevelData(&gameState->assets, levelState->activeLevelId)->floor);
+        LevelData* levelData = GetLevelData(&gameState->assets, levelState->activeLevelId);
+        FloorCollider* floor = &levelData->floor;
 
         const FontFace& fontMedium = gameState->assets.fontFaceMedium;
         const FontFace& fontSmall = gameState->assets.fontFaceSmall;
@@ -1394,16 +1560,26 @@ platformFuncs.glFunctions.name;
                 if (gameState->floorVertexSelected == -1) {
                     levelState->cameraPos -= mouseWorldDelta;
                 }
-                else {
+                else if (input.mouseDelta.x != 0 || input.mouseDelta.y != 0) {
                     floor->line[gameState->floorVertexSelected] += mouseWorldDelta;
-                    floor->PrecomputeSampleVerticesFromLine();
+                    floor->PrecomputeSampleVerticesFromVertexMove(gameState->floorVertexSelected);
+                    // The height tables would be stale until the drag ends, so fall back to raycasts meanwhile
+                    ClearLineColliderHeights(levelData);
                 }
             }
+            else if (input.mouseButtons[0].transitions > 0 && gameState->floorVertexSelected != -1) {
+                // Vertex drag ended, clean up the approximations from incremental sample updates
+                floor->PrecomputeSampleVerticesFromLine();
+                PrecomputeLineColliderHeights(levelData);
+                SetRainTerrain(gameState);
+            }
 
             if (gameState->floorVertexSelected != -1) {
                 if (WasKeyPressed(input, KM_KEY_R)) {
                     floor->line.Remove(gameState->floorVertexSelected);
                     floor->PrecomputeSampleVerticesFromLine();
+                    PrecomputeLineColliderHeights(levelData);
+                    SetRainTerrain(gameState);
                     gameState->floorVertexSelected = -1;
                 }
             }
@@ -1418,6 +1594,8 @@ platformFuncs.glFunctions.name;
                     gameState->floorVertexSelected += 1;
                 }
                 floor->PrecomputeSampleVerticesFromLine();
+                PrecomputeLineColliderHeights(levelData);
+                SetRainTerrain(gameState);
             }
         }
         else {
@@ -1448,19 +1626,26 @@ platformFuncs.glFunctions.name;
 }
 
 #include "alphabet.cpp"
+#include "animation.cpp"
 #include "asset.cpp"
 #include "asset_animation.cpp"
 #include "asset_audio.cpp"
 #include "asset_level.cpp"
 #include "asset_texture.cpp"
 #include "audio.cpp"
+#include "audio_bus.cpp"
+#include "audio_mixer.cpp"
+#include "audio_resample.cpp"
 #include "collision.cpp"
 #include "framebuffer.cpp"
 #include "imgui.cpp"
+#include "jobs.cpp"
 #include "load_psd.cpp"
 #include "opengl_base.cpp"
 #include "particles.cpp"
+#include "physics.cpp"
 #include "post.cpp"
+#include "random.cpp"
 #include "render.cpp"
 #include "text.cpp"
 
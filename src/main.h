@@ -5,6 +5,7 @@
 #include <km_common/km_math.h>
 
 #include "alphabet.h"
+#include "animation.h"
 #include "asset.h"
 #include "asset_animation.h"
 #include "asset_level.h"
@@ -14,6 +15,9 @@
 #include "framebuffer.h"
 #include "opengl.h"
 #include "opengl_base.h"
+#include "particles.h"
+#include "physics.h"
+#include "random.h"
 #include "text.h"
 
 const uint64 NUM_FRAMEBUFFERS_COLOR_DEPTH = 1;
@@ -31,7 +35,7 @@ enum class PlayerState
 
 struct Rock
 {
-    Vec2 coords;
+    uint64 body; // index into GameState::physicsWorld
     float32 angle;
 };
 
@@ -49,16 +53,6 @@ struct LiftedObjectInfo
     float32 coordYPrev;
 };
 
-struct AnimatedSpriteInstance
-{
-    AnimatedSpriteId animatedSpriteId;
-
-    HashKey activeAnimationKey;
-    int activeFrame;
-    int activeFrameRepeat;
-    float32 activeFrameTime;
-};
-
 struct LevelState
 {
     LevelId activeLevelId;
@@ -77,21 +71,40 @@ struct LevelState
     bool playerJumpHolding;
     float32 playerJumpHold;
 
-    AnimatedSpriteInstance kid;
+    int kid; // animation instance
 
     GrabbedObjectInfo grabbedObject;
     LiftedObjectInfo liftedObject;
 };
 
+enum class KidAnimation
+{
+    IDLE,
+    WALK,
+    JUMP,
+    FALL,
+    LAND,
+
+    COUNT
+};
+
 struct GameState
 {
     GameAssets assets;
 
     AudioState audioState;
 
-    AnimatedSpriteInstance paper;
+    AnimationSystem animationSystem;
+    int paper; // animation instance
+    int kidAnimations[(int)KidAnimation::COUNT]; // animation ids in the kid sprite
+    RandomState random;
+    PhysicsWorld physicsWorld;
     Rock rock;
 
+    JobSystem jobSystem;
+    ParticlePool particlePool;
+    ParticleSystem* rain;
+
     float32 aspectRatio;
     int refPixelScreenHeight;
     float32 refPixelsPerUnit;
@@ -112,6 +125,7 @@ struct GameState
     TexturedRectGL texturedRectGL;
     LineGL lineGL;
     TextGL textGL;
+    ParticleSystemGL particleSystemGL;
 
     Framebuffer framebuffersColorDepth[NUM_FRAMEBUFFERS_COLOR_DEPTH];
     Framebuffer framebuffersColor[NUM_FRAMEBUFFERS_COLOR];
@@ -123,8 +137,6 @@ struct GameState
 };
 
 Vec2Int GetBorderSize(ScreenInfo screenInfo, float32 targetAspectRatio, float32 minBorderFrac);
+// Offset from fromCoords to toCoords in floor coordinates, going whichever way around the floor is shorter
+Vec2 WrappedWorldOffset(Vec2 fromCoords, Vec2 toCoords, float32 floorLength);
 
-Vec2 UpdateAnimatedSprite(AnimatedSpriteInstance* sprite, const GameAssets& assets, float32 deltaTime,
-                          const Array<HashKey>& nextAnimations);
-void DrawAnimatedSprite(const AnimatedSpriteInstance& sprite, const GameAssets& assets, SpriteDataGL* spriteDataGL,
-                        Vec2 pos, Vec2 size, Vec2 anchor, Quat rot, float32 alpha, bool flipHorizontal);
@@ -23,6 +23,7 @@
 #define GL_UNSIGNED_INT             0x1405
 #define GL_FLOAT                    0x1406
 #define GL_DOUBLE                   0x140A
+#define GL_HALF_FLOAT               0x140B
 
 #define GL_POINTS                   0x0000
 #define GL_LINES                    0x0001
@@ -309,6 +310,7 @@ FUNC(void,  glGenTextures, GLsizei n, GLuint* textures) \
 FUNC(void,  glDeleteTextures, GLsizei n, const GLuint* textures) \
 FUNC(void,  glTexParameteri, GLenum target, GLenum pname, GLint param) \
 FUNC(void,  glTexImage2D, GLenum target, GLint level, GLint internalFormat, GLsizei width, GLsizei height, GLint border, GLenum format, GLenum type, const GLvoid* data) \
+FUNC(void,  glTexSubImage2D, GLenum target, GLint level, GLint xoffset, GLint yoffset, GLsizei width, GLsizei height, GLenum format, GLenum type, const GLvoid* data) \
 FUNC(void,  glPixelStorei, GLenum pname, GLint param) \
 \
 FUNC(void,  glDrawArrays, GLenum mode, GLint first, GLsizei count) \
@@ -1,7 +1,12 @@
 #include "particles.h"
 
+#include <emmintrin.h>
 #include <km_common/km_debug.h>
-#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#undef internal
+#include <chrono>
+#define internal static
 
 #include "opengl_base.h"
 #include "opengl_funcs.h"
@@ -9,11 +14,35 @@
 #define PARTICLE_EPS 0.0001f
 #define BOUNCE_MARGIN 0.001f
 
-struct ParticleSystemDataGL
+// Particles are updated in fixed-size chunks, one job per chunk
+#define PARTICLE_CHUNK_SIZE 4096
+#define PARTICLE_CHUNKS_MAX ((MAX_PARTICLES + PARTICLE_CHUNK_SIZE - 1) / PARTICLE_CHUNK_SIZE)
+// Below this many active particles the whole update runs on the calling thread. Waking the job threads
+// costs more than a single chunk's work, and it would count against the system's update budget.
+#define PARTICLE_JOBS_MIN_PARTICLES (2 * PARTICLE_CHUNK_SIZE)
+// Number of per-particle arrays in ParticleSystem
+#define PARTICLE_FIELDS 12
+// Spawn init randoms are generated this many particles at a time
+#define PARTICLE_SPAWN_BATCH 64
+// Weight of the latest update time in the smoothed time compared against the budget
+#define PARTICLE_BUDGET_SMOOTHING 0.1f
+#define PARTICLE_EMISSION_SCALE_MIN 0.05f
+
+static_assert(PARTICLE_CHUNK_SIZE % 4 == 0, "particle chunks must start on a 4-particle boundary");
+
+// Bytes of pool storage per particle, over all the per-particle arrays
+#define PARTICLE_BYTES (7 * sizeof(float32) + sizeof(Vec3) + sizeof(float32) + sizeof(Vec2) \
+                        + 2 * sizeof(float32))
+#define PARTICLE_POOL_BLOCK_BYTES (PARTICLE_POOL_BLOCK_PARTICLES * PARTICLE_BYTES)
+
+static_assert(PARTICLE_POOL_BLOCK_PARTICLES % 4 == 0, "pool blocks must hold whole 4-particle groups");
+
+// 20 bytes per particle, down from 36 for separate float pos, color and size arrays
+struct ParticleInstanceGL
 {
-	Vec3 pos[MAX_PARTICLES];
-	Vec4 color[MAX_PARTICLES];
-	Vec2 size[MAX_PARTICLES];
+	Vec3 pos;
+	uint8 color[4]; // RGBA, normalized
+	uint16 size[2]; // half floats
 };
 
 template <typename Allocator>
@@ -65,9 +94,10 @@ ParticleSystemGL InitParticleSystemGL(Allocator* allocator)
                           );
 	glVertexAttribDivisor(1, 0);
     
-	glGenBuffers(1, &psGL.posBuffer);
-	glBindBuffer(GL_ARRAY_BUFFER, psGL.posBuffer);
-	glBufferData(GL_ARRAY_BUFFER, MAX_PARTICLES * sizeof(Vec3), NULL,
+	// Per-particle data, interleaved in one instance buffer
+	glGenBuffers(1, &psGL.instanceBuffer);
+	glBindBuffer(GL_ARRAY_BUFFER, psGL.instanceBuffer);
+	glBufferData(GL_ARRAY_BUFFER, MAX_PARTICLES * sizeof(ParticleInstanceGL), NULL,
                  GL_STREAM_DRAW);
 	glEnableVertexAttribArray(2);
 	glVertexAttribPointer(
@@ -75,38 +105,28 @@ ParticleSystemGL InitParticleSystemGL(Allocator* allocator)
                           3, // size (vec3)
                           GL_FLOAT, // type
                           GL_FALSE, // normalized?
-                          0, // stride
-                          (void*)0 // array buffer offset
+                          sizeof(ParticleInstanceGL), // stride
+                          (void*)offsetof(ParticleInstanceGL, pos) // array buffer offset
                           );
 	glVertexAttribDivisor(2, 1);
-    
-	glGenBuffers(1, &psGL.colorBuffer);
-	glBindBuffer(GL_ARRAY_BUFFER, psGL.colorBuffer);
-	glBufferData(GL_ARRAY_BUFFER, MAX_PARTICLES * sizeof(Vec4), NULL,
-                 GL_STREAM_DRAW);
 	glEnableVertexAttribArray(3);
 	glVertexAttribPointer(
                           3, // match shader layout location
                           4, // size (vec4)
-                          GL_FLOAT, // type
-                          GL_FALSE, // normalized?
-                          0, // stride
-                          (void*)0 // array buffer offset
+                          GL_UNSIGNED_BYTE, // type
+                          GL_TRUE, // normalized?
+                          sizeof(ParticleInstanceGL), // stride
+                          (void*)offsetof(ParticleInstanceGL, color) // array buffer offset
                           );
 	glVertexAttribDivisor(3, 1);
-    
-	glGenBuffers(1, &psGL.sizeBuffer);
-	glBindBuffer(GL_ARRAY_BUFFER, psGL.sizeBuffer);
-	glBufferData(GL_ARRAY_BUFFER, MAX_PARTICLES * sizeof(Vec2), NULL,
-                 GL_STREAM_DRAW);
 	glEnableVertexAttribArray(4);
 	glVertexAttribPointer(
                           4, // match shader layout location
                           2, // size (vec2)
-                          GL_FLOAT, // type
+                          GL_HALF_FLOAT, // type
                           GL_FALSE, // normalized?
-                          0, // stride
-                          (void*)0 // array buffer offset
+                          sizeof(ParticleInstanceGL), // stride
+                          (void*)offsetof(ParticleInstanceGL, size) // array buffer offset
                           );
 	glVertexAttribDivisor(4, 1);
     
@@ -117,7 +137,65 @@ ParticleSystemGL InitParticleSystemGL(Allocator* allocator)
 	return psGL;
 }
 
-void CreateParticleSystem(ParticleSystem* ps, int maxParticles,
+bool InitParticlePool(ParticlePool* pool, MemoryBlock memory)
+{
+	for (int i = 0; i < PARTICLE_SYSTEMS_MAX; i++) {
+		pool->systemUsed[i] = false;
+	}
+
+	uint64 numBlocks = memory.size / PARTICLE_POOL_BLOCK_BYTES;
+	if (numBlocks == 0) {
+		LOG_ERROR("Not enough memory for any particle pool blocks (%llu bytes)\n", memory.size);
+		return false;
+	}
+	if (numBlocks > PARTICLE_POOL_BLOCKS_MAX) {
+		numBlocks = PARTICLE_POOL_BLOCKS_MAX;
+	}
+	pool->numBlocks = (uint32)numBlocks;
+	for (uint32 i = 0; i < pool->numBlocks; i++) {
+		pool->blockUsed[i] = false;
+	}
+	pool->blockData = (uint8*)memory.memory;
+
+	return true;
+}
+
+// First fit search for numBlocks contiguous free blocks. Returns pool->numBlocks if there are none.
+internal uint32 FindFreeParticlePoolBlocks(const ParticlePool* pool, uint32 numBlocks)
+{
+	uint32 runStart = 0;
+	for (uint32 i = 0; i < pool->numBlocks; i++) {
+		if (pool->blockUsed[i]) {
+			runStart = i + 1;
+		}
+		else if (i + 1 - runStart == numBlocks) {
+			return runStart;
+		}
+	}
+
+	return pool->numBlocks;
+}
+
+// Lays out the per-particle arrays back to back in the system's pool blocks
+internal void AssignParticleArrays(ParticleSystem* ps, uint8* data)
+{
+	const uint64 capacity = ps->poolBlockCount * PARTICLE_POOL_BLOCK_PARTICLES;
+	ps->life = (float32*)data;
+	ps->posX = ps->life + capacity;
+	ps->posY = ps->posX + capacity;
+	ps->posZ = ps->posY + capacity;
+	ps->velX = ps->posZ + capacity;
+	ps->velY = ps->velX + capacity;
+	ps->velZ = ps->velY + capacity;
+	ps->color = (Vec3*)(ps->velZ + capacity);
+	ps->alpha = (float32*)(ps->color + capacity);
+	ps->size = (Vec2*)(ps->alpha + capacity);
+	ps->bounceMult = (float32*)(ps->size + capacity);
+	ps->frictionMult = ps->bounceMult + capacity;
+	DEBUG_ASSERT((uint8*)(ps->frictionMult + capacity) == data + capacity * PARTICLE_BYTES);
+}
+
+ParticleSystem* CreateParticleSystem(ParticlePool* pool, int maxParticles,
                           int particlesPerSec, float32 maxLife, Vec3 gravity,
                           float32 linearDamp, float32 quadraticDamp,
                           Attractor* attractors, int numAttractors,
@@ -126,10 +204,39 @@ void CreateParticleSystem(ParticleSystem* ps, int maxParticles,
                           SphereCollider* sphereColliders, int numSphereColliders,
                           InitParticleFunction initParticleFunc, GLuint texture)
 {
-	DEBUG_ASSERT(0 <= maxParticles && maxParticles <= MAX_PARTICLES);
+	DEBUG_ASSERT(0 < maxParticles && maxParticles <= MAX_PARTICLES);
+
+	int systemIndex = 0;
+	while (systemIndex < PARTICLE_SYSTEMS_MAX && pool->systemUsed[systemIndex]) {
+		systemIndex++;
+	}
+	if (systemIndex == PARTICLE_SYSTEMS_MAX) {
+		LOG_ERROR("Too many particle systems (max %d)\n", PARTICLE_SYSTEMS_MAX);
+		return nullptr;
+	}
+
+	uint32 numBlocks = (uint32)((maxParticles + PARTICLE_POOL_BLOCK_PARTICLES - 1)
+                                / PARTICLE_POOL_BLOCK_PARTICLES);
+	uint32 blockStart = FindFreeParticlePoolBlocks(pool, numBlocks);
+	if (blockStart == pool->numBlocks) {
+		LOG_ERROR("No room in particle pool for %d particles (%u blocks)\n", maxParticles, numBlocks);
+		return nullptr;
+	}
+	for (uint32 i = blockStart; i < blockStart + numBlocks; i++) {
+		pool->blockUsed[i] = true;
+	}
+	pool->systemUsed[systemIndex] = true;
+
+	ParticleSystem* ps = &pool->systems[systemIndex];
+	ps->poolBlockStart = blockStart;
+	ps->poolBlockCount = numBlocks;
+	AssignParticleArrays(ps, pool->blockData + blockStart * PARTICLE_POOL_BLOCK_BYTES);
     
 	ps->spawnCounter = 0.0f;
 	ps->active = 0;
+	ps->updateBudget = 0.0f;
+	ps->updateTime = 0.0f;
+	ps->emissionScale = 1.0f;
     
 	ps->maxParticles = maxParticles;
 	ps->particlesPerSec = particlesPerSec;
@@ -163,9 +270,87 @@ void CreateParticleSystem(ParticleSystem* ps, int maxParticles,
 	}
 	ps->numSphereColliders = numSphereColliders;
     
+	ps->floor = nullptr;
+	ps->lineColliders = nullptr;
+	ps->numLineColliders = 0;
+	ps->terrainType = COLLIDER_SINK;
+	BuildParticleColliderGrid(ps);
+
 	ps->initParticleFunc = initParticleFunc;
+	SeedRandom(&ps->random, PARTICLE_RANDOM_SEED, systemIndex);
     
 	ps->texture = texture;
+
+	return ps;
+}
+
+void SetParticleSystemBudget(ParticleSystem* ps, float32 updateBudget)
+{
+	DEBUG_ASSERT(updateBudget >= 0.0f);
+	ps->updateBudget = updateBudget;
+	if (updateBudget == 0.0f) {
+		ps->emissionScale = 1.0f;
+	}
+}
+
+void SeedParticleSystem(ParticleSystem* ps, uint64 seed)
+{
+	SeedRandom(&ps->random, seed, 0);
+}
+
+void DestroyParticleSystem(ParticlePool* pool, ParticleSystem* ps)
+{
+	uint64 systemIndex = ps - pool->systems;
+	DEBUG_ASSERT(systemIndex < PARTICLE_SYSTEMS_MAX && pool->systemUsed[systemIndex]);
+
+	for (uint32 i = ps->poolBlockStart; i < ps->poolBlockStart + ps->poolBlockCount; i++) {
+		pool->blockUsed[i] = false;
+	}
+	pool->systemUsed[systemIndex] = false;
+}
+
+
+internal void SpawnParticles(ParticleSystem* ps, int numParticles, void* data)
+{
+	float32 random[PARTICLE_SPAWN_BATCH * PARTICLE_INIT_RANDOMS];
+	for (int batchStart = 0; batchStart < numParticles; batchStart += PARTICLE_SPAWN_BATCH) {
+		const int batchSize = MinInt(numParticles - batchStart, PARTICLE_SPAWN_BATCH);
+		RandFloat32Batch(&ps->random, random, batchSize * PARTICLE_INIT_RANDOMS);
+		for (int i = 0; i < batchSize; i++) {
+			Particle particle;
+			ps->initParticleFunc(ps, &particle, random + i * PARTICLE_INIT_RANDOMS, data);
+
+			int ind = ps->active++;
+			ps->life[ind] = particle.life;
+			ps->posX[ind] = particle.pos.x;
+			ps->posY[ind] = particle.pos.y;
+			ps->posZ[ind] = particle.pos.z;
+			ps->velX[ind] = particle.vel.x;
+			ps->velY[ind] = particle.vel.y;
+			ps->velZ[ind] = particle.vel.z;
+			ps->color[ind] = Vec3 { particle.color.r, particle.color.g, particle.color.b };
+			ps->alpha[ind] = particle.color.a;
+			ps->size[ind] = particle.size;
+			ps->bounceMult[ind] = particle.bounceMult;
+			ps->frictionMult[ind] = particle.frictionMult;
+		}
+	}
+}
+
+internal void CopyParticle(ParticleSystem* ps, int dst, int src)
+{
+	ps->life[dst] = ps->life[src];
+	ps->posX[dst] = ps->posX[src];
+	ps->posY[dst] = ps->posY[src];
+	ps->posZ[dst] = ps->posZ[src];
+	ps->velX[dst] = ps->velX[src];
+	ps->velY[dst] = ps->velY[src];
+	ps->velZ[dst] = ps->velZ[src];
+	ps->color[dst] = ps->color[src];
+	ps->alpha[dst] = ps->alpha[src];
+	ps->size[dst] = ps->size[src];
+	ps->bounceMult[dst] = ps->bounceMult[src];
+	ps->frictionMult[dst] = ps->frictionMult[src];
 }
 
 void ParticleBurst(ParticleSystem* ps, int numParticles, void* data)
@@ -175,24 +360,200 @@ void ParticleBurst(ParticleSystem* ps, int numParticles, void* data)
 	if (ps->active + spawn >= ps->maxParticles) {
 		spawn = ps->maxParticles - ps->active - 1;
 	}
-	for (int i = 0; i < spawn; i++) {
-		int ind = ps->active;
-		ps->initParticleFunc(ps, &ps->particles[ind], data);
-		ps->active++;
+	SpawnParticles(ps, spawn, data);
+}
+
+// Collider bounds are grown by this much when binned, so a particle moving less than this per update
+// can't skip past a collider that only overlaps a neighboring cell
+#define PARTICLE_GRID_MARGIN 0.5f
+#define PARTICLE_GRID_ENTRY_TYPE_SHIFT 14
+#define PARTICLE_GRID_ENTRY_INDEX_MASK ((1 << PARTICLE_GRID_ENTRY_TYPE_SHIFT) - 1)
+
+enum ParticleGridEntryType
+{
+	PARTICLE_GRID_ENTRY_BOX = 0,
+	PARTICLE_GRID_ENTRY_SPHERE,
+	PARTICLE_GRID_ENTRY_LINE
+};
+
+struct ParticleGridRect
+{
+	uint16 entry;
+	Vec2 min;
+	Vec2 max;
+};
+
+internal uint16 ToParticleGridEntry(ParticleGridEntryType type, int index)
+{
+	DEBUG_ASSERT(0 <= index && index <= PARTICLE_GRID_ENTRY_INDEX_MASK);
+	return (uint16)((type << PARTICLE_GRID_ENTRY_TYPE_SHIFT) | index);
+}
+
+// Adds the XY bounds of a line collider's top, in floor coordinates. The span is split in two if it wraps
+// around the end of the floor. Returns false if the collider has no precomputed heights.
+internal bool GetLineColliderGridRects(const LineCollider& lineCollider, const FloorCollider& floor, uint16 entry,
+                                       ParticleGridRect* rects, int* numRects)
+{
+	if (lineCollider.heightSamples.size == 0) {
+		return false;
+	}
+
+	float32 heightMin = 1e6f;
+	float32 heightMax = -1e6f;
+	for (uint64 s = 0; s < lineCollider.heightSamples.size; s++) {
+		float32 height = lineCollider.heightSamples[s];
+		if (height != LINE_COLLIDER_NO_HEIGHT) {
+			heightMin = MinFloat32(heightMin, height);
+			heightMax = MaxFloat32(heightMax, height);
+		}
+	}
+	if (heightMin > heightMax) {
+		// No samples hit the collider, nothing to bin
+		return true;
+	}
+
+	const float32 start = lineCollider.heightCoordXStart;
+	const float32 end = start + (float32)(lineCollider.heightSamples.size - 1) * FLOOR_PRECOMPUTED_STEP_LENGTH;
+	rects[(*numRects)++] = { entry, Vec2 { start, heightMin }, Vec2 { MinFloat32(end, floor.length), heightMax } };
+	if (end > floor.length) {
+		rects[(*numRects)++] = { entry, Vec2 { 0.0f, heightMin }, Vec2 { end - floor.length, heightMax } };
 	}
+	return true;
 }
 
-#if 0
-internal void HandleBounceCollision(Particle* p,
+void BuildParticleColliderGrid(ParticleSystem* ps)
+{
+	ParticleColliderGrid* grid = &ps->colliderGrid;
+	grid->valid = false;
+
+	ParticleGridRect rects[MAX_COLLIDERS * 4];
+	int numRects = 0;
+	for (int c = 0; c < ps->numBoxColliders; c++) {
+		const AxisBoxCollider& box = ps->boxColliders[c];
+		rects[numRects++] = {
+			ToParticleGridEntry(PARTICLE_GRID_ENTRY_BOX, c),
+			Vec2 { box.min.x, box.min.y }, Vec2 { box.max.x, box.max.y }
+		};
+	}
+	for (int c = 0; c < ps->numSphereColliders; c++) {
+		const SphereCollider& sphere = ps->sphereColliders[c];
+		const Vec2 center = { sphere.center.x, sphere.center.y };
+		const Vec2 radius = { sphere.radius, sphere.radius };
+		rects[numRects++] = {
+			ToParticleGridEntry(PARTICLE_GRID_ENTRY_SPHERE, c), center - radius, center + radius
+		};
+	}
+	if (ps->floor != nullptr) {
+		for (int c = 0; c < ps->numLineColliders; c++) {
+			uint16 entry = ToParticleGridEntry(PARTICLE_GRID_ENTRY_LINE, c);
+			if (!GetLineColliderGridRects(ps->lineColliders[c], *ps->floor, entry, rects, &numRects)) {
+				// Can't bound this collider, particles will test all of them
+				return;
+			}
+		}
+	}
+
+	if (numRects == 0) {
+		grid->min = Vec2::zero;
+		grid->invCellSize = Vec2::zero;
+		for (int c = 0; c < C_ARRAY_LENGTH(grid->cellStart); c++) {
+			grid->cellStart[c] = 0;
+		}
+		grid->valid = true;
+		return;
+	}
+
+	const Vec2 margin = { PARTICLE_GRID_MARGIN, PARTICLE_GRID_MARGIN };
+	Vec2 gridMin = rects[0].min - margin;
+	Vec2 gridMax = rects[0].max + margin;
+	for (int r = 0; r < numRects; r++) {
+		rects[r].min -= margin;
+		rects[r].max += margin;
+		gridMin.x = MinFloat32(gridMin.x, rects[r].min.x);
+		gridMin.y = MinFloat32(gridMin.y, rects[r].min.y);
+		gridMax.x = MaxFloat32(gridMax.x, rects[r].max.x);
+		gridMax.y = MaxFloat32(gridMax.y, rects[r].max.y);
+	}
+	grid->min = gridMin;
+	grid->invCellSize = Vec2 {
+		(float32)PARTICLE_GRID_SIZE / (gridMax.x - gridMin.x),
+		(float32)PARTICLE_GRID_SIZE / (gridMax.y - gridMin.y)
+	};
+
+	// Count entries per cell, prefix sum into cell starts, then fill
+	int cellMin[MAX_COLLIDERS * 4][2];
+	int cellMax[MAX_COLLIDERS * 4][2];
+	uint32 counts[PARTICLE_GRID_SIZE * PARTICLE_GRID_SIZE] = {};
+	uint32 totalEntries = 0;
+	for (int r = 0; r < numRects; r++) {
+		for (int e = 0; e < 2; e++) {
+			cellMin[r][e] = ClampInt((int)((rects[r].min.e[e] - gridMin.e[e]) * grid->invCellSize.e[e]),
+                                     0, PARTICLE_GRID_SIZE - 1);
+			cellMax[r][e] = ClampInt((int)((rects[r].max.e[e] - gridMin.e[e]) * grid->invCellSize.e[e]),
+                                     0, PARTICLE_GRID_SIZE - 1);
+		}
+		for (int y = cellMin[r][1]; y <= cellMax[r][1]; y++) {
+			for (int x = cellMin[r][0]; x <= cellMax[r][0]; x++) {
+				counts[y * PARTICLE_GRID_SIZE + x]++;
+			}
+		}
+		totalEntries += (cellMax[r][0] - cellMin[r][0] + 1) * (cellMax[r][1] - cellMin[r][1] + 1);
+	}
+	if (totalEntries > PARTICLE_GRID_ENTRIES_MAX) {
+		LOG_INFO("Particle collider grid needs %u entries (max %d), testing all colliders\n",
+                 totalEntries, PARTICLE_GRID_ENTRIES_MAX);
+		return;
+	}
+
+	uint32 sum = 0;
+	for (int c = 0; c < PARTICLE_GRID_SIZE * PARTICLE_GRID_SIZE; c++) {
+		grid->cellStart[c] = (uint16)sum;
+		sum += counts[c];
+		counts[c] = grid->cellStart[c];
+	}
+	grid->cellStart[PARTICLE_GRID_SIZE * PARTICLE_GRID_SIZE] = (uint16)sum;
+
+	// Rects are in collider order, so each cell lists its colliders in the same order as the full loops
+	for (int r = 0; r < numRects; r++) {
+		for (int y = cellMin[r][1]; y <= cellMax[r][1]; y++) {
+			for (int x = cellMin[r][0]; x <= cellMax[r][0]; x++) {
+				grid->entries[counts[y * PARTICLE_GRID_SIZE + x]++] = rects[r].entry;
+			}
+		}
+	}
+	grid->valid = true;
+}
+
+void SetParticleSystemTerrain(ParticleSystem* ps, const FloorCollider* floor,
+                              const LineCollider* lineColliders, int numLineColliders, ColliderType type)
+{
+	DEBUG_ASSERT(0 <= numLineColliders && numLineColliders <= MAX_COLLIDERS);
+	DEBUG_ASSERT(floor != nullptr || numLineColliders == 0);
+
+	ps->floor = floor;
+	ps->lineColliders = lineColliders;
+	ps->numLineColliders = numLineColliders;
+	ps->terrainType = type;
+	BuildParticleColliderGrid(ps);
+}
+
+// Earliest collision along a particle's movement this update
+struct ParticleHit
+{
+	float32 t; // fraction of the movement, > 1 if nothing was hit
+	Vec3 normal;
+	ColliderType type;
+};
+
+internal void HandleBounceCollision(ParticleSystem* ps, int i, Vec3* pos, Vec3* vel,
                                     Vec3 intersect, Vec3 normal, float32 deltaTime, float32 offset)
 {
-	Vec3 velNormal = Dot(normal, p->vel) * normal;
-	Vec3 velTangent = p->vel - velNormal;
-	p->vel = velTangent * p->frictionMult - velNormal * p->bounceMult;
-	//float32 off = MinFloat32(Mag(p->vel) * deltaTime, offset);
-	p->pos = intersect + normal * offset;
+	Vec3 velNormal = Dot(normal, *vel) * normal;
+	Vec3 velTangent = *vel - velNormal;
+	*vel = velTangent * ps->frictionMult[i] - velNormal * ps->bounceMult[i];
+	//float32 off = MinFloat32(Mag(*vel) * deltaTime, offset);
+	*pos = intersect + normal * offset;
 }
-#endif
 
 internal bool IsInsideBox(Vec3 p, Vec3 boxMin, Vec3 boxMax)
 {
@@ -201,178 +562,381 @@ internal bool IsInsideBox(Vec3 p, Vec3 boxMin, Vec3 boxMax)
 		&& boxMin.z <= p.z && p.z <= boxMax.z;
 }
 
-void UpdateParticleSystem(ParticleSystem* ps, float32 deltaTime, void* data)
+internal void SweepPlaneCollider(const PlaneCollider& plane, Vec3 start, Vec3 dir, ParticleHit* hit)
 {
-	// Update all particle non-position data
-	for (int i = 0; i < ps->active; i++) {
-		ps->particles[i].life += deltaTime;
-        
-		// Damping
-		float32 magVel = Mag(ps->particles[i].vel);
-		Vec3 damp = (ps->linearDamp + ps->quadraticDamp * magVel)
-			* ps->particles[i].vel;
-		// Attractors
-		Vec3 attract = Vec3::zero;
-		for (int a = 0; a < ps->numAttractors; a++) {
-			Vec3 toAttractor = ps->attractors[a].pos - ps->particles[i].pos;
-			float32 distToAttractor = Mag(toAttractor);
-			if (distToAttractor < PARTICLE_EPS) {
-				continue;
-			}
-			toAttractor /= distToAttractor;
-			float32 attractMag = ps->attractors[a].strength / distToAttractor;
-			attract += attractMag * toAttractor;
+	float32 denom = Dot(plane.normal, dir);
+	if (fabs(denom) < PARTICLE_EPS) {
+		// Motion parallel to the plane
+		return;
+	}
+
+	float32 t = Dot(plane.point - start, plane.normal) / denom;
+	if (-PARTICLE_EPS <= t && t < hit->t) {
+		hit->t = t;
+		hit->normal = plane.normal;
+		hit->type = plane.type;
+	}
+}
+
+internal void SweepBoxCollider(const AxisBoxCollider& box, Vec3 start, Vec3 dir, ParticleHit* hit)
+{
+	for (int e = 0; e < 3; e++) {
+		float32 tInt1 = (box.min.e[e] - start.e[e]) / dir.e[e];
+		Vec3 v1 = start + tInt1 * dir;
+		if (IsInsideBox(v1, box.min, box.max) && PARTICLE_EPS < tInt1 && tInt1 < hit->t) {
+			hit->t = tInt1;
+			hit->normal = Vec3::zero;
+			hit->normal.e[e] = -1.1f;
+			hit->type = box.type;
 		}
-		// Velocity update
-		ps->particles[i].vel += (ps->gravity + attract - damp)
-			* deltaTime;
-        
-		// Color update
-		float32 alpha = 1.0f - ps->particles[i].life / ps->maxLife;
-		alpha = alpha * alpha;
-		//alpha = sqrtf(alpha);
-		ps->particles[i].color.a = alpha;
-	}
-	// Update all particle position data
-	for (int i = 0; i < ps->active; i++) {
-#if 0
-		// Plane colliders
-		for (int c = 0; c < ps->numPlaneColliders; c++) {
-			Vec3 pos = ps->particles[i].pos;
-			Vec3 dir = ps->particles[i].vel * deltaTime;
-			Vec3 normal = ps->planeColliders[c].normal;
-			Vec3 point = ps->planeColliders[c].point;
-            
-			float32 denom = Dot(normal, dir);
-			if (fabs(denom) < PARTICLE_EPS) {
-				// Motion parallel to the plane
-				continue;
-			}
-            
-			float32 t = Dot(point - pos, normal) / denom;
-			if (-PARTICLE_EPS <= t && t < 1.0f) {
-				switch (ps->planeColliders[c].type) {
-					case COLLIDER_SINK: {
-						ps->particles[i].life = ps->maxLife + PARTICLE_EPS;
-					} break;
-					case COLLIDER_BOUNCE: {
-						Vec3 intersect = pos + t * dir;
-						HandleBounceCollision(&ps->particles[i],
-                                              intersect, normal, deltaTime, BOUNCE_MARGIN);
-					} break;
-				}
+		float32 tInt2 = (box.max.e[e] - start.e[e]) / dir.e[e];
+		Vec3 v2 = start + tInt2 * dir;
+		if (IsInsideBox(v2, box.min, box.max) && PARTICLE_EPS < tInt2 && tInt2 < hit->t) {
+			hit->t = tInt2;
+			hit->normal = Vec3::zero;
+			hit->normal.e[e] = 1.1f;
+			hit->type = box.type;
+		}
+	}
+}
+
+internal void SweepSphereCollider(const SphereCollider& sphere, Vec3 start, Vec3 dir, ParticleHit* hit)
+{
+	// From Assignment 3, sphere + ray collision
+	float32 dirMagSq = Dot(dir, dir);
+	if (dirMagSq < PARTICLE_EPS * PARTICLE_EPS) {
+		return;
+	}
+	Vec3 toSphere = sphere.center - start;
+	float32 tClosest = Dot(toSphere, dir) / dirMagSq;
+	Vec3 closest = start + dir * tClosest;
+	float32 dist = Mag(closest - sphere.center);
+	if (dist > sphere.radius) {
+		return;
+	}
+
+	// Offset along the ray is in units of dir's length
+	float32 tOffset = sqrtf(sphere.radius * sphere.radius - dist * dist) / sqrtf(dirMagSq);
+	float32 tInt = tClosest - tOffset;
+	if (tInt < PARTICLE_EPS) {
+		tInt = tClosest + tOffset;
+		if (tInt < PARTICLE_EPS) {
+			return;
+		}
+	}
+	if (tInt < hit->t) {
+		hit->t = tInt;
+		hit->normal = Normalize(start + dir * tInt - sphere.center);
+		hit->type = sphere.type;
+	}
+}
+
+// Particles only land on top of line colliders, like the player does
+internal void SweepLineCollider(const LineCollider& lineCollider, const FloorCollider& floor, ColliderType type,
+                                Vec3 start, Vec3 end, ParticleHit* hit)
+{
+	float32 height;
+	if (!GetLineColliderCoordYFromFloorCoordX(lineCollider, floor, end.x, &height)) {
+		return;
+	}
+	if (start.y < height || end.y >= height) {
+		return;
+	}
+
+	float32 t = (start.y - height) / (start.y - end.y);
+	if (t < hit->t) {
+		hit->t = t;
+		hit->normal = Vec3::unitY;
+		hit->type = type;
+	}
+}
+
+internal void SweepGridEntry(const ParticleSystem* ps, uint16 entry, Vec3 start, Vec3 end, Vec3 dir,
+                             ParticleHit* hit)
+{
+	int index = entry & PARTICLE_GRID_ENTRY_INDEX_MASK;
+	switch (entry >> PARTICLE_GRID_ENTRY_TYPE_SHIFT) {
+		case PARTICLE_GRID_ENTRY_BOX: {
+			SweepBoxCollider(ps->boxColliders[index], start, dir, hit);
+		} break;
+		case PARTICLE_GRID_ENTRY_SPHERE: {
+			SweepSphereCollider(ps->sphereColliders[index], start, dir, hit);
+		} break;
+		case PARTICLE_GRID_ENTRY_LINE: {
+			SweepLineCollider(ps->lineColliders[index], *ps->floor, ps->terrainType, start, end, hit);
+		} break;
+	}
+}
+
+internal bool HasParticleColliders(const ParticleSystem* ps)
+{
+	return ps->numPlaneColliders > 0 || ps->numBoxColliders > 0 || ps->numSphereColliders > 0
+		|| ps->floor != nullptr;
+}
+
+// Sweeps particle i over this update's movement, ending at pos, and responds to the earliest collision
+internal void CollideParticle(ParticleSystem* ps, int i, Vec3* pos, Vec3* vel, float32 deltaTime)
+{
+	if (ps->floor != nullptr) {
+		// Keep floor coordinates on the floor loop
+		if (pos->x < 0.0f) {
+			pos->x += ps->floor->length;
+		}
+		else if (pos->x >= ps->floor->length) {
+			pos->x -= ps->floor->length;
+		}
+	}
+
+	const Vec3 end = *pos;
+	const Vec3 dir = *vel * deltaTime;
+	const Vec3 start = end - dir;
+	ParticleHit hit;
+	hit.t = 2.0f;
+
+	for (int c = 0; c < ps->numPlaneColliders; c++) {
+		SweepPlaneCollider(ps->planeColliders[c], start, dir, &hit);
+	}
+
+	const ParticleColliderGrid& grid = ps->colliderGrid;
+	if (grid.valid) {
+		int cellX = (int)floorf((end.x - grid.min.x) * grid.invCellSize.x);
+		int cellY = (int)floorf((end.y - grid.min.y) * grid.invCellSize.y);
+		if (0 <= cellX && cellX < PARTICLE_GRID_SIZE && 0 <= cellY && cellY < PARTICLE_GRID_SIZE) {
+			int cell = cellY * PARTICLE_GRID_SIZE + cellX;
+			for (int e = grid.cellStart[cell]; e < grid.cellStart[cell + 1]; e++) {
+				SweepGridEntry(ps, grid.entries[e], start, end, dir, &hit);
 			}
 		}
-		// Box colliders
+	}
+	else {
 		for (int c = 0; c < ps->numBoxColliders; c++) {
-			Vec3 pos = ps->particles[i].pos;
-			Vec3 dir = ps->particles[i].vel * deltaTime;
-			//Vec3 newPos = pos + dir;
-			Vec3 boxMin = ps->boxColliders[c].min;
-			Vec3 boxMax = ps->boxColliders[c].max;
-			bool32 found = false;
-			float tIntMin = 1e6;
-			Vec3 normal = Vec3::unitX;
-			for (int e = 0; e < 3; e++) {
-				float32 tInt1 = (boxMin.e[e] - pos.e[e])
-					/ dir.e[e];
-				Vec3 v1 = pos + tInt1 * dir;
-				if (IsInsideBox(v1, boxMin, boxMax)
-                    && PARTICLE_EPS < tInt1 && tInt1 < tIntMin) {
-					tIntMin = tInt1;
-					Vec3 n = Vec3::zero;
-					n.e[e] = -1.0f;
-					normal = n;
-					found = true;
-				}
-				float32 tInt2 = (boxMax.e[e] - pos.e[e])
-					/ dir.e[e];
-				Vec3 v2 = pos + tInt2 * dir;
-				if (IsInsideBox(v2, boxMin, boxMax)
-                    && PARTICLE_EPS < tInt2 && tInt2 < tIntMin) {
-					tIntMin = tInt2;
-					Vec3 n = Vec3::zero;
-					n.e[e] = 1.0f;
-					normal = n;
-					found = true;
-				}
-			}
-			if (found && 0.0f <= tIntMin && tIntMin <= 1.0f) {
-				switch (ps->boxColliders[c].type) {
-					case COLLIDER_SINK: {
-						ps->particles[i].life = ps->maxLife + PARTICLE_EPS;
-					} break;
-					case COLLIDER_BOUNCE: {
-						Vec3 intersect = pos + dir * tIntMin;
-						normal *= 1.1f;
-						HandleBounceCollision(&ps->particles[i],
-                                              intersect, normal, deltaTime, BOUNCE_MARGIN);
-					} break;
-				}
-			}
+			SweepBoxCollider(ps->boxColliders[c], start, dir, &hit);
 		}
-		// Sphere colliders
 		for (int c = 0; c < ps->numSphereColliders; c++) {
-			// From Assignment 3, sphere + ray collision
-			Vec3 pos = ps->particles[i].pos;
-			Vec3 dir = ps->particles[i].vel * deltaTime;
-			Vec3 center = ps->sphereColliders[c].center;
-			float32 radius = ps->sphereColliders[c].radius;
-            
-			Vec3 toSphere = center - pos;
-			float32 tClosest = Dot(toSphere, dir);
-			Vec3 closest = pos + dir * tClosest;
-			float32 dist = Mag(closest - center);
-			if (dist > radius) {
-				continue;
-			}
-            
-			switch (ps->sphereColliders[c].type) {
-				case COLLIDER_SINK: {
-					ps->particles[i].life = ps->maxLife + PARTICLE_EPS;
-				} break;
-				case COLLIDER_BOUNCE: {
-					float32 tOffset = sqrtf(radius * radius - dist * dist);
-					float32 tInt = tClosest - tOffset;
-					if (tInt < PARTICLE_EPS) {
-						tInt = tClosest + tOffset;
-						if (tInt < PARTICLE_EPS) {
-							continue;
-						}
-					}
-					Vec3 intersect = pos + dir * tInt;
-					Vec3 normal = Normalize(intersect - center);
-					HandleBounceCollision(&ps->particles[i],
-                                          intersect, normal, deltaTime, BOUNCE_MARGIN);
-				} break;
+			SweepSphereCollider(ps->sphereColliders[c], start, dir, &hit);
+		}
+		for (int c = 0; c < ps->numLineColliders; c++) {
+			SweepLineCollider(ps->lineColliders[c], *ps->floor, ps->terrainType, start, end, &hit);
+		}
+	}
+
+	if (ps->floor != nullptr && end.y < 0.0f) {
+		float32 t = start.y > 0.0f ? start.y / (start.y - end.y) : 0.0f;
+		if (t < hit.t) {
+			hit.t = t;
+			hit.normal = Vec3::unitY;
+			hit.type = ps->terrainType;
+		}
+	}
+
+	if (hit.t > 1.0f) {
+		return;
+	}
+	switch (hit.type) {
+		case COLLIDER_SINK: {
+			ps->life[i] = ps->maxLife + PARTICLE_EPS;
+		} break;
+		case COLLIDER_BOUNCE: {
+			Vec3 intersect = start + dir * hit.t;
+			HandleBounceCollision(ps, i, pos, vel, intersect, hit.normal, deltaTime, BOUNCE_MARGIN);
+		} break;
+	}
+}
+
+// Life, damping, attractors, gravity and position integration for 4 particles per iteration,
+// over [start, end). end is rounded up to a multiple of 4, lanes past the active count are scratch.
+internal void UpdateParticlesSimd(ParticleSystem* ps, int start, int end, float32 deltaTime)
+{
+	const __m128 dt = _mm_set1_ps(deltaTime);
+	const __m128 one = _mm_set1_ps(1.0f);
+	const __m128 eps = _mm_set1_ps(PARTICLE_EPS);
+	const __m128 invMaxLife = _mm_set1_ps(1.0f / ps->maxLife);
+	const __m128 linearDamp = _mm_set1_ps(ps->linearDamp);
+	const __m128 quadraticDamp = _mm_set1_ps(ps->quadraticDamp);
+	const __m128 gravityX = _mm_set1_ps(ps->gravity.x);
+	const __m128 gravityY = _mm_set1_ps(ps->gravity.y);
+	const __m128 gravityZ = _mm_set1_ps(ps->gravity.z);
+
+	DEBUG_ASSERT(start % 4 == 0);
+	const int endRounded = (end + 3) & ~3;
+	for (int i = start; i < endRounded; i += 4) {
+		const __m128 life = _mm_add_ps(_mm_loadu_ps(ps->life + i), dt);
+		__m128 posX = _mm_loadu_ps(ps->posX + i);
+		__m128 posY = _mm_loadu_ps(ps->posY + i);
+		__m128 posZ = _mm_loadu_ps(ps->posZ + i);
+		__m128 velX = _mm_loadu_ps(ps->velX + i);
+		__m128 velY = _mm_loadu_ps(ps->velY + i);
+		__m128 velZ = _mm_loadu_ps(ps->velZ + i);
+
+		// Damping
+		const __m128 magVel = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(velX, velX), _mm_mul_ps(velY, velY)),
+                                                     _mm_mul_ps(velZ, velZ)));
+		const __m128 damp = _mm_add_ps(linearDamp, _mm_mul_ps(quadraticDamp, magVel));
+		__m128 accelX = _mm_sub_ps(gravityX, _mm_mul_ps(damp, velX));
+		__m128 accelY = _mm_sub_ps(gravityY, _mm_mul_ps(damp, velY));
+		__m128 accelZ = _mm_sub_ps(gravityZ, _mm_mul_ps(damp, velZ));
+
+		// Attractors, strength / dist along the normalized direction
+		for (int a = 0; a < ps->numAttractors; a++) {
+			const Attractor& attractor = ps->attractors[a];
+			const __m128 toX = _mm_sub_ps(_mm_set1_ps(attractor.pos.x), posX);
+			const __m128 toY = _mm_sub_ps(_mm_set1_ps(attractor.pos.y), posY);
+			const __m128 toZ = _mm_sub_ps(_mm_set1_ps(attractor.pos.z), posZ);
+			const __m128 distSq = _mm_add_ps(_mm_add_ps(_mm_mul_ps(toX, toX), _mm_mul_ps(toY, toY)),
+                                             _mm_mul_ps(toZ, toZ));
+			const __m128 far = _mm_cmpge_ps(_mm_sqrt_ps(distSq), eps);
+			const __m128 scale = _mm_and_ps(far, _mm_div_ps(_mm_set1_ps(attractor.strength), distSq));
+			accelX = _mm_add_ps(accelX, _mm_mul_ps(scale, toX));
+			accelY = _mm_add_ps(accelY, _mm_mul_ps(scale, toY));
+			accelZ = _mm_add_ps(accelZ, _mm_mul_ps(scale, toZ));
+		}
+
+		velX = _mm_add_ps(velX, _mm_mul_ps(accelX, dt));
+		velY = _mm_add_ps(velY, _mm_mul_ps(accelY, dt));
+		velZ = _mm_add_ps(velZ, _mm_mul_ps(accelZ, dt));
+		posX = _mm_add_ps(posX, _mm_mul_ps(velX, dt));
+		posY = _mm_add_ps(posY, _mm_mul_ps(velY, dt));
+		posZ = _mm_add_ps(posZ, _mm_mul_ps(velZ, dt));
+
+		// Fade out over the particle's life
+		const __m128 alpha = _mm_sub_ps(one, _mm_mul_ps(life, invMaxLife));
+
+		_mm_storeu_ps(ps->life + i, life);
+		_mm_storeu_ps(ps->posX + i, posX);
+		_mm_storeu_ps(ps->posY + i, posY);
+		_mm_storeu_ps(ps->posZ + i, posZ);
+		_mm_storeu_ps(ps->velX + i, velX);
+		_mm_storeu_ps(ps->velY + i, velY);
+		_mm_storeu_ps(ps->velZ + i, velZ);
+		_mm_storeu_ps(ps->alpha + i, _mm_mul_ps(alpha, alpha));
+	}
+}
+
+struct ParticleUpdateJobData
+{
+	ParticleSystem* ps;
+	float32 deltaTime;
+	int numChunks;
+	int chunkActive[PARTICLE_CHUNKS_MAX]; // surviving particles, packed at the start of each chunk
+	int chunkOffset[PARTICLE_CHUNKS_MAX]; // where each chunk's survivors go after compaction
+};
+
+internal void UpdateParticleChunkJob(void* data, int chunk)
+{
+	ParticleUpdateJobData* jobData = (ParticleUpdateJobData*)data;
+	ParticleSystem* ps = jobData->ps;
+	const float32 deltaTime = jobData->deltaTime;
+	const int start = chunk * PARTICLE_CHUNK_SIZE;
+	const int end = MinInt(start + PARTICLE_CHUNK_SIZE, ps->active);
+
+	UpdateParticlesSimd(ps, start, end, deltaTime);
+
+	if (HasParticleColliders(ps)) {
+		for (int i = start; i < end; i++) {
+			Vec3 pos = { ps->posX[i], ps->posY[i], ps->posZ[i] };
+			Vec3 vel = { ps->velX[i], ps->velY[i], ps->velZ[i] };
+			CollideParticle(ps, i, &pos, &vel, deltaTime);
+			ps->posX[i] = pos.x;
+			ps->posY[i] = pos.y;
+			ps->posZ[i] = pos.z;
+			ps->velX[i] = vel.x;
+			ps->velY[i] = vel.y;
+			ps->velZ[i] = vel.z;
+		}
+	}
+
+	// Remove expired particles, keeping the survivors in order
+	int write = start;
+	for (int i = start; i < end; i++) {
+		if (ps->life[i] <= ps->maxLife) {
+			if (write != i) {
+				CopyParticle(ps, write, i);
 			}
+			write++;
 		}
-#endif
-        
-		// Position update
-		ps->particles[i].pos += ps->particles[i].vel * deltaTime;
 	}
-    
-	// Remove expired particles
-	int p = 0;
-	int active = ps->active;
-	while (p < active) {
-		if (ps->particles[p].life > ps->maxLife) {
-			ps->particles[p] = ps->particles[active - 1];
-			active--;
-			continue;
+	jobData->chunkActive[chunk] = write - start;
+}
+
+// Moves each chunk's survivors down to its offset, for a single particle field.
+// Chunks are moved in order, so a chunk's destination only overlaps sources that were already moved.
+internal void MoveParticleFieldJob(void* data, int field)
+{
+	ParticleUpdateJobData* jobData = (ParticleUpdateJobData*)data;
+	ParticleSystem* ps = jobData->ps;
+
+	const struct {
+		void* base;
+		uint64 elementSize;
+	} fields[PARTICLE_FIELDS] = {
+		{ ps->life, sizeof(ps->life[0]) },
+		{ ps->posX, sizeof(ps->posX[0]) },
+		{ ps->posY, sizeof(ps->posY[0]) },
+		{ ps->posZ, sizeof(ps->posZ[0]) },
+		{ ps->velX, sizeof(ps->velX[0]) },
+		{ ps->velY, sizeof(ps->velY[0]) },
+		{ ps->velZ, sizeof(ps->velZ[0]) },
+		{ ps->color, sizeof(ps->color[0]) },
+		{ ps->alpha, sizeof(ps->alpha[0]) },
+		{ ps->size, sizeof(ps->size[0]) },
+		{ ps->bounceMult, sizeof(ps->bounceMult[0]) },
+		{ ps->frictionMult, sizeof(ps->frictionMult[0]) }
+	};
+	uint8* base = (uint8*)fields[field].base;
+	const uint64 elementSize = fields[field].elementSize;
+
+	for (int c = 0; c < jobData->numChunks; c++) {
+		const int start = c * PARTICLE_CHUNK_SIZE;
+		const int offset = jobData->chunkOffset[c];
+		if (offset != start && jobData->chunkActive[c] > 0) {
+			memmove(base + offset * elementSize, base + start * elementSize,
+                    jobData->chunkActive[c] * elementSize);
 		}
-		p++;
+	}
+}
+
+// Smooths the measured update time, then backs emission off while it's over budget
+// and lets it recover once there's some headroom
+internal void UpdateParticleEmissionScale(ParticleSystem* ps, float32 updateTime)
+{
+	ps->updateTime = Lerp(ps->updateTime, updateTime, PARTICLE_BUDGET_SMOOTHING);
+	if (ps->updateTime > ps->updateBudget) {
+		ps->emissionScale = MaxFloat32(ps->emissionScale * 0.9f, PARTICLE_EMISSION_SCALE_MIN);
+	}
+	else if (ps->updateTime < ps->updateBudget * 0.75f) {
+		ps->emissionScale = MinFloat32(ps->emissionScale * 1.05f, 1.0f);
+	}
+}
+
+void UpdateParticleSystem(ParticleSystem* ps, float32 deltaTime, void* data, const JobSystem& jobSystem)
+{
+	const std::chrono::steady_clock::time_point timerStart = std::chrono::steady_clock::now();
+
+	const JobSystem serialJobSystem = CreateJobSystem(1);
+	const JobSystem& jobs = ps->active >= PARTICLE_JOBS_MIN_PARTICLES ? jobSystem : serialJobSystem;
+
+	// Chunks are fixed-size regardless of thread count, so results don't depend on it
+	ParticleUpdateJobData jobData;
+	jobData.ps = ps;
+	jobData.deltaTime = deltaTime;
+	jobData.numChunks = (ps->active + PARTICLE_CHUNK_SIZE - 1) / PARTICLE_CHUNK_SIZE;
+	RunJobs(jobs, jobData.numChunks, UpdateParticleChunkJob, &jobData);
+
+	// Prefix sum of survivor counts gives each chunk's destination
+	int active = 0;
+	for (int c = 0; c < jobData.numChunks; c++) {
+		jobData.chunkOffset[c] = active;
+		active += jobData.chunkActive[c];
+	}
+	// The first chunk's survivors are already in place, so a single chunk never needs moving
+	if (jobData.numChunks > 1 && active != ps->active) {
+		RunJobs(jobs, PARTICLE_FIELDS, MoveParticleFieldJob, &jobData);
 	}
 	ps->active = active;
-    
-	// Spawn new particles
-	ps->spawnCounter += (float32)ps->particlesPerSec * deltaTime;
+
+	// Spawn new particles, scaled down while over the update budget
+	ps->spawnCounter += (float32)ps->particlesPerSec * ps->emissionScale * deltaTime;
 	int spawn = (int)ps->spawnCounter;
-	if (spawn == 0) {
-		// Nothing to spawn yet
-		return;
-	}
 	if (spawn > MAX_SPAWN) {
 		spawn = MAX_SPAWN;
 	}
@@ -380,50 +944,125 @@ void UpdateParticleSystem(ParticleSystem* ps, float32 deltaTime, void* data)
 	if (ps->active + spawn >= ps->maxParticles) {
 		spawn = ps->maxParticles - ps->active - 1;
 	}
-	for (int i = 0; i < spawn; i++) {
-		int ind = ps->active;
-		ps->initParticleFunc(ps, &ps->particles[ind], data);
-		ps->active++;
+	SpawnParticles(ps, spawn, data);
+
+	if (ps->updateBudget > 0.0f) {
+		const std::chrono::duration<float32> elapsed = std::chrono::steady_clock::now() - timerStart;
+		UpdateParticleEmissionScale(ps, elapsed.count());
 	}
 }
 
-internal int DepthComparator(const void* p, const void* q)
+struct ParticleSortKey
 {
-	float32 depthP = ((Particle*)p)->depth;
-	float32 depthQ = ((Particle*)q)->depth;
-	if (depthP > depthQ) {
-		return -1;
-	}
-	else if (depthP < depthQ) {
-		return 1;
+	uint32 key;
+	uint32 index;
+};
+
+// Maps a float to a uint32 with the same ordering, so keys can be radix sorted as integers
+internal uint32 FloatToSortableUInt32(float32 f)
+{
+	union {
+		float32 f;
+		uint32 u;
+	} bits;
+	bits.f = f;
+	uint32 mask = (bits.u & 0x80000000) ? 0xffffffff : 0x80000000;
+	return bits.u ^ mask;
+}
+
+// LSD radix sort on key, 8 bits per pass. Passes where every key has the same digit are skipped.
+// Sorted result ends up in either keys or scratch, and is returned.
+internal ParticleSortKey* RadixSortParticleKeys(ParticleSortKey* keys, ParticleSortKey* scratch, int n)
+{
+	uint32 counts[4][256] = {};
+	for (int i = 0; i < n; i++) {
+		uint32 key = keys[i].key;
+		counts[0][key & 0xff]++;
+		counts[1][(key >> 8) & 0xff]++;
+		counts[2][(key >> 16) & 0xff]++;
+		counts[3][key >> 24]++;
 	}
-	else {
-		return 0;
+
+	ParticleSortKey* src = keys;
+	ParticleSortKey* dst = scratch;
+	for (int pass = 0; pass < 4; pass++) {
+		const uint32 shift = pass * 8;
+		if (n == 0 || counts[pass][(src[0].key >> shift) & 0xff] == (uint32)n) {
+			continue;
+		}
+
+		uint32 offsets[256];
+		uint32 sum = 0;
+		for (int d = 0; d < 256; d++) {
+			offsets[d] = sum;
+			sum += counts[pass][d];
+		}
+		for (int i = 0; i < n; i++) {
+			uint32 digit = (src[i].key >> shift) & 0xff;
+			dst[offsets[digit]++] = src[i];
+		}
+
+		ParticleSortKey* temp = src;
+		src = dst;
+		dst = temp;
 	}
+
+	return src;
 }
 
-void DrawParticleSystem(ParticleSystemGL psGL,
-                        ParticleSystem* ps,
-                        Vec3 camRight, Vec3 camUp, Vec3 camPos, Mat4 proj, Mat4 view,
-                        MemoryBlock transient)
+// Converts to IEEE half precision, rounding to nearest. Values too small for a normal half flush to zero.
+internal uint16 Float32ToFloat16(float32 f)
 {
-	DEBUG_ASSERT(transient.size >= sizeof(ParticleSystemDataGL));
-	ParticleSystemDataGL* dataGL = (ParticleSystemDataGL*)transient.memory;
-	Mat4 vp = proj * view;
-    
-	int active = (int)ps->active;
-	for (int i = 0; i < active; i++) {
-		Vec4 transformed = vp * ToVec4(ps->particles[i].pos, 1.0f);
-		ps->particles[i].depth = transformed.z;
+	union {
+		float32 f;
+		uint32 u;
+	} bits;
+	bits.f = f;
+	const uint32 sign = (bits.u >> 16) & 0x8000;
+	const uint32 absBits = bits.u & 0x7fffffff;
+	if (absBits >= 0x7f800000) {
+		// Inf or NaN
+		return (uint16)(sign | 0x7c00 | (absBits > 0x7f800000 ? 0x200 : 0));
 	}
-	qsort((void*)ps->particles, active, sizeof(Particle),
-          DepthComparator);
-	for (int i = 0; i < active; i++) {
-		dataGL->pos[i] = ps->particles[i].pos;
-		dataGL->color[i] = ps->particles[i].color;
-		dataGL->size[i] = ps->particles[i].size;
+	if (absBits >= 0x477ff000) {
+		// Rounds past the largest half, 65504
+		return (uint16)(sign | 0x7c00);
 	}
-    
+	if (absBits < 0x38800000) {
+		return (uint16)sign;
+	}
+	// Rebias the exponent from 127 to 15 and round the mantissa from 23 to 10 bits
+	return (uint16)(sign | ((absBits - 0x38000000 + 0x1000) >> 13));
+}
+
+internal uint8 UnitFloatToUInt8(float32 f)
+{
+	return (uint8)(ClampFloat32(f, 0.0f, 1.0f) * 255.0f + 0.5f);
+}
+
+uint64 GetParticleSystemDrawMemorySize(int numParticles)
+{
+	// 3D draws sort keys, 2D draws floor queries
+	const uint64 sortSize = 2 * sizeof(ParticleSortKey);
+	const uint64 floorQuerySize = sizeof(float32) + 2 * sizeof(Vec2);
+	return numParticles * (sizeof(ParticleInstanceGL) + (sortSize > floorQuerySize ? sortSize : floorQuerySize));
+}
+
+internal void PackParticleInstance(const ParticleSystem* ps, uint32 ind, Vec3 pos, ParticleInstanceGL* instance)
+{
+	instance->pos = pos;
+	instance->color[0] = UnitFloatToUInt8(ps->color[ind].r);
+	instance->color[1] = UnitFloatToUInt8(ps->color[ind].g);
+	instance->color[2] = UnitFloatToUInt8(ps->color[ind].b);
+	instance->color[3] = UnitFloatToUInt8(ps->alpha[ind]);
+	instance->size[0] = Float32ToFloat16(ps->size[ind].x);
+	instance->size[1] = Float32ToFloat16(ps->size[ind].y);
+}
+
+internal void DrawParticleInstances(ParticleSystemGL psGL, const ParticleSystem* ps,
+                                    const ParticleInstanceGL* instances, int numInstances,
+                                    Vec3 camRight, Vec3 camUp, Mat4 vp)
+{
 	GLint loc;
 	glUseProgram(psGL.programID);
     
@@ -442,25 +1081,68 @@ void DrawParticleSystem(ParticleSystemGL psGL,
 	loc = glGetUniformLocation(psGL.programID, "vp");
 	glUniformMatrix4fv(loc, 1, GL_FALSE, &vp.e[0][0]);
     
-	glBindBuffer(GL_ARRAY_BUFFER, psGL.posBuffer);
+	glBindBuffer(GL_ARRAY_BUFFER, psGL.instanceBuffer);
 	// Buffer orphaning, a common way to improve streaming perf.
 	// See http://www.opengl.org/wiki/Buffer_Object_Streaming
-	glBufferData(GL_ARRAY_BUFFER, MAX_PARTICLES * sizeof(Vec3), NULL,
-                 GL_STREAM_DRAW);
-	glBufferSubData(GL_ARRAY_BUFFER, 0, active * sizeof(Vec3),
-                    dataGL->pos);
-	glBindBuffer(GL_ARRAY_BUFFER, psGL.colorBuffer);
-	glBufferData(GL_ARRAY_BUFFER, MAX_PARTICLES * sizeof(Vec4), NULL,
-                 GL_STREAM_DRAW);
-	glBufferSubData(GL_ARRAY_BUFFER, 0, active * sizeof(Vec4),
-                    dataGL->color);
-	glBindBuffer(GL_ARRAY_BUFFER, psGL.sizeBuffer);
-	glBufferData(GL_ARRAY_BUFFER, MAX_PARTICLES * sizeof(Vec2), NULL,
+	glBufferData(GL_ARRAY_BUFFER, ps->maxParticles * sizeof(ParticleInstanceGL), NULL,
                  GL_STREAM_DRAW);
-	glBufferSubData(GL_ARRAY_BUFFER, 0, active * sizeof(Vec2),
-                    dataGL->size);
+	glBufferSubData(GL_ARRAY_BUFFER, 0, numInstances * sizeof(ParticleInstanceGL), instances);
     
 	glBindVertexArray(psGL.vertexArray);
-	glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, active);
+	glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, numInstances);
 	glBindVertexArray(0);
-}
\ No newline at end of file
+}
+
+void DrawParticleSystem(ParticleSystemGL psGL,
+                        ParticleSystem* ps,
+                        Vec3 camRight, Vec3 camUp, Vec3 camPos, Mat4 proj, Mat4 view,
+                        MemoryBlock transient)
+{
+	DEBUG_ASSERT(ps->floor == nullptr);
+	const int active = ps->active;
+	DEBUG_ASSERT(transient.size >= GetParticleSystemDrawMemorySize(active));
+	ParticleInstanceGL* instances = (ParticleInstanceGL*)transient.memory;
+	ParticleSortKey* sortKeys = (ParticleSortKey*)(instances + active);
+	ParticleSortKey* sortScratch = sortKeys + active;
+	Mat4 vp = proj * view;
+
+	// Only the clip-space z row of vp is needed for depth. Keys are inverted to draw far particles first.
+	const Vec4 depthRow = { vp.e[0][2], vp.e[1][2], vp.e[2][2], vp.e[3][2] };
+	for (int i = 0; i < active; i++) {
+		float32 depth = depthRow.x * ps->posX[i] + depthRow.y * ps->posY[i] + depthRow.z * ps->posZ[i]
+			+ depthRow.w;
+		sortKeys[i].key = ~FloatToSortableUInt32(depth);
+		sortKeys[i].index = (uint32)i;
+	}
+	const ParticleSortKey* sorted = RadixSortParticleKeys(sortKeys, sortScratch, active);
+	for (int i = 0; i < active; i++) {
+		uint32 ind = sorted[i].index;
+		PackParticleInstance(ps, ind, Vec3 { ps->posX[ind], ps->posY[ind], ps->posZ[ind] }, &instances[i]);
+	}
+
+	DrawParticleInstances(psGL, ps, instances, active, camRight, camUp, vp);
+}
+
+void DrawParticleSystem2D(ParticleSystemGL psGL, ParticleSystem* ps,
+                          Vec3 camRight, Vec3 camUp, Mat4 transform, MemoryBlock transient)
+{
+	DEBUG_ASSERT(ps->floor != nullptr);
+	const int active = ps->active;
+	DEBUG_ASSERT(transient.size >= GetParticleSystemDrawMemorySize(active));
+	ParticleInstanceGL* instances = (ParticleInstanceGL*)transient.memory;
+	Vec2* floorPos = (Vec2*)(instances + active);
+	Vec2* floorNormal = floorPos + active;
+	float32* coordX = (float32*)(floorNormal + active);
+
+	// Everything is at the same depth, so no sorting. Floor coordinates go to world space in one batch.
+	for (int i = 0; i < active; i++) {
+		coordX[i] = ps->posX[i];
+	}
+	ps->floor->GetInfoFromCoordXBatch(coordX, active, floorPos, floorNormal);
+	for (int i = 0; i < active; i++) {
+		Vec2 pos = floorPos[i] + floorNormal[i] * ps->posY[i];
+		PackParticleInstance(ps, i, ToVec3(pos, 0.0f), &instances[i]);
+	}
+
+	DrawParticleInstances(psGL, ps, instances, active, camRight, camUp, transform);
+}
@@ -3,6 +3,9 @@
 #include <km_common/km_math.h>
 #include <km_platform/main_platform.h>
 
+#include "collision.h"
+#include "jobs.h"
+#include "random.h"
 #include "opengl.h"
 #include "opengl_base.h"
 
@@ -10,6 +13,11 @@
 #define MAX_SPAWN (MAX_PARTICLES / 10)
 #define MAX_ATTRACTORS 50
 #define MAX_COLLIDERS 20
+// Uniform random floats in [0, 1) handed to InitParticleFunction for each particle
+#define PARTICLE_INIT_RANDOMS 8
+
+#define PARTICLE_GRID_SIZE 32
+#define PARTICLE_GRID_ENTRIES_MAX 8192
 
 enum ColliderType
 {
@@ -17,6 +25,8 @@ enum ColliderType
 	COLLIDER_BOUNCE
 };
 
+// A single particle's initial state, filled in by InitParticleFunction and then
+// scattered into the system's per-field arrays
 struct Particle
 {
 	float32 life;
@@ -26,8 +36,6 @@ struct Particle
 	Vec2 size;
 	float32 bounceMult;
 	float32 frictionMult;
-
-	float32 depth;
 };
 
 struct Attractor
@@ -58,13 +66,48 @@ struct SphereCollider
 	float32 radius;
 };
 
+// Coarse grid over the XY bounds of the box, sphere and line colliders, listing the colliders that overlap
+// each cell. Each particle only tests the colliders in its cell. Plane colliders are unbounded and always tested.
+struct ParticleColliderGrid
+{
+	bool valid; // if false (too many entries), every collider is tested
+	Vec2 min;
+	Vec2 invCellSize;
+	// Cell c's entries are entries[cellStart[c]] to entries[cellStart[c + 1] - 1]
+	uint16 cellStart[PARTICLE_GRID_SIZE * PARTICLE_GRID_SIZE + 1];
+	uint16 entries[PARTICLE_GRID_ENTRIES_MAX]; // collider type in the top 2 bits, index in the rest
+};
+
 struct ParticleSystem;
-typedef void (*InitParticleFunction)(ParticleSystem*, Particle*, void* data);
+// random holds PARTICLE_INIT_RANDOMS floats from the system's generator, made in bulk ahead of spawning
+typedef void (*InitParticleFunction)(ParticleSystem*, Particle*, const float32* random, void* data);
 
+// Particle data is stored one array per field, so the update kernels can process
+// 4 particles at a time. The arrays live in the ParticlePool, sized to a whole number of
+// pool blocks (a multiple of 4), and lanes past the active count are scratch.
 struct ParticleSystem
 {
-	Particle particles[MAX_PARTICLES];
+	float32* life;
+	float32* posX;
+	float32* posY;
+	float32* posZ;
+	float32* velX;
+	float32* velY;
+	float32* velZ;
+	Vec3* color;
+	float32* alpha;
+	Vec2* size;
+	float32* bounceMult;
+	float32* frictionMult;
+	uint32 poolBlockStart;
+	uint32 poolBlockCount;
+
 	float32 spawnCounter;
+	// CPU time budget for UpdateParticleSystem in seconds, 0 if unlimited. Emission is
+	// scaled by emissionScale, which drops while the smoothed updateTime is over budget.
+	float32 updateBudget;
+	float32 updateTime;
+	float32 emissionScale;
 	int active;
 
 	int maxParticles;
@@ -86,26 +129,54 @@ struct ParticleSystem
 	SphereCollider sphereColliders[MAX_COLLIDERS];
 	int numSphereColliders;
 
+	// Optional level terrain. When set, particle positions are floor coordinates (x along the floor, y height)
+	// and particles collide with the floor and the tops of the line colliders.
+	const FloorCollider* floor;
+	const LineCollider* lineColliders;
+	int numLineColliders;
+	ColliderType terrainType;
+
+	ParticleColliderGrid colliderGrid;
+
 	InitParticleFunction initParticleFunc;
+	RandomStateX4 random;
 
 	GLuint texture;
 };
 
+#define PARTICLE_SYSTEMS_MAX 64
+#define PARTICLE_RANDOM_SEED 0x6b6964ull
+#define PARTICLE_POOL_BLOCK_PARTICLES 256
+#define PARTICLE_POOL_BLOCKS_MAX 4096
+
+// Owns every particle system and their particle storage. Each system gets a contiguous run of
+// fixed-size blocks, enough for its maxParticles, which go back to the pool when it's destroyed.
+struct ParticlePool
+{
+	ParticleSystem systems[PARTICLE_SYSTEMS_MAX];
+	bool systemUsed[PARTICLE_SYSTEMS_MAX];
+
+	uint32 numBlocks;
+	bool blockUsed[PARTICLE_POOL_BLOCKS_MAX];
+	uint8* blockData;
+};
+
 struct ParticleSystemGL
 {
 	GLuint vertexArray;
 	GLuint vertexBuffer;
 	GLuint uvBuffer;
-	GLuint posBuffer;
-	GLuint colorBuffer;
-	GLuint sizeBuffer;
+	GLuint instanceBuffer;
 	GLuint programID;
 };
 
 template <typename Allocator>
 ParticleSystemGL InitParticleSystemGL(Allocator* allocator);
 
-void CreateParticleSystem(ParticleSystem* ps, int maxParticles,
+// Uses memory for as many pool blocks as fit, up to PARTICLE_POOL_BLOCKS_MAX
+bool InitParticlePool(ParticlePool* pool, MemoryBlock memory);
+// Returns nullptr if the pool is out of systems or contiguous blocks
+ParticleSystem* CreateParticleSystem(ParticlePool* pool, int maxParticles,
 	int particlesPerSec, float32 maxLife, Vec3 gravity,
 	float32 linearDamp, float32 quadraticDamp,
 	Attractor* attractors, int numAttractors,
@@ -113,9 +184,23 @@ void CreateParticleSystem(ParticleSystem* ps, int maxParticles,
 	AxisBoxCollider* boxColliders, int numBoxColliders,
 	SphereCollider* sphereColliders, int numSphereColliders,
 	InitParticleFunction initParticleFunc, GLuint texture);
+void DestroyParticleSystem(ParticlePool* pool, ParticleSystem* ps);
+void SetParticleSystemBudget(ParticleSystem* ps, float32 updateBudget);
+// Systems are seeded with PARTICLE_RANDOM_SEED and their pool index on creation
+void SeedParticleSystem(ParticleSystem* ps, uint64 seed);
+// Transient memory needed to draw a system with the given number of particles
+uint64 GetParticleSystemDrawMemorySize(int numParticles);
+// Must be called again whenever the system's colliders or terrain change
+void BuildParticleColliderGrid(ParticleSystem* ps);
+void SetParticleSystemTerrain(ParticleSystem* ps, const FloorCollider* floor,
+	const LineCollider* lineColliders, int numLineColliders, ColliderType type);
 void ParticleBurst(ParticleSystem* ps, int numParticles, void* data);
-void UpdateParticleSystem(ParticleSystem* ps, float32 deltaTime, void* data);
+void UpdateParticleSystem(ParticleSystem* ps, float32 deltaTime, void* data, const JobSystem& jobSystem);
+// For 3D systems, particles are depth sorted
 void DrawParticleSystem(ParticleSystemGL psGL,
 	ParticleSystem* ps,
 	Vec3 camRight, Vec3 camUp, Vec3 camPos, Mat4 proj, Mat4 view,
-	MemoryBlock transient);
\ No newline at end of file
+	MemoryBlock transient);
+// For systems in floor coordinates (see SetParticleSystemTerrain), drawn with the world sprites' transform
+void DrawParticleSystem2D(ParticleSystemGL psGL, ParticleSystem* ps,
+	Vec3 camRight, Vec3 camUp, Mat4 transform, MemoryBlock transient);
@@ -0,0 +1,117 @@
+#include "physics.h"
+
+#include <km_common/km_debug.h>
+
+#include "asset_level.h"
+
+void InitPhysicsWorld(PhysicsWorld* world, Vec2 gravity, float32 groundFriction)
+{
+    world->gravity = gravity;
+    world->groundFriction = groundFriction;
+    world->numBodies = 0;
+}
+
+uint64 AddPhysicsBody(PhysicsWorld* world, Vec2 coords, float32 radius)
+{
+    if (world->numBodies >= PHYSICS_BODIES_MAX) {
+        LOG_ERROR("Physics world is full (%d bodies)\n", PHYSICS_BODIES_MAX);
+        return PHYSICS_BODIES_MAX;
+    }
+
+    uint64 index = world->numBodies++;
+    world->coords[index] = coords;
+    world->vel[index] = Vec2::zero;
+    world->radius[index] = radius;
+    world->platform[index] = nullptr;
+    world->grounded[index] = false;
+    world->deltaCoords[index] = Vec2::zero;
+    return index;
+}
+
+void UpdatePhysicsWorld(PhysicsWorld* world, const FloorCollider& floor, const Array<LineCollider>& lineColliders,
+                        float32 movementMargin, float32 deltaTime)
+{
+    const uint64 numBodies = world->numBodies;
+
+    // Integrate velocities. Grounded bodies don't accumulate gravity, and lose horizontal speed to friction.
+    const Vec2 gravityDelta = world->gravity * deltaTime;
+    const float32 frictionMult = 1.0f / (1.0f + world->groundFriction * deltaTime);
+    for (uint64 i = 0; i < numBodies; i++) {
+        if (world->grounded[i]) {
+            world->vel[i].x *= frictionMult;
+        }
+        else {
+            world->vel[i] += gravityDelta;
+        }
+        world->deltaCoords[i] = world->vel[i] * deltaTime;
+    }
+
+    // Sweep moving bodies against line colliders, same rules as the player: land on walkable platforms while
+    // falling, stop at walls
+    const float32 COS_WALK_ANGLE = cosf(PI_F / 4.0f);
+    FixedArray<LineColliderIntersect, LINE_COLLIDERS_MAX> intersects;
+    for (uint64 i = 0; i < numBodies; i++) {
+        const Vec2 deltaCoords = world->deltaCoords[i];
+        if (deltaCoords.x == 0.0f && deltaCoords.y == 0.0f) {
+            continue;
+        }
+
+        GetLineColliderIntersectionsAlongFloor(lineColliders, floor, world->coords[i], deltaCoords,
+                                               movementMargin, &intersects);
+        for (uint64 j = 0; j < intersects.size; j++) {
+            if (world->platform[i] == intersects[j].collider) {
+                continue;
+            }
+
+            float32 newDeltaCoordX = deltaCoords.x * intersects[j].t;
+            Vec2 floorPos, floorNormal;
+            floor.GetInfoFromCoordX(world->coords[i].x + newDeltaCoordX, &floorPos, &floorNormal);
+            if (AbsFloat32(Dot(floorNormal, intersects[j].normal)) >= COS_WALK_ANGLE) {
+                if (deltaCoords.y < 0.0f) {
+                    world->platform[i] = intersects[j].collider;
+                    world->deltaCoords[i].x = newDeltaCoordX;
+                    break;
+                }
+            }
+            else {
+                world->deltaCoords[i] = Vec2::zero;
+                world->vel[i].x = 0.0f;
+                break;
+            }
+        }
+    }
+
+    // Apply movement and resolve support against the floor or the current platform
+    for (uint64 i = 0; i < numBodies; i++) {
+        Vec2 coordsNew = world->coords[i] + world->deltaCoords[i];
+
+        float32 supportHeight = 0.0f;
+        if (world->platform[i] != nullptr) {
+            float32 platformHeight;
+            if (GetLineColliderCoordYFromFloorCoordX(*world->platform[i], floor, coordsNew.x, &platformHeight)) {
+                supportHeight = platformHeight;
+            }
+            else {
+                world->platform[i] = nullptr;
+            }
+        }
+
+        const bool onPlatform = world->platform[i] != nullptr && world->vel[i].y <= 0.0f;
+        if (coordsNew.y <= supportHeight || onPlatform) {
+            coordsNew.y = supportHeight;
+            world->vel[i].y = 0.0f;
+            world->grounded[i] = true;
+        }
+        else {
+            world->grounded[i] = false;
+        }
+
+        if (coordsNew.x < 0.0f) {
+            coordsNew.x += floor.length;
+        }
+        else if (coordsNew.x > floor.length) {
+            coordsNew.x -= floor.length;
+        }
+        world->coords[i] = coordsNew;
+    }
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <km_common/km_lib.h>
+#include <km_common/km_math.h>
+
+#include "collision.h"
+
+#define PHYSICS_BODIES_MAX 256
+
+// Bodies that move along the floor (coordinates are floor-space, y = 0 is the floor, coords are the bottom of
+// the body). Stored one array per field so the integration passes stream through memory.
+struct PhysicsWorld
+{
+    Vec2 gravity;
+    float32 groundFriction;
+
+    uint64 numBodies;
+    Vec2 coords[PHYSICS_BODIES_MAX];
+    Vec2 vel[PHYSICS_BODIES_MAX];
+    float32 radius[PHYSICS_BODIES_MAX];
+    const LineCollider* platform[PHYSICS_BODIES_MAX];
+    bool grounded[PHYSICS_BODIES_MAX];
+
+    // Per-tick scratch, filled by the integration pass
+    Vec2 deltaCoords[PHYSICS_BODIES_MAX];
+};
+
+void InitPhysicsWorld(PhysicsWorld* world, Vec2 gravity, float32 groundFriction);
+// Returns the index of the new body, or PHYSICS_BODIES_MAX if the world is full
+uint64 AddPhysicsBody(PhysicsWorld* world, Vec2 coords, float32 radius);
+
+void UpdatePhysicsWorld(PhysicsWorld* world, const FloorCollider& floor, const Array<LineCollider>& lineColliders,
+                        float32 movementMargin, float32 deltaTime);
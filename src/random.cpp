@@ -0,0 +1,128 @@
+#include "random.h"
+
+#include <emmintrin.h>
+#include <km_common/km_debug.h>
+
+// Multiplier for 24 random bits to a float in [0, 1)
+#define RANDOM_FLOAT_SCALE (1.0f / 16777216.0f)
+
+// splitmix64, spreads seeds that differ in a few bits over the whole state
+internal uint64 SplitMix64(uint64* x)
+{
+	uint64 z = (*x += 0x9e3779b97f4a7c15ull);
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+	return z ^ (z >> 31);
+}
+
+internal void SeedXoshiro128(uint32 s[4], uint64 seed, uint64 stream)
+{
+	uint64 x = seed ^ SplitMix64(&stream);
+	uint64 a = SplitMix64(&x);
+	uint64 b = SplitMix64(&x);
+	s[0] = (uint32)a;
+	s[1] = (uint32)(a >> 32);
+	s[2] = (uint32)b;
+	s[3] = (uint32)(b >> 32);
+	if ((s[0] | s[1] | s[2] | s[3]) == 0) {
+		// All-zero state only ever outputs zeros
+		s[0] = 1;
+	}
+}
+
+internal inline uint32 RotateLeft(uint32 x, int k)
+{
+	return (x << k) | (x >> (32 - k));
+}
+
+void SeedRandom(RandomState* random, uint64 seed, uint64 stream)
+{
+	SeedXoshiro128(random->s, seed, stream);
+}
+
+void SeedRandom(RandomStateX4* random, uint64 seed, uint64 stream)
+{
+	for (int lane = 0; lane < 4; lane++) {
+		uint32 s[4];
+		SeedXoshiro128(s, seed, stream * 4 + lane);
+		for (int w = 0; w < 4; w++) {
+			random->s[w][lane] = s[w];
+		}
+	}
+}
+
+uint32 RandUInt32(RandomState* random)
+{
+	uint32* s = random->s;
+	const uint32 result = s[0] + s[3];
+	const uint32 t = s[1] << 9;
+
+	s[2] ^= s[0];
+	s[3] ^= s[1];
+	s[1] ^= s[2];
+	s[0] ^= s[3];
+	s[2] ^= t;
+	s[3] = RotateLeft(s[3], 11);
+
+	return result;
+}
+
+float32 RandFloat32(RandomState* random)
+{
+	// The low bits of xoshiro128+ are weak, use the top 24
+	return (float32)(RandUInt32(random) >> 8) * RANDOM_FLOAT_SCALE;
+}
+
+float32 RandFloat32(RandomState* random, float32 min, float32 max)
+{
+	DEBUG_ASSERT(max > min);
+	return RandFloat32(random) * (max - min) + min;
+}
+
+int RandInt(RandomState* random, int min, int max)
+{
+	DEBUG_ASSERT(max > min);
+	// Multiply-shift range reduction, uses the high bits and avoids a divide
+	uint64 range = (uint64)((int64)max - (int64)min);
+	return min + (int)(((uint64)RandUInt32(random) * range) >> 32);
+}
+
+void RandFloat32Batch(RandomStateX4* random, float32* out, uint64 n)
+{
+	__m128i s0 = _mm_loadu_si128((const __m128i*)random->s[0]);
+	__m128i s1 = _mm_loadu_si128((const __m128i*)random->s[1]);
+	__m128i s2 = _mm_loadu_si128((const __m128i*)random->s[2]);
+	__m128i s3 = _mm_loadu_si128((const __m128i*)random->s[3]);
+	const __m128 scale = _mm_set1_ps(RANDOM_FLOAT_SCALE);
+
+	uint64 i = 0;
+	while (i < n) {
+		const __m128i result = _mm_add_epi32(s0, s3);
+		const __m128i t = _mm_slli_epi32(s1, 9);
+		s2 = _mm_xor_si128(s2, s0);
+		s3 = _mm_xor_si128(s3, s1);
+		s1 = _mm_xor_si128(s1, s2);
+		s0 = _mm_xor_si128(s0, s3);
+		s2 = _mm_xor_si128(s2, t);
+		s3 = _mm_or_si128(_mm_slli_epi32(s3, 11), _mm_srli_epi32(s3, 21));
+
+		// Top 24 bits fit a float exactly, and are non-negative as int32
+		const __m128 floats = _mm_mul_ps(_mm_cvtepi32_ps(_mm_srli_epi32(result, 8)), scale);
+		if (n - i >= 4) {
+			_mm_storeu_ps(out + i, floats);
+			i += 4;
+		}
+		else {
+			float32 last[4];
+			_mm_storeu_ps(last, floats);
+			for (int lane = 0; i < n; lane++, i++) {
+				out[i] = last[lane];
+			}
+		}
+	}
+
+	_mm_storeu_si128((__m128i*)random->s[0], s0);
+	_mm_storeu_si128((__m128i*)random->s[1], s1);
+	_mm_storeu_si128((__m128i*)random->s[2], s2);
+	_mm_storeu_si128((__m128i*)random->s[3], s3);
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <km_common/km_defines.h>
+
+// xoshiro128+ generators (Blackman & Vigna). Unlike libc rand(), these are fast, lock-free and give the same
+// sequence on every platform for a given seed.
+struct RandomState
+{
+	uint32 s[4];
+};
+
+// 4 independent xoshiro128+ streams stepped together with SSE, for generating floats in bulk
+struct RandomStateX4
+{
+	uint32 s[4][4]; // [state word][lane]
+};
+
+// Different streams from the same seed give unrelated sequences, e.g. one per job index or per system,
+// so results stay reproducible no matter which thread runs what.
+void SeedRandom(RandomState* random, uint64 seed, uint64 stream);
+void SeedRandom(RandomStateX4* random, uint64 seed, uint64 stream);
+
+uint32 RandUInt32(RandomState* random);
+// In [0, 1)
+float32 RandFloat32(RandomState* random);
+// In [min, max)
+float32 RandFloat32(RandomState* random, float32 min, float32 max);
+// In [min, max)
+int RandInt(RandomState* random, int min, int max);
+
+// Fills out with n floats in [0, 1)
+void RandFloat32Batch(RandomStateX4* random, float32* out, uint64 n);
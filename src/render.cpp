@@ -132,7 +132,7 @@ bool InitRenderState(Allocator* allocator, RenderState& renderState)
 	return true;
 }
 
-void PushSprite(SpriteDataGL* spriteDataGL, Mat4 transform, float32 alpha, GLuint texture)
+void PushSprite(SpriteDataGL* spriteDataGL, Mat4 transform, Vec4 uvInfo, float32 alpha, GLuint texture)
 {
 	DEBUG_ASSERT(spriteDataGL->numSprites < SPRITE_BATCH_SIZE);
     
@@ -142,22 +142,22 @@ void PushSprite(SpriteDataGL* spriteDataGL, Mat4 transform, float32 alpha, GLuin
         transform = flipMatrix * transform;
     }*/
 	spriteDataGL->transform[spriteInd] = transform;
-	spriteDataGL->uvInfo[spriteInd] = Vec4 {
-		0.0f, 0.0f,
-		1.0f, 1.0f
-	};
-	/*if (flipHorizontal) {
-		spriteDataGL->uvInfo[spriteInd] = Vec4 {
-			1.0f, 0.0f,
-			-1.0f, 1.0f
-		};
-	}*/
+	spriteDataGL->uvInfo[spriteInd] = uvInfo;
     spriteDataGL->alpha[spriteInd] = alpha;
 	spriteDataGL->texture[spriteInd] = texture;
     
 	spriteDataGL->numSprites++;
 }
 
+void PushSprite(SpriteDataGL* spriteDataGL, Mat4 transform, float32 alpha, GLuint texture)
+{
+	const Vec4 uvInfo = {
+		0.0f, 0.0f,
+		1.0f, 1.0f
+	};
+	PushSprite(spriteDataGL, transform, uvInfo, alpha, texture);
+}
+
 void DrawSprites(const RenderState& renderState,
                  const SpriteDataGL& spriteDataGL, Mat4 transform)
 {
@@ -176,7 +176,9 @@ void DrawSprites(const RenderState& renderState,
     
 	// TODO revamp this eventually. Right now it's clearly the wrong data model
 	for (int i = 0; i < spriteDataGL.numSprites; i++) {
-		glBindTexture(GL_TEXTURE_2D, spriteDataGL.texture[i]);
+		if (i == 0 || spriteDataGL.texture[i] != spriteDataGL.texture[i - 1]) {
+			glBindTexture(GL_TEXTURE_2D, spriteDataGL.texture[i]);
+		}
         
 		loc = glGetUniformLocation(programID, "transform");
 		glUniformMatrix4fv(loc, 1, GL_FALSE, &spriteDataGL.transform[i].e[0][0]);
@@ -26,8 +26,7 @@ struct SpriteDataGL
 	Vec4 uvInfo[SPRITE_BATCH_SIZE];
     float32 alpha[SPRITE_BATCH_SIZE];
     
-	// TODO temporary, probably make a sprite sheet and put this in uvInfo
-    // otherwise it's very inefficient, prevents batching
+	// Sprites in a row with the same texture (e.g. frames from one animation atlas) share a texture bind
 	GLuint texture[SPRITE_BATCH_SIZE];
 };
 
@@ -39,6 +38,8 @@ template <typename Allocator>
 bool InitRenderState(Allocator* allocator, RenderState& renderState);
 
 void PushSprite(SpriteDataGL* spriteDataGL, Mat4 transform, float32 alpha, GLuint texture);
+// For a sprite in part of a texture. uvInfo is the UV origin, then size.
+void PushSprite(SpriteDataGL* spriteDataGL, Mat4 transform, Vec4 uvInfo, float32 alpha, GLuint texture);
 
 void DrawSprites(const RenderState& renderState,
                  const SpriteDataGL& spriteDataGL, Mat4 transform);
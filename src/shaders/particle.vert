@@ -2,6 +2,7 @@
 
 layout(location = 0) in vec3 squareVerts;
 layout(location = 1) in vec2 uvs;
+// Per-instance, interleaved in one buffer: float3 center, normalized RGBA8 color, half2 size
 layout(location = 2) in vec3 center;
 layout(location = 3) in vec4 color;
 layout(location = 4) in vec2 size;
@@ -2,7 +2,10 @@
 #include <stdio.h>
 #include <stdlib.h>
 
+#include "audio_mixer.h"
+#include "jobs.h"
 #include "load_psd.h"
+#include "particles.h"
 
 void LogString(const char* string, uint64 n)
 {
@@ -52,6 +55,183 @@ void PlatformFlushLogs(LogState* logState)
     // }
 }
 
+internal void InitBenchmarkParticle(ParticleSystem* ps, Particle* particle, const float32* r, void* data)
+{
+    particle->life = r[0] * ps->maxLife;
+    particle->pos = Vec3 { r[1], r[2], r[3] };
+    particle->vel = Vec3 { r[4] - 0.5f, r[5] * 3.0f, r[6] - 0.5f };
+    particle->color = Vec4::one;
+    particle->size = Vec2 { 0.1f, 0.1f };
+    particle->bounceMult = 0.5f;
+    particle->frictionMult = 0.5f;
+}
+
+// Particle update cycles at different thread counts. The checksum should match across thread counts.
+internal int BenchmarkParticleUpdate(void* memory, uint64 memorySize)
+{
+    LinearAllocator allocator(memorySize, memory);
+    ParticlePool* pool = (ParticlePool*)allocator.Allocate(sizeof(ParticlePool));
+    MemoryBlock poolMemory;
+    poolMemory.size = MEGABYTES(64);
+    poolMemory.memory = allocator.Allocate(poolMemory.size);
+    if (!InitParticlePool(pool, poolMemory)) {
+        LOG_ERROR("Failed to init particle pool\n");
+        LOG_FLUSH();
+        return 1;
+    }
+
+    const int THREAD_COUNTS[] = { 1, 2, 4, 8 };
+    const int ITERATIONS = 256;
+    const float32 DELTA_TIME = 1.0f / 120.0f;
+    Attractor attractors[] = {
+        { Vec3 { 0.0f, 2.0f, 0.0f }, 1.0f },
+        { Vec3 { 1.0f, 0.0f, 1.0f }, 0.5f },
+        { Vec3 { -1.0f, 1.0f, 0.0f }, 0.3f }
+    };
+
+    LOG_INFO("Starting particle benchmark (%d particles)\n", MAX_PARTICLES);
+    for (int t = 0; t < (int)C_ARRAY_LENGTH(THREAD_COUNTS); t++) {
+        ParticleSystem* ps = CreateParticleSystem(pool, MAX_PARTICLES, 20000, 3.0f, Vec3 { 0.0f, -9.8f, 0.0f },
+                                                  0.1f, 0.02f,
+                                                  attractors, (int)C_ARRAY_LENGTH(attractors),
+                                                  nullptr, 0, nullptr, 0, nullptr, 0,
+                                                  InitBenchmarkParticle, 0);
+        if (ps == nullptr) {
+            LOG_ERROR("Failed to create particle system\n");
+            LOG_FLUSH();
+            return 1;
+        }
+        SeedParticleSystem(ps, 1);
+        ParticleBurst(ps, MAX_PARTICLES, nullptr);
+
+        JobSystem jobSystem = CreateJobSystem(THREAD_COUNTS[t]);
+        uint64 cyclesStart = __rdtsc();
+        for (int i = 0; i < ITERATIONS; i++) {
+            UpdateParticleSystem(ps, DELTA_TIME, nullptr, jobSystem);
+        }
+        uint64 cyclesEnd = __rdtsc();
+
+        float64 checksum = 0.0;
+        for (int i = 0; i < ps->active; i++) {
+            checksum += ps->posX[i] * (i % 13) + ps->velY[i];
+        }
+        double cyclesPerIteration = (double)(cyclesEnd - cyclesStart) / (double)ITERATIONS;
+        LOG_INFO("    %d threads: %.0f cycles per update, %d active, checksum %f\n",
+                 THREAD_COUNTS[t], cyclesPerIteration, ps->active, checksum);
+        DestroyParticleSystem(pool, ps);
+    }
+    LOG_FLUSH();
+
+    return 0;
+}
+
+// Mixer cycles for one platform-sized chunk with every voice playing, like a crowded scene
+internal int BenchmarkAudioMix(void* memory, uint64 memorySize)
+{
+    const uint64 FILL_LENGTH = 48000 / 60;
+    const int ITERATIONS = 100; // short enough that no voice finishes
+    const uint64 CLIP_SAMPLES = 48000 * 2;
+
+    LinearAllocator allocator(memorySize, memory);
+    AudioBuffer* clip = (AudioBuffer*)allocator.Allocate(sizeof(AudioBuffer));
+    clip->buffer = (float32*)allocator.Allocate(CLIP_SAMPLES * 2 * sizeof(float32));
+    AudioMixer* mixer = (AudioMixer*)allocator.Allocate(sizeof(AudioMixer));
+    float32* buffer = (float32*)allocator.Allocate(FILL_LENGTH * 2 * sizeof(float32));
+
+    RandomState random;
+    SeedRandom(&random, 1, 0);
+    clip->sampleRate = 48000;
+    clip->channels = 2;
+    clip->bufferSizeSamples = CLIP_SAMPLES;
+    clip->format = AudioFormat::FLOAT32;
+    clip->adpcmBlocks = nullptr;
+    for (uint64 i = 0; i < CLIP_SAMPLES * 2; i++) {
+        clip->buffer[i] = RandFloat32(&random, -1.0f, 1.0f);
+    }
+
+    InitAudioMixer(mixer);
+    for (int i = 0; i < AUDIO_VOICES_MAX; i++) {
+        PlayVoice(mixer, i + 1, clip, AudioBusId::SFX, RandFloat32(&random, 0.1f, 1.0f), RandFloat32(&random, -1.0f, 1.0f), 0);
+    }
+
+    LOG_INFO("Starting audio mix benchmark (%d voices, %llu samples per chunk)\n",
+             mixer->numVoices, FILL_LENGTH);
+    uint64 cyclesStart = __rdtsc();
+    for (int i = 0; i < ITERATIONS; i++) {
+        AdvanceVoices(mixer, FILL_LENGTH);
+        MixVoices(mixer, AudioBusId::SFX, buffer, FILL_LENGTH);
+    }
+    uint64 cyclesEnd = __rdtsc();
+
+    float64 checksum = 0.0;
+    for (uint64 i = 0; i < FILL_LENGTH * 2; i++) {
+        checksum += buffer[i];
+    }
+    double cyclesPerIteration = (double)(cyclesEnd - cyclesStart) / (double)ITERATIONS;
+    LOG_INFO("    %.0f cycles per chunk, %d voices, checksum %f\n",
+             cyclesPerIteration, mixer->numVoices, checksum);
+
+    // Same again with every voice resampled, restarted so none finish
+    for (int i = 0; i < mixer->numVoices; i++) {
+        mixer->voices[i].sampleIndex = 0;
+        SetVoicePitch(mixer, mixer->voices[i].id, RandFloat32(&random, 0.5f, 1.5f));
+    }
+    cyclesStart = __rdtsc();
+    for (int i = 0; i < ITERATIONS / 2; i++) {
+        AdvanceVoices(mixer, FILL_LENGTH);
+        MixVoices(mixer, AudioBusId::SFX, buffer, FILL_LENGTH);
+    }
+    cyclesEnd = __rdtsc();
+    cyclesPerIteration = (double)(cyclesEnd - cyclesStart) / (double)(ITERATIONS / 2);
+    LOG_INFO("    pitched: %.0f cycles per chunk, %d voices\n", cyclesPerIteration, mixer->numVoices);
+
+    // And unpitched again from an ADPCM copy of the clip, decoded as it's mixed
+    uint64 numBlocks = GetAdpcmBlockCount(CLIP_SAMPLES);
+    clip->adpcmBlocks = (AdpcmBlock*)allocator.Allocate(numBlocks * sizeof(AdpcmBlock));
+    EncodeAdpcm(clip->buffer, CLIP_SAMPLES, clip->adpcmBlocks);
+    clip->format = AudioFormat::ADPCM;
+    for (int i = 0; i < mixer->numVoices; i++) {
+        mixer->voices[i].sampleIndex = 0;
+        mixer->voices[i].sampleFraction = 0.0f;
+        SetVoicePitch(mixer, mixer->voices[i].id, 1.0f);
+    }
+    cyclesStart = __rdtsc();
+    for (int i = 0; i < ITERATIONS; i++) {
+        AdvanceVoices(mixer, FILL_LENGTH);
+        MixVoices(mixer, AudioBusId::SFX, buffer, FILL_LENGTH);
+    }
+    cyclesEnd = __rdtsc();
+    cyclesPerIteration = (double)(cyclesEnd - cyclesStart) / (double)ITERATIONS;
+    LOG_INFO("    adpcm: %.0f cycles per chunk, %d voices\n", cyclesPerIteration, mixer->numVoices);
+
+    // Bus DSP on its own, with every effect on: filters on all buses and reverb sends from the source buses
+    AudioBusGraph* busGraph = (AudioBusGraph*)allocator.Allocate(sizeof(AudioBusGraph));
+    InitAudioBusGraph(busGraph, 48000);
+    for (int b = 0; b < (int)AudioBusId::COUNT; b++) {
+        AudioBusParams params = { 0.8f, 8000.0f, 80.0f, b == (int)AudioBusId::MASTER ? 0.0f : 0.3f };
+        SetAudioBusParams(busGraph, (AudioBusId)b, params);
+    }
+    for (int b = 0; b < (int)AudioBusId::MASTER; b++) {
+        for (int i = 0; i < AUDIO_BUS_BLOCK_SAMPLES * 2; i++) {
+            busGraph->buses[b].buffer[i] = RandFloat32(&random, -1.0f, 1.0f);
+        }
+    }
+    cyclesStart = __rdtsc();
+    for (int i = 0; i < ITERATIONS; i++) {
+        BeginAudioBusBlock(busGraph);
+        for (int b = 0; b < (int)AudioBusId::MASTER; b++) {
+            ProcessAudioBus(busGraph, (AudioBusId)b);
+        }
+        ProcessMasterBus(busGraph, buffer);
+    }
+    cyclesEnd = __rdtsc();
+    cyclesPerIteration = (double)(cyclesEnd - cyclesStart) / (double)ITERATIONS;
+    LOG_INFO("    buses: %.0f cycles per %d-sample block\n", cyclesPerIteration, AUDIO_BUS_BLOCK_SAMPLES);
+    LOG_FLUSH();
+
+    return 0;
+}
+
 int main(int argc, char** argv)
 {
     LogState* logState = (LogState*)malloc(sizeof(LogState));
@@ -62,6 +242,13 @@ int main(int argc, char** argv)
     const uint64 memorySize = GIGABYTES(1);
     void* memory = malloc(memorySize);
 
+    if (argc > 1 && StringEquals(ToString(argv[1]), ToString("particles"))) {
+        return BenchmarkParticleUpdate(memory, memorySize);
+    }
+    if (argc > 1 && StringEquals(ToString(argv[1]), ToString("audio"))) {
+        return BenchmarkAudioMix(memory, memorySize);
+    }
+
     const_string psdFilePath = ToString("data/levels/overworld/overworld.psd");
     PsdFile psdFile;
     if (!OpenPSD(&defaultAllocator_, psdFilePath, &psdFile)) {
@@ -110,7 +297,15 @@ int main(int argc, char** argv)
     return 0;
 }
 
+#include "asset_audio.cpp"
+#include "audio_bus.cpp"
+#include "audio_mixer.cpp"
+#include "audio_resample.cpp"
+#include "collision.cpp"
+#include "jobs.cpp"
 #include "load_psd.cpp"
+#include "particles.cpp"
+#include "random.cpp"
 
 #define STB_SPRINTF_IMPLEMENTATION
 #include <stb_sprintf.h>